@@ -1,7 +1,10 @@
 #version 330 core
 
-in vec3 position;
-in vec3 normal;
+// Locations of the merged scene buffers, per vertex then per mesh
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec4 color;
+layout(location = 5) in uint meshIdx;
 
 out struct {
 	vec3 position;
@@ -16,25 +19,29 @@ out struct {
 
 out vec3 viewPosition;
 
-uniform mat4 uModel;
-uniform mat4 uView;
-uniform mat4 uProjection;
-uniform vec4 uColor;
+// Must match 'Frame_Uniforms'
+layout(std140) uniform Frame {
+	mat4 uModel;
+	mat4 uView;
+	mat4 uProjection;
+	mat4 uNormalMatrix;
+	vec4 uViewPosition;
+	vec4 uLightPosition;
+	vec4 uLightColor;
+};
 
-uniform vec3 uViewPosition;
-
-uniform vec3 uLightPosition;
-uniform vec3 uLightColor;
+uniform int uPickedMesh;
+uniform vec4 uPickedColor;
 
 void main() {
 	vertex.position = vec3(uModel * vec4(position, 1.0f));
-	vertex.normal = normalize(mat3(transpose(inverse(uModel))) * normal);
-	vertex.color = uColor;
+	vertex.normal = normalize(mat3(uNormalMatrix) * normal);
+	vertex.color = (int(meshIdx) == uPickedMesh) ? uPickedColor : color;
 
-	viewPosition = vec3(uModel * vec4(uViewPosition, 1.0f));
+	viewPosition = vec3(uModel * uViewPosition);
 
-	light.position = vec3(uModel * vec4(uLightPosition, 1.0f));
-	light.color = uLightColor;
+	light.position = vec3(uModel * uLightPosition);
+	light.color = uLightColor.rgb;
 
 	gl_Position = uProjection * uView * vec4(vertex.position, 1.0f);
 }
\ No newline at end of file
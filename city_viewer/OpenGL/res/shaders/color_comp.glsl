@@ -1,51 +1,56 @@
 #version 430
 
-layout(std430, binding = 0) buffer ColorBuffer {
-	float colorPixels[];
-};
+#define GROUP_SIZE 256
+
+layout(local_size_x = GROUP_SIZE) in;
+
+layout(binding = 0) uniform usampler2DArray uClassTexture;
 
-layout(std430, binding = 1) buffer IndicesBuffer {
-	uint colorIndices[];
+// Layer of the camera setup being reduced
+uniform int uLayer;
+
+layout(std430, binding = 0) buffer ResultBuffer {
+	//   0      1         2        3       4      5
+	// [Sky, Building, Amenity, Landmark, Tree, Water]
+	uint colorIndices[6];
+	uint minDepthBits;
+	uint maxDepthBits;
+	float depthSum;
 };
 
-uniform uint color_len;
-uniform uint color_num_channels;
+shared uint localIndices[6];
 
-uint get_mesh_type(float r, float g, float b) {
-	if (r == 1.0f && g == 0.0f && b == 0.0f) {
-		return 1; // Building
+void main() {
+	uint localIdx = gl_LocalInvocationIndex;
+	if (localIdx < 6) {
+		localIndices[localIdx] = 0;
 	}
 
-	if (r == 1.0f && g == 1.0f && b == 0.0f) {
-		return 2; // Amenity
-	}
+	// Each invocation walks the frame with a grid stride and counts privately first
+	uint counts[6] = uint[6](0, 0, 0, 0, 0, 0);
 
-	if (r == 1.0f && g == 0.0f && b == 1.0f) {
-		return 3; // Landmark
-	}
+	ivec2 size = textureSize(uClassTexture, 0).xy;
+	uint pixelCount = uint(size.x * size.y);
+	uint stride = gl_NumWorkGroups.x * GROUP_SIZE;
 
-	if (r == 0.0f && g == 1.0f && b == 0.0f) {
-		return 4; // Tree
-	}
+	for (uint i = gl_GlobalInvocationID.x; i < pixelCount; i += stride) {
+		ivec2 pixel = ivec2(i % uint(size.x), i / uint(size.x));
 
-	if (r == 0.0f && g == 0.0f && b == 1.0f) {
-		return 5; // Water
+		++counts[min(texelFetch(uClassTexture, ivec3(pixel, uLayer), 0).r, 5u)];
 	}
 
-	return 0; // Sky
-}
+	barrier();
 
-void main() {
-	uint idx = gl_GlobalInvocationID.x * color_num_channels;
-	if (idx >= color_len) {
-		return;
+	for (uint i = 0; i < 6; ++i) {
+		if (counts[i] != 0) {
+			atomicAdd(localIndices[i], counts[i]);
+		}
 	}
 
-	float r = colorPixels[idx];
-	float g = colorPixels[idx + 1];
-	float b = colorPixels[idx + 2];
+	barrier();
 
-	uint meshType = get_mesh_type(r, g, b);
-
-	atomicAdd(colorIndices[meshType], 1);
+	// One global atomic per class and work group
+	if (localIdx < 6 && localIndices[localIdx] != 0) {
+		atomicAdd(colorIndices[localIdx], localIndices[localIdx]);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,122 @@
+#version 430
+
+#define GROUP_SIZE 64
+
+// Must match MAX_BATCH_SIZE
+#define MAX_VIEWS 32
+
+layout(local_size_x = GROUP_SIZE) in;
+
+// Same layout as 'Draw_Elements_Command', the one glMultiDrawElementsIndirect reads
+struct DrawCommand {
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+struct Bounds {
+	vec4 lower;
+	vec4 upper;
+};
+
+layout(std430, binding = 0) readonly buffer MeshBoundsBuffer {
+	// Model space, like the frustum planes
+	Bounds meshBounds[];
+};
+
+layout(std430, binding = 1) readonly buffer MeshCommandBuffer {
+	DrawCommand meshCommands[];
+};
+
+layout(std430, binding = 2) readonly buffer DrawListBuffer {
+	uint drawLists[];
+};
+
+layout(std430, binding = 3) writeonly buffer CommandBuffer {
+	DrawCommand commands[];
+};
+
+layout(std430, binding = 4) buffer StatsBuffer {
+	// Per render pass: drawn and culled meshes, each as a low and high word
+	uint stats[];
+};
+
+// Six clip space planes per view, a mesh is drawn if any of the views sees it
+uniform vec4 uPlanes[MAX_VIEWS * 6];
+uniform uint uViewCount;
+uniform bool uCulling;
+
+uniform uint uListOffset;
+uniform uint uListSize;
+uniform uint uInstanceCount;
+uniform uint uStatsOffset;
+
+shared uint drawnCount;
+shared uint culledCount;
+
+// Same test as 'Frustum::intersects': the box corner furthest along each plane's normal
+bool intersects(Bounds bounds, uint view) {
+	for (uint i = 0; i < 6; ++i) {
+		vec4 plane = uPlanes[view * 6 + i];
+		vec3 dist = max(plane.xyz * bounds.lower.xyz, plane.xyz * bounds.upper.xyz);
+
+		if (dist.x + dist.y + dist.z + plane.w < 0.0f) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void add(uint idx, uint count) {
+	uint old = atomicAdd(stats[idx], count);
+	if (old + count < old) {
+		atomicAdd(stats[idx + 1], 1u);
+	}
+}
+
+void main() {
+	if (gl_LocalInvocationIndex == 0) {
+		drawnCount = 0;
+		culledCount = 0;
+	}
+
+	barrier();
+
+	uint idx = gl_GlobalInvocationID.x;
+
+	if (idx < uListSize) {
+		uint meshIdx = drawLists[uListOffset + idx];
+		DrawCommand command = meshCommands[meshIdx];
+
+		// Empty meshes have no bounds to test
+		bool visible = command.count > 0;
+
+		if (visible && uCulling) {
+			visible = false;
+
+			for (uint i = 0; i < uViewCount && !visible; ++i) {
+				visible = intersects(meshBounds[meshIdx], i);
+			}
+		}
+
+		// Culled draws stay in place with no instances, so the draw order never changes
+		command.instanceCount = visible ? uInstanceCount : 0;
+		commands[idx] = command;
+
+		if (visible) {
+			atomicAdd(drawnCount, 1u);
+		} else {
+			atomicAdd(culledCount, 1u);
+		}
+	}
+
+	barrier();
+
+	if (gl_LocalInvocationIndex == 0) {
+		add(uStatsOffset, drawnCount);
+		add(uStatsOffset + 2, culledCount);
+	}
+}
\ No newline at end of file
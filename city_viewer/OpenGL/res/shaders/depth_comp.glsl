@@ -1,27 +1,103 @@
 #version 430
 
-layout(std430, binding = 0) buffer DepthBuffer {
-	float depthPixels[];
+#define GROUP_SIZE 256
+
+layout(local_size_x = GROUP_SIZE) in;
+
+layout(binding = 1) uniform sampler2DArray uDistanceTexture;
+
+layout(std430, binding = 0) buffer ResultBuffer {
+	//   0      1         2        3       4      5
+	// [Sky, Building, Amenity, Landmark, Tree, Water]
+	uint colorIndices[6];
+	uint minDepthBits;
+	uint maxDepthBits;
+	float depthSum;
 };
 
-layout(std430, binding = 1) buffer ResultBuffer {
-	//     0          1            2
-	// [min_depth, max_depth, depth_sum]
-	float results[3];
+layout(std430, binding = 1) buffer PartialBuffer {
+	// One depth sum per work group, added up by the resolve pass
+	float partialSums[];
 };
 
-uniform uint depth_len;
-uniform uint depth_num_channels;
+// Layer of the camera setup being reduced
+uniform int uLayer;
+uniform uint uPartialCount;
+uniform bool uResolve;
+
+shared float localMin[GROUP_SIZE];
+shared float localMax[GROUP_SIZE];
+shared float localSum[GROUP_SIZE];
+
+void reduce(uint localIdx, bool withMinMax) {
+	for (uint stride = GROUP_SIZE / 2; stride > 0; stride >>= 1) {
+		if (localIdx < stride) {
+			if (withMinMax) {
+				localMin[localIdx] = min(localMin[localIdx], localMin[localIdx + stride]);
+				localMax[localIdx] = max(localMax[localIdx], localMax[localIdx + stride]);
+			}
+
+			localSum[localIdx] += localSum[localIdx + stride];
+		}
+
+		barrier();
+	}
+}
 
 void main() {
-	uint idx = gl_GlobalInvocationID.x;
-	if (idx >= depth_len) {
+	uint localIdx = gl_LocalInvocationIndex;
+
+	if (uResolve) {
+		// Single work group: fold every partial sum into the result buffer
+		float sum = 0.0f;
+		for (uint i = localIdx; i < uPartialCount; i += GROUP_SIZE) {
+			sum += partialSums[i];
+		}
+
+		localSum[localIdx] = sum;
+
+		barrier();
+
+		reduce(localIdx, false);
+
+		if (localIdx == 0) {
+			depthSum = localSum[0];
+		}
+
 		return;
 	}
 
-	float depth = depthPixels[idx * depth_num_channels];
+	// Each invocation walks the frame with a grid stride before the group is reduced;
+	// distances are linear, so the minimum starts at FLT_MAX
+	float depthMin = uintBitsToFloat(0x7f7fffffu);
+	float depthMax = 0.0f;
+	float sum = 0.0f;
+
+	ivec2 size = textureSize(uDistanceTexture, 0).xy;
+	uint pixelCount = uint(size.x * size.y);
+	uint stride = gl_NumWorkGroups.x * GROUP_SIZE;
+
+	for (uint i = gl_GlobalInvocationID.x; i < pixelCount; i += stride) {
+		float depth = texelFetch(uDistanceTexture, ivec3(i % uint(size.x), i / uint(size.x), uLayer), 0).r;
+
+		depthMin = min(depthMin, depth);
+		depthMax = max(depthMax, depth);
+		sum += depth;
+	}
 
-	atomicMin(results[0], depth);
-	atomicMax(results[1], depth);
-	atomicAdd(results[2], depth);
+	localMin[localIdx] = depthMin;
+	localMax[localIdx] = depthMax;
+	localSum[localIdx] = sum;
+
+	barrier();
+
+	reduce(localIdx, true);
+
+	if (localIdx == 0) {
+		partialSums[gl_WorkGroupID.x] = localSum[0];
+
+		// Distances are never negative, so their bit pattern orders like an unsigned integer
+		atomicMin(minDepthBits, floatBitsToUint(localMin[0]));
+		atomicMax(maxDepthBits, floatBitsToUint(localMax[0]));
+	}
 }
\ No newline at end of file
@@ -0,0 +1,36 @@
+#version 330 core
+precision highp float;
+
+layout(location = 0) out float MaxDistance;
+
+// Level above the one being written, always sampled at its base level
+uniform sampler2DArray uSource;
+uniform int            uSourceLayer;
+
+void main() {
+    ivec2 sourceSize = textureSize(uSource, 0).xy;
+    ivec2 size = sourceSize / 2;
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+
+    ivec2 begin = 2 * texel;
+    ivec2 end = begin + 2;
+
+    // The last row and column of an odd sized source are folded into the texel before them
+    if (texel.x == size.x - 1) {
+        end.x = sourceSize.x;
+    }
+
+    if (texel.y == size.y - 1) {
+        end.y = sourceSize.y;
+    }
+
+    float maxDistance = 0.0f;
+
+    for (int y = begin.y; y < end.y; ++y) {
+        for (int x = begin.x; x < end.x; ++x) {
+            maxDistance = max(maxDistance, texelFetch(uSource, ivec3(x, y, uSourceLayer), 0).r);
+        }
+    }
+
+    MaxDistance = maxDistance;
+}
\ No newline at end of file
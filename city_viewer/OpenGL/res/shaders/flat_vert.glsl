@@ -4,9 +4,17 @@ in vec3 position;
 
 out vec4 color;
 
-uniform mat4 uModel;
-uniform mat4 uView;
-uniform mat4 uProjection;
+// Must match 'Frame_Uniforms'
+layout(std140) uniform Frame {
+	mat4 uModel;
+	mat4 uView;
+	mat4 uProjection;
+	mat4 uNormalMatrix;
+	vec4 uViewPosition;
+	vec4 uLightPosition;
+	vec4 uLightColor;
+};
+
 uniform vec4 uColor;
 
 void main() {
@@ -16,25 +16,28 @@ out struct {
 
 out vec3 viewPosition;
 
-uniform mat4 uModel;
-uniform mat4 uView;
-uniform mat4 uProjection;
-uniform vec4 uColor;
-
-uniform vec3 uViewPosition;
+// Must match 'Frame_Uniforms'
+layout(std140) uniform Frame {
+	mat4 uModel;
+	mat4 uView;
+	mat4 uProjection;
+	mat4 uNormalMatrix;
+	vec4 uViewPosition;
+	vec4 uLightPosition;
+	vec4 uLightColor;
+};
 
-uniform vec3 uLightPosition;
-uniform vec3 uLightColor;
+uniform vec4 uColor;
 
 void main() {
 	vertex.position = vec3(uModel * vec4(position, 1.0f));
-	vertex.normal = mat3(transpose(inverse(uModel))) * normal;
+	vertex.normal = mat3(uNormalMatrix) * normal;
 	vertex.color = uColor;
 
-	light.position = vec3(uModel * vec4(uLightPosition, 1.0f));
-	light.color = uLightColor;
+	light.position = vec3(uModel * uLightPosition);
+	light.color = uLightColor.rgb;
 
-	viewPosition = uViewPosition;
+	viewPosition = uViewPosition.xyz;
 
 	gl_Position = uProjection * uView * vec4(vertex.position, 1.0f);
 }
\ No newline at end of file
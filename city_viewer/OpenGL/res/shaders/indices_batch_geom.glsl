@@ -0,0 +1,25 @@
+#version 330 core
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in float gDistance[];
+flat in int gLayer[];
+flat in uint gClassId[];
+
+out float vDistance;
+flat out uint vClassId;
+
+void main() {
+    // Route the whole triangle to the layer of its camera setup
+    for (int i = 0; i < 3; ++i) {
+        gl_Layer = gLayer[0];
+        vDistance = gDistance[i];
+        vClassId = gClassId[0];
+        gl_Position = gl_in[i].gl_Position;
+
+        EmitVertex();
+    }
+
+    EndPrimitive();
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#version 330 core
+
+// Must match MAX_BATCH_SIZE
+#define MAX_VIEWS 32
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 3) in uint aClassId;
+
+out float gDistance;
+flat out int gLayer;
+flat out uint gClassId;
+
+layout(std140) uniform Views {
+    mat4 uBatchProjection;
+    mat4 uViews[MAX_VIEWS];
+};
+
+// Must match 'Frame_Uniforms'
+layout(std140) uniform Frame {
+    mat4 uModel;
+    mat4 uView;
+    mat4 uProjection;
+    mat4 uNormalMatrix;
+    vec4 uViewPosition;
+    vec4 uLightPosition;
+    vec4 uLightColor;
+};
+
+void main() {
+    // One instance per camera setup of the batch
+    vec4 viewPosition = uViews[gl_InstanceID] * uModel * vec4(aPosition, 1.0f);
+
+    gDistance = -viewPosition.z;
+    gLayer = gl_InstanceID;
+    gClassId = aClassId;
+
+    gl_Position = uBatchProjection * viewPosition;
+}
\ No newline at end of file
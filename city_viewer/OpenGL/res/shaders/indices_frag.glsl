@@ -1,10 +1,16 @@
 #version 330 core
 precision highp float;
 
-out vec4 FragColor;
+in float vDistance;
 
-uniform vec3 uObjectColor;
+//   0      1         2        3       4      5
+// [Sky, Building, Amenity, Landmark, Tree, Water]
+flat in uint vClassId;
+
+layout(location = 0) out uint ClassId;
+layout(location = 1) out float Distance;
 
 void main() {
-    FragColor = vec4(uObjectColor, 1.0f);
+    ClassId = vClassId;
+    Distance = vDistance;
 }
\ No newline at end of file
@@ -1,11 +1,28 @@
 #version 330 core
 
-in vec3 aPosition;
+layout(location = 0) in vec3 aPosition;
+layout(location = 3) in uint aClassId;
 
-uniform mat4 uModel;
-uniform mat4 uView;
-uniform mat4 uProjection;
+out float vDistance;
+flat out uint vClassId;
+
+// Must match 'Frame_Uniforms'
+layout(std140) uniform Frame {
+    mat4 uModel;
+    mat4 uView;
+    mat4 uProjection;
+    mat4 uNormalMatrix;
+    vec4 uViewPosition;
+    vec4 uLightPosition;
+    vec4 uLightColor;
+};
 
 void main() {
-    gl_Position = uProjection * uView * uModel * vec4(aPosition, 1.0f);
+    vec4 viewPosition = uView * uModel * vec4(aPosition, 1.0f);
+
+    // Linear view-space depth, i.e. what the nonlinear depth buffer used to be converted back to
+    vDistance = -viewPosition.z;
+    vClassId = aClassId;
+
+    gl_Position = uProjection * viewPosition;
 }
\ No newline at end of file
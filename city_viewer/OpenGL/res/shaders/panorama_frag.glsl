@@ -0,0 +1,62 @@
+#version 330 core
+precision highp float;
+
+layout(location = 0) out uint ClassId;
+layout(location = 1) out float Distance;
+
+// Cube faces of the panorama, one per layer: +X, +Z, -X, -Z, +Y, -Y
+uniform usampler2DArray uPanoramaClasses;
+uniform sampler2DArray  uPanoramaDistances;
+
+// World to face camera space
+uniform mat3  uFaceRotations[6];
+
+// Camera setup being resampled
+uniform vec3  uFront;
+uniform vec3  uRight;
+uniform vec3  uUp;
+uniform vec2  uTanHalfFov;
+uniform vec2  uViewportSize;
+uniform float uFar;
+
+int get_face(vec3 ray) {
+    vec3 absRay = abs(ray);
+
+    if (absRay.y >= absRay.x && absRay.y >= absRay.z) {
+        return ray.y > 0.0f ? 4 : 5;
+    }
+
+    if (absRay.x >= absRay.z) {
+        return ray.x > 0.0f ? 0 : 2;
+    }
+
+    return ray.z > 0.0f ? 1 : 3;
+}
+
+void main() {
+    // Same ray the perspective projection of the camera setup rasterizes at this pixel
+    vec2 ndc = gl_FragCoord.xy / uViewportSize * 2.0f - 1.0f;
+    vec3 ray = normalize(uFront + ndc.x * uTanHalfFov.x * uRight + ndc.y * uTanHalfFov.y * uUp);
+
+    int face = get_face(ray);
+    vec3 faceRay = uFaceRotations[face] * ray;
+
+    // Faces have a 90 degree field of view, so projecting is just dividing by the depth
+    vec2 uv = faceRay.xy / -faceRay.z * 0.5f + 0.5f;
+
+    int size = textureSize(uPanoramaClasses, 0).x;
+    ivec3 texel = ivec3(clamp(ivec2(uv * float(size)), ivec2(0), ivec2(size - 1)), face);
+
+    uint classId = texelFetch(uPanoramaClasses, texel, 0).r;
+
+    // Faces store the depth along their own axis, the setup wants it along its view axis
+    float distance = texelFetch(uPanoramaDistances, texel, 0).r / -faceRay.z * dot(ray, uFront);
+
+    if (classId == 0u || distance > uFar) {
+        classId = 0u;
+        distance = uFar;
+    }
+
+    ClassId = classId;
+    Distance = distance;
+}
\ No newline at end of file
@@ -1,13 +1,13 @@
 #version 330 core
 precision highp float;
 
-out vec4 FragColor;
+flat in uint vPickingId;
 
-//uniform uint uObjectIndex;
-//uniform uint uObjectCount;
-uniform vec3 uObjectColor;
+out vec4 FragColor;
 
 void main() {
-    //FragColor = vec4(float(uObjectIndex) / float(uObjectCount), 0.0f, 0.0f, 1.0f);
-    FragColor = vec4(uObjectColor, 1.0f);
+    // The id spread over the color channels, one byte each
+    uvec3 bytes = (uvec3(vPickingId) >> uvec3(0u, 8u, 16u)) & 255u;
+
+    FragColor = vec4(vec3(bytes) / 255.0f, 1.0f);
 }
\ No newline at end of file
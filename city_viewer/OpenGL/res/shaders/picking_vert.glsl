@@ -1,11 +1,23 @@
 #version 330 core
 
-in vec3 aPosition;
+layout(location = 0) in vec3 aPosition;
+layout(location = 4) in uint aPickingId;
 
-uniform mat4 uModel;
-uniform mat4 uView;
-uniform mat4 uProjection;
+flat out uint vPickingId;
+
+// Must match 'Frame_Uniforms'
+layout(std140) uniform Frame {
+    mat4 uModel;
+    mat4 uView;
+    mat4 uProjection;
+    mat4 uNormalMatrix;
+    vec4 uViewPosition;
+    vec4 uLightPosition;
+    vec4 uLightColor;
+};
 
 void main() {
+    vPickingId = aPickingId;
+
     gl_Position = uProjection * uView * uModel * vec4(aPosition, 1.0f);
 }
\ No newline at end of file
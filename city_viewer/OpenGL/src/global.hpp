@@ -12,13 +12,16 @@ enum _Config_Flags : uint {
 
     // Indices
     CONFIG_FLAGS_COMPUTE_INDICES        = BIT(3),
+    CONFIG_FLAGS_VERIFY_INDICES         = BIT(4),
+    CONFIG_FLAGS_PANORAMIC_INDICES      = BIT(5),
+    CONFIG_FLAGS_SAMPLED_INDICES        = BIT(6),
 
     // Render
-    CONFIG_FLAGS_ENABLE_CULLING         = BIT(4),
-    CONFIG_FLAGS_ENABLE_WIREFRAME       = BIT(5),
+    CONFIG_FLAGS_ENABLE_CULLING         = BIT(7),
+    CONFIG_FLAGS_ENABLE_WIREFRAME       = BIT(8),
 
     // Menu
-    CONFIG_FLAGS_SHOW_POPUP             = BIT(6),
+    CONFIG_FLAGS_SHOW_POPUP             = BIT(9),
 };
 
 typedef uint Config_Flags;
@@ -39,6 +42,44 @@ enum Screenshot_Mode : ubyte {
 
 // --------------------------------------------------------------------------------
 
+// Values written to the class id target of the indices frame buffer
+enum Indices_Class : ubyte {
+    INDICES_CLASS_SKY,
+    INDICES_CLASS_BUILDING,
+    INDICES_CLASS_AMENITY,
+    INDICES_CLASS_LANDMARK,
+    INDICES_CLASS_TREE,
+    INDICES_CLASS_WATER,
+
+    INDICES_CLASS_COUNT
+};
+
+// --------------------------------------------------------------------------------
+
+enum Reduction_Mode : ubyte {
+    REDUCTION_MODE_CPU,
+    REDUCTION_MODE_CPU_ASYNC,
+    REDUCTION_MODE_GPU,
+    REDUCTION_MODE_QUERY
+};
+
+#define MAX_READBACK_DEPTH 8
+
+// Camera setups rendered per pass, one per layer of the indices frame buffer
+#define MAX_BATCH_SIZE     32
+
+// Meshes drawn before the depth pyramid is built when occlusion culling
+#define MAX_OCCLUDER_COUNT 64
+
+// Longer side of the offscreen indices target, which keeps the window's aspect ratio so that every
+// resolution samples the same view. 0 renders at the window's size instead.
+#define INDICES_RESOLUTION_WINDOW 0
+
+// Two-sided 95% normal quantile, for the confidence intervals of sampled rates
+#define RATE_ERROR_Z       1.96
+
+// --------------------------------------------------------------------------------
+
 struct Camera_Setup {
     glm::vec3 position;
     float     yaw;
@@ -48,16 +89,33 @@ inline bool operator==(Camera_Setup a, Camera_Setup b) {
     return a.position == b.position && a.yaw == b.yaw;
 }
 
-struct Camera_Setup_Hash {
-    size_t operator()(const Camera_Setup &setup) const {
-        size_t h1 = std::hash<float>()(setup.yaw);
-        size_t h2 = std::hash<float>()(setup.position.x);
-        size_t h3 = std::hash<float>()(setup.position.y);
-        size_t h4 = std::hash<float>()(setup.position.z);
-        
-        // Combine all the hash values
-        return h1 ^ (h2 << 1) ^ (h3 << 2) ^ (h4 << 3);
-    }
+// --------------------------------------------------------------------------------
+
+enum Render_Pass : ubyte {
+    RENDER_PASS_VIEWER,
+    RENDER_PASS_PICKING,
+    RENDER_PASS_INDICES,
+
+    RENDER_PASS_COUNT
+};
+
+// Meshes drawn, frustum culled and occlusion culled by the last pass of a kind
+struct Culling_Stats {
+    size_t drawn;
+    size_t culled;
+    size_t occluded;
+};
+
+// --------------------------------------------------------------------------------
+
+// Progress of the indices computation in flight, shown in the menu
+struct Indices_Progress {
+    bool   running;
+    bool   cancel_requested;
+    size_t num_setups;
+    size_t num_done;
+    double elapsed_time;
+    double rate_sums[INDICES_CLASS_COUNT];
 };
 
 // --------------------------------------------------------------------------------
@@ -90,7 +148,9 @@ struct Experiment {
 
         free(performance_path);
 
-        fprintf(performance_file, "building_id,num_camera_setups,execution_time,memory_usage\n");
+        fprintf(performance_file, "building_id,num_camera_setups,execution_time,memory_usage,reduction_mode,readback_depth,batch_size,panoramic,setups_per_second,"
+                                  "resolution_x,resolution_y,aspect_ratio,sampled,max_rate_error,"
+                                  "occlusion_culling,meshes_drawn,meshes_frustum_culled,meshes_occluded\n");
 
         char *data_path = static_cast<char *>(malloc(dir_path_len + 1 + name_len + 9 + 1));
         ASSERT(data_path);
@@ -106,7 +166,8 @@ struct Experiment {
             "building_id,origin_x,origin_y,origin_z,"
             "x,y,z,yaw,"
             "building_rate,landmark_rate,amenity_rate,tree_rate,water_rate,sky_rate,"
-            "min_depth,max_depth,avg_depth\n"
+            "min_depth,max_depth,avg_depth,"
+            "building_rate_error,landmark_rate_error,amenity_rate_error,tree_rate_error,water_rate_error,sky_rate_error\n"
         );
     }
 
@@ -120,26 +181,35 @@ struct Experiment {
         }
     }
 
-    void write_performance(int picked_id, uint num_cam_setups, double exe_time, size_t mem_usage) {
+    void write_performance(int picked_id, uint num_cam_setups, double exe_time, size_t mem_usage,
+                           const char *reduction_mode, int readback_depth, int batch_size, bool panoramic,
+                           double setups_per_sec, int resolution_x, int resolution_y, float aspect_ratio, bool sampled, float max_rate_error,
+                           bool occlusion_culling, const Culling_Stats &culling_totals) {
         ASSERT(performance_file);
 
-        fprintf(performance_file, "%d,%u,%lf,%zu\n", picked_id, num_cam_setups, exe_time, mem_usage);
+        fprintf(performance_file, "%d,%u,%lf,%zu,%s,%d,%d,%d,%lf,%d,%d,%f,%d,%f,%d,%zu,%zu,%zu\n", picked_id, num_cam_setups, exe_time, mem_usage,
+                reduction_mode, readback_depth, batch_size, panoramic ? 1 : 0, setups_per_sec,
+                resolution_x, resolution_y, aspect_ratio, sampled ? 1 : 0, max_rate_error,
+                occlusion_culling ? 1 : 0, culling_totals.drawn, culling_totals.culled, culling_totals.occluded);
         fflush(performance_file);
     }
 
     void write_data(int picked_id, glm::vec3 origin_pos,
                     Camera_Setup cam_setup,
                     float building_rate, float landmark_rate, float amenity_rate, float tree_rate, float water_rate, float sky_rate,
-                    float min_depth, float max_depth, float avg_depth) {
+                    float min_depth, float max_depth, float avg_depth,
+                    const float rate_errors[INDICES_CLASS_COUNT]) {
         ASSERT(data_file);
 
         fprintf(
             data_file,
-            "%d,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f\n",
+            "%d,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f\n",
             picked_id, origin_pos.x, origin_pos.y, origin_pos.z,
             cam_setup.position.x, cam_setup.position.y, cam_setup.position.z, cam_setup.yaw,
             building_rate, landmark_rate, amenity_rate, tree_rate, water_rate, sky_rate,
-            min_depth, max_depth, avg_depth
+            min_depth, max_depth, avg_depth,
+            rate_errors[INDICES_CLASS_BUILDING], rate_errors[INDICES_CLASS_LANDMARK], rate_errors[INDICES_CLASS_AMENITY],
+            rate_errors[INDICES_CLASS_TREE], rate_errors[INDICES_CLASS_WATER], rate_errors[INDICES_CLASS_SKY]
         );
     }
 };
@@ -148,46 +218,101 @@ struct Experiment {
 
 namespace global {
 // Platform
-Config_Flags    config_flags         = CONFIG_FLAGS_ALL_UNSET;
-FILE           *log_file             = nullptr;
+Config_Flags         config_flags         = CONFIG_FLAGS_ALL_UNSET;
+FILE                *log_file             = nullptr;
+
+Linear_Allocator     transient_storage    = make_linear_allocator();
 
 // Light
-glm::vec3       light_position       = {};
-glm::vec3       light_color          = COLOR_WHITE;
+glm::vec3            light_position       = {};
+glm::vec3            light_color          = COLOR_WHITE;
 
 // Model
-glm::vec3       model_origin         = {};
+glm::vec3            model_origin         = {};
+
+// Threads the model files are read on, 0 for one per hardware thread
+uint                 loader_thread_count  = 0;
+
+// Loaded models are cached in SCENE_CACHE_DIR, later loads of unchanged files map the cache instead
+bool                 scene_cache          = true;
 
 // Indices
-Frame_Buffer    picking_buffer;
-Frame_Buffer    indices_buffer;
-Frame_Buffer    position_buffer;
-Frame_Buffer    aabb_buffer;
+Frame_Buffer         picking_buffer;
+Indices_Frame_Buffer indices_buffer;
+Frame_Buffer         position_buffer;
+Frame_Buffer         aabb_buffer;
+
+int                  picked_id            = -1;
+int                  picked_mesh_idx      = -1;
 
-int             picked_id            = -1;
-int             picked_mesh_idx      = -1;
+// Click waiting to be picked, in picking buffer pixels from the bottom left
+bool                 pick_pending         = false;
+int                  pick_x               = 0;
+int                  pick_y               = 0;
 
-int             granularity[4]       = {2, 2, 2, 3};
+int                  granularity[4]       = {2, 2, 2, 3};
+
+Reduction_Mode       reduction_mode       = REDUCTION_MODE_GPU;
+const char          *reduction_mode_name  = "GPU";
+
+// Number of setups in flight when reading back asynchronously or waiting on queries
+int                  readback_depth       = 3;
+
+int                  batch_size           = 1;
+
+int                  indices_resolution   = INDICES_RESOLUTION_WINDOW;
+
+Indices_Progress     indices_progress     = {};
+
+// Time given to the indices computation every frame, in milliseconds
+float                indices_budget       = 12.0f;
+bool                 indices_no_vsync     = true;
 
 std::unordered_map<std::string, Experiment> saved_experiments;
 std::string experiment_name;
 
 // Debug
-uint            culling_mode         = GL_FRONT;
-const char     *culling_mode_name    = "Front";
+bool                 frustum_culling      = true;
+
+// Draw each pass with one indirect call over the merged scene buffers when supported, read once
+// when the renderer is initialized
+bool                 multi_draw           = true;
 
-Screenshot_Mode screenshot_mode      = SCREENSHOT_MODE_PICKING;
-const char     *screenshot_mode_name = "Picking";
+// Frustum culling in a compute pass that writes the indirect commands, when multi draw indirect
+// is used. The passes with occlusion culling stay on the CPU.
+bool                 gpu_culling          = true;
+Culling_Stats        culling_stats[RENDER_PASS_COUNT] = {};
+
+// Hi-Z occlusion culling of the viewer and the single view indices passes, the biggest meshes
+// on screen are drawn first and occlude the rest
+bool                 occlusion_culling    = false;
+int                  occluder_count       = 16;
+
+uint                 culling_mode         = GL_FRONT;
+const char          *culling_mode_name    = "Front";
+
+Screenshot_Mode      screenshot_mode      = SCREENSHOT_MODE_PICKING;
+const char          *screenshot_mode_name = "Picking";
+
+// Only draw the frames where the camera, light, selection, config or window changed, waiting on
+// events otherwise
+bool                 render_on_demand     = true;
+
+// Longest wait for an event while idle, in seconds
+double               idle_timeout         = 0.5;
 
 // Menu
-bool            show_menu            = false;
-bool            show_debug_menu      = false;
+bool                 show_menu            = false;
+bool                 show_debug_menu      = false;
 
 // --------------------------------------------------------------------------------
 
 void init(int win_width, int win_height) {
     config_flags = CONFIG_FLAGS_DEFAULT;
 
+    // Enough for a couple of full frame readbacks, grows to the peak usage otherwise
+    transient_storage.init(MEGABYTES(16));
+
 #ifndef DEBUG_MODE
     log_file = fopen("files/log.txt", "wb");
     ASSERT(log_file != nullptr);
@@ -196,7 +321,7 @@ void init(int win_width, int win_height) {
     picking_buffer = make_frame_buffer();
     picking_buffer.init(win_width, win_height);
 
-    indices_buffer = make_frame_buffer();
+    indices_buffer = make_indices_frame_buffer();
     indices_buffer.init(win_width, win_height);
 
     position_buffer = make_frame_buffer();
@@ -208,6 +333,8 @@ void shutdown() {
     destroy(indices_buffer);
     destroy(picking_buffer);
 
+    destroy(transient_storage);
+
 #ifndef DEBUG_MODE
     fclose(log_file);
 #endif // DEBUG_MODE
@@ -216,6 +343,40 @@ void shutdown() {
 
 // --------------------------------------------------------------------------------
 
+// Class ids are not viewable as is, so they are mapped back to the colors the indices pass used to output
+void save_indices_image(const char *filepath) {
+    static const ubyte class_colors[INDICES_CLASS_COUNT][3] = {
+        {  0,   0,   0}, // Sky
+        {255,   0,   0}, // Building
+        {255, 255,   0}, // Amenity
+        {255,   0, 255}, // Landmark
+        {  0, 255,   0}, // Tree
+        {  0,   0, 255}  // Water
+    };
+
+    constexpr int num_channels = 3;
+
+    const Indices_Frame_Buffer &fb = global::indices_buffer;
+
+    int num_pixels = fb.width * fb.height;
+
+    Arena_Scope scope = global::transient_storage.begin_scope();
+
+    ubyte *class_pixels = fb.retrieve_class_pixels();
+
+    ubyte *buff = global::transient_storage.alloc_array<ubyte>(num_channels * num_pixels);
+
+    for (int i = 0; i < num_pixels; ++i) {
+        memcpy(buff + num_channels * i, class_colors[MIN(class_pixels[i], INDICES_CLASS_COUNT - 1)], num_channels);
+    }
+
+    stbi_write_png(filepath, fb.width, fb.height, num_channels, buff, num_channels * fb.width);
+
+    global::transient_storage.end_scope(scope);
+}
+
+// --------------------------------------------------------------------------------
+
 bool save_screenshot(const char *screenshot_name, Screenshot_Mode screenshot_mode = global::screenshot_mode) {
     if (screenshot_name == nullptr) {
         return false;
@@ -251,7 +412,7 @@ bool save_screenshot(const char *screenshot_name, Screenshot_Mode screenshot_mod
     if (screenshot_mode == SCREENSHOT_MODE_PICKING) {
         global::picking_buffer.save_image(screenshot_path);
     } else if (screenshot_mode == SCREENSHOT_MODE_INDICES) {
-        global::indices_buffer.save_image(screenshot_path);
+        save_indices_image(screenshot_path);
     } else {
         //global::aabb_buffer.save_image(screenshot_path);
     }
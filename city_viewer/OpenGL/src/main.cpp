@@ -1,5 +1,12 @@
 #include "platform/indices.hpp"
 
+#ifdef HEADLESS_MODE
+#include "platform/batch.hpp"
+
+int main(int argc, char **argv) {
+    return batch::run(argc, argv);
+}
+#else
 int main() {
     // Platform initialization
     window::init("City Viewer", 800, 600, "res/icon.png");
@@ -15,6 +22,8 @@ int main() {
 
     renderer::init(RENDER_MODE_COLLADA);
 
+    bool restore_vsync = false;
+
     // Main loop
     while (!window::closed()) {
         if (HAS_FLAG(global::config_flags, CONFIG_FLAGS_ENABLE_CULLING)) {
@@ -26,6 +35,13 @@ int main() {
 
         window::process_input();
 
+        // Same frame as the one on screen, wait for something to happen instead of drawing it again
+        if (global::render_on_demand && !HAS_FLAG(global::config_flags, CONFIG_FLAGS_COMPUTE_INDICES) &&
+            !renderer::needs_redraw()) {
+            window::wait_events(global::idle_timeout);
+            continue;
+        }
+
         if (global::show_menu || global::show_debug_menu) {
             menu::new_frame();
         }
@@ -33,7 +49,16 @@ int main() {
         renderer::update();
 
         // Rendering
-        renderer::render_picking();
+        if (global::pick_pending) {
+            renderer::pick(global::pick_x, global::pick_y);
+            global::pick_pending = false;
+        }
+
+        // A picking screenshot saves the whole buffer, so it is kept current while one can be taken
+        if (HAS_FLAG(global::config_flags, CONFIG_FLAGS_SHOW_POPUP) &&
+            global::screenshot_mode == SCREENSHOT_MODE_PICKING) {
+            renderer::render_picking();
+        }
 
         // TMP
         //renderer::render_indices();
@@ -46,9 +71,22 @@ int main() {
             renderer::render_debug_menu();
         }
 
+        // The computation only gets a slice of every frame, so the viewer stays responsive
         if (HAS_FLAG(global::config_flags, CONFIG_FLAGS_COMPUTE_INDICES)) {
-            indices::compute();
-            char a = 0;
+            if (!global::indices_progress.running) {
+                indices::begin();
+
+                // Frames are only presented to show progress, no need to wait for the display
+                if (global::indices_no_vsync && window::vsync) {
+                    window::set_vsync(false);
+                    restore_vsync = true;
+                }
+            }
+
+            if (indices::step(global::indices_budget * 1e-3) && restore_vsync) {
+                window::set_vsync(true);
+                restore_vsync = false;
+            }
         }
 
         menu::update();
@@ -65,6 +103,7 @@ int main() {
 
     window::shutdown();
 }
+#endif // HEADLESS_MODE
 
 /*
 Study:
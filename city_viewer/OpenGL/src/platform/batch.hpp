@@ -0,0 +1,934 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "indices.hpp"
+
+// --------------------------------------------------------------------------------
+
+/*
+Headless batch runner for the indices pipeline (build with HEADLESS_MODE defined).
+
+Linux build, from city_viewer/OpenGL (GLEW built with GLEW_EGL is preferred):
+    g++ -std=c++17 -O2 -DHEADLESS_MODE -Isrc -Isrc/vendor -I../Dependencies/GLEW/include \
+        src/main.cpp src/vendor/stb_image/stb_image.cpp src/vendor/stb_image/stb_image_write.cpp \
+        -lGLEW -lEGL -lGL -o city_batch
+
+Usage, also from city_viewer/OpenGL so that 'res/' and 'files/' resolve:
+    ./city_batch --experiment tall --buildings 265,270 --granularity 2,2,2,3
+
+Force software rendering with LIBGL_ALWAYS_SOFTWARE=1 on GPU-less machines.
+
+Loaded models are cached in files/cache and mapped by later runs while their sources are unchanged,
+--no-scene-cache always parses the sources.
+
+Scene BVH build times and query throughput, against brute force loops over the meshes:
+    ./city_batch --benchmark-bvh
+
+Model load times and MB/s of the GeoJSON and COLLADA scenes from 1 thread up to one per hardware
+thread:
+    ./city_batch --benchmark-loaders
+
+Triangulation times of synthetic footprints with thousands of vertices, some with courtyards:
+    ./city_batch --benchmark-triangulation
+*/
+
+// --------------------------------------------------------------------------------
+
+namespace batch {
+struct Options {
+    const char       *experiment_name = nullptr;
+    std::vector<int>  building_ids;
+    int               granularity[4]  = {2, 2, 2, 3};
+    int               width           = 800;
+    int               height          = 600;
+    Reduction_Mode    reduction_mode  = REDUCTION_MODE_GPU;
+    const char       *reduction_name  = "GPU";
+    int               readback_depth  = 3;
+    int               batch_size      = 1;
+    bool              verify          = false;
+    bool              panoramic       = false;
+    int               resolution      = INDICES_RESOLUTION_WINDOW;
+    bool              sampled         = false;
+    bool              benchmark_bvh   = false;
+    bool              benchmark_loaders = false;
+    bool              benchmark_triangulation = false;
+    int               loader_threads  = 0;
+    bool              scene_cache     = true;
+    bool              occlusion       = false;
+    int               occluder_count  = 16;
+    bool              multi_draw      = true;
+    bool              gpu_culling     = true;
+    int               gl_debug        = -1; // A 'Debug_Severity', the build's default when negative
+};
+
+// --------------------------------------------------------------------------------
+
+#define BVH_BENCHMARK_BUILDS  5
+#define BVH_BENCHMARK_RAYS    100000
+#define BVH_BENCHMARK_FRUSTA  10000
+#define BVH_BENCHMARK_SPHERES 100000
+#define BVH_BENCHMARK_BOXES   100000
+
+// Queries per kind that are also answered by brute force, as a check and as the baseline
+#define BVH_BENCHMARK_CHECKS  1000
+
+#define LOADER_BENCHMARK_LOADS 3
+
+#define TRIANGULATION_BENCHMARK_RUNS 5
+
+// --------------------------------------------------------------------------------
+
+void print_usage(const char *program_name) {
+    fprintf(
+        stderr,
+        "Usage: %s --experiment <name> --buildings <id,id,...> [options]\n"
+        "       %s --benchmark-bvh\n"
+        "       %s --benchmark-loaders\n"
+        "       %s --benchmark-triangulation\n"
+        "Options:\n"
+        "  --granularity <a,b,c,d>  Camera setup granularity, as in the viewer (default: 2,2,2,3)\n"
+        "  --width <pixels>         Render target width (default: 800)\n"
+        "  --height <pixels>        Render target height (default: 600)\n"
+        "  --reduction <mode>       cpu, cpu-async, gpu or query: how the indices frame buffer is reduced (default: gpu)\n"
+        "  --readback-depth <n>     Setups in flight with --reduction cpu-async or query, 1 to %d (default: 3)\n"
+        "  --batch-size <n>         Camera setups rendered per pass, 1 to %d (default: 1)\n"
+        "  --panorama               Render one panorama per position and resample every yaw from it\n"
+        "  --resolution <pixels>    Longer side of the offscreen indices target at the --width x --height aspect,\n"
+        "                           0 for --width x --height (default: 0)\n"
+        "  --sampled                Jitter every render and report 95%% confidence intervals for the rates\n"
+        "  --occlusion-culling      Hi-Z occlusion culling of the single view passes\n"
+        "  --occluders <n>          Meshes drawn as occluders with --occlusion-culling, 1 to %d (default: 16)\n"
+        "  --no-multi-draw          Draw the meshes one by one instead of with multi draw indirect\n"
+        "  --no-gpu-culling         Frustum cull on the CPU instead of in a compute pass\n"
+        "  --gl-debug <severity>    off, high, medium, low or notification: least severe OpenGL debug message reported\n"
+        "                           (default: medium in debug builds, high otherwise)\n"
+        "  --loader-threads <n>     Threads the models are loaded on, 0 for one per hardware thread (default: 0)\n"
+        "  --no-scene-cache         Always load the models from their source files, neither reading nor writing " SCENE_CACHE_DIR "\n"
+        "  --verify                 Check every reduction against the CPU one\n",
+        program_name, program_name, program_name, program_name, MAX_READBACK_DEPTH, MAX_BATCH_SIZE, MAX_OCCLUDER_COUNT
+    );
+}
+
+bool parse_int_list(std::vector<int> &dst, const char *txt) {
+    char *end;
+
+    while (*txt != '\0') {
+        long val = strtol(txt, &end, 10);
+        if (end == txt) {
+            return false;
+        }
+
+        dst.push_back(static_cast<int>(val));
+
+        txt = end;
+        if (*txt == ',') {
+            ++txt;
+        }
+    }
+
+    return !dst.empty();
+}
+
+bool parse_args(Options &dst, int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (strcmp(arg, "--verify") == 0) {
+            dst.verify = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--panorama") == 0) {
+            dst.panoramic = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--sampled") == 0) {
+            dst.sampled = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--occlusion-culling") == 0) {
+            dst.occlusion = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--no-multi-draw") == 0) {
+            dst.multi_draw = false;
+            continue;
+        }
+
+        if (strcmp(arg, "--no-gpu-culling") == 0) {
+            dst.gpu_culling = false;
+            continue;
+        }
+
+        if (strcmp(arg, "--no-scene-cache") == 0) {
+            dst.scene_cache = false;
+            continue;
+        }
+
+        if (strcmp(arg, "--benchmark-loaders") == 0) {
+            dst.benchmark_loaders = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--benchmark-triangulation") == 0) {
+            dst.benchmark_triangulation = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--benchmark-bvh") == 0) {
+            dst.benchmark_bvh = true;
+            continue;
+        }
+
+        if (i + 1 == argc) {
+            LOG_ERROR("Missing value for argument '%s'.", arg);
+            return false;
+        }
+
+        const char *val = argv[++i];
+
+        if (strcmp(arg, "--experiment") == 0) {
+            dst.experiment_name = val;
+        } else if (strcmp(arg, "--buildings") == 0) {
+            if (!parse_int_list(dst.building_ids, val)) {
+                LOG_ERROR("Invalid building id list '%s'.", val);
+                return false;
+            }
+        } else if (strcmp(arg, "--granularity") == 0) {
+            std::vector<int> granularity;
+            if (!parse_int_list(granularity, val) || granularity.size() != ARRAY_SIZE(dst.granularity)) {
+                LOG_ERROR("Invalid granularity '%s'.", val);
+                return false;
+            }
+
+            for (size_t j = 0; j < granularity.size(); ++j) {
+                if (granularity[j] <= 0) {
+                    LOG_ERROR("Invalid granularity '%s'.", val);
+                    return false;
+                }
+
+                dst.granularity[j] = granularity[j];
+            }
+        } else if (strcmp(arg, "--reduction") == 0) {
+            if (strcmp(val, "cpu") == 0) {
+                dst.reduction_mode = REDUCTION_MODE_CPU;
+                dst.reduction_name = "CPU";
+            } else if (strcmp(val, "cpu-async") == 0) {
+                dst.reduction_mode = REDUCTION_MODE_CPU_ASYNC;
+                dst.reduction_name = "CPU (Async)";
+            } else if (strcmp(val, "gpu") == 0) {
+                dst.reduction_mode = REDUCTION_MODE_GPU;
+                dst.reduction_name = "GPU";
+            } else if (strcmp(val, "query") == 0) {
+                dst.reduction_mode = REDUCTION_MODE_QUERY;
+                dst.reduction_name = "Occlusion Query";
+            } else {
+                LOG_ERROR("Unknown reduction mode '%s'.", val);
+                return false;
+            }
+        } else if (strcmp(arg, "--readback-depth") == 0) {
+            dst.readback_depth = atoi(val);
+            if (dst.readback_depth < 1 || dst.readback_depth > MAX_READBACK_DEPTH) {
+                LOG_ERROR("Readback depth must be in [1, %d].", MAX_READBACK_DEPTH);
+                return false;
+            }
+        } else if (strcmp(arg, "--batch-size") == 0) {
+            dst.batch_size = atoi(val);
+            if (dst.batch_size < 1 || dst.batch_size > MAX_BATCH_SIZE) {
+                LOG_ERROR("Batch size must be in [1, %d].", MAX_BATCH_SIZE);
+                return false;
+            }
+        } else if (strcmp(arg, "--resolution") == 0) {
+            dst.resolution = atoi(val);
+            if (dst.resolution < 0) {
+                LOG_ERROR("Invalid indices resolution '%s'.", val);
+                return false;
+            }
+        } else if (strcmp(arg, "--occluders") == 0) {
+            dst.occluder_count = atoi(val);
+            if (dst.occluder_count < 1 || dst.occluder_count > MAX_OCCLUDER_COUNT) {
+                LOG_ERROR("Occluder count must be in [1, %d].", MAX_OCCLUDER_COUNT);
+                return false;
+            }
+        } else if (strcmp(arg, "--gl-debug") == 0) {
+            static const char *severity_names[] = {"off", "high", "medium", "low", "notification"};
+            static_assert(ARRAY_SIZE(severity_names) == DEBUG_SEVERITY_COUNT, "Every debug severity needs a name.");
+
+            for (size_t j = 0; j < ARRAY_SIZE(severity_names); ++j) {
+                if (strcmp(val, severity_names[j]) == 0) {
+                    dst.gl_debug = static_cast<int>(j);
+                }
+            }
+
+            if (dst.gl_debug < 0) {
+                LOG_ERROR("Unknown debug severity '%s'.", val);
+                return false;
+            }
+        } else if (strcmp(arg, "--loader-threads") == 0) {
+            dst.loader_threads = atoi(val);
+            if (dst.loader_threads < 0) {
+                LOG_ERROR("Invalid loader thread count '%s'.", val);
+                return false;
+            }
+        } else if (strcmp(arg, "--width") == 0) {
+            dst.width = atoi(val);
+        } else if (strcmp(arg, "--height") == 0) {
+            dst.height = atoi(val);
+        } else {
+            LOG_ERROR("Unknown argument '%s'.", arg);
+            return false;
+        }
+    }
+
+    if (dst.width <= 0 || dst.height <= 0) {
+        LOG_ERROR("Invalid render target size %dx%d.", dst.width, dst.height);
+        return false;
+    }
+
+    if (dst.benchmark_bvh || dst.benchmark_loaders || dst.benchmark_triangulation) {
+        return true;
+    }
+
+    if (dst.experiment_name == nullptr || strlen(dst.experiment_name) == 0) {
+        LOG_ERROR("Experiment name cannot be empty.");
+        return false;
+    }
+
+    if (dst.building_ids.empty()) {
+        LOG_ERROR("No building was selected.");
+        return false;
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+double get_time() {
+    timespec time_now;
+    timespec_get(&time_now, TIME_UTC);
+
+    return time_now.tv_sec + time_now.tv_nsec * 1e-9;
+}
+
+template<typename Query>
+double time_queries(uint count, Query &&query) {
+    double time_begin = get_time();
+
+    for (uint i = 0; i < count; ++i) {
+        query(i);
+    }
+
+    return get_time() - time_begin;
+}
+
+void print_throughput(const char *name, uint count, double bvh_time, double brute_force_time, size_t num_results) {
+    printf(
+        "  %-8s %10.3f Mq/s, brute force %10.3f Mq/s, %8.2f results/query\n",
+        name, count / bvh_time * 1e-6, BVH_BENCHMARK_CHECKS / brute_force_time * 1e-6,
+        static_cast<double>(num_results) / count
+    );
+}
+
+// The first BVH_BENCHMARK_CHECKS queries of every kind are checked against brute force
+bool benchmark_bvh() {
+    const std::vector<Mesh> &meshes = renderer::buildings_model.meshes;
+
+    uint thread_count = MAX(std::thread::hardware_concurrency(), 1u);
+
+    size_t triangle_count = 0;
+    for (const auto &mesh : meshes) {
+        triangle_count += mesh.indices.size() / 3;
+    }
+
+    printf("Scene: %zu meshes, %zu triangles\n", meshes.size(), triangle_count);
+
+    // Builds, best of a few
+    struct {
+        const char *name;
+        bool        with_triangles;
+        uint        thread_count;
+    } builds[] = {
+        {"Meshes",             false, 1},
+        {"Meshes + triangles", true,  1},
+        {"Meshes + triangles", true,  thread_count},
+    };
+
+    Scene_BVH bvh = make_scene_bvh();
+
+    printf("Build:\n");
+    for (const auto &build : builds) {
+        double best_time = DBL_MAX;
+
+        for (int i = 0; i < BVH_BENCHMARK_BUILDS; ++i) {
+            bvh.build(meshes, build.with_triangles, build.thread_count);
+            best_time = MIN(best_time, bvh.build_time);
+        }
+
+        printf(
+            "  %-20s %2u thread(s) %10.3f ms, %zu top nodes, depth %u, %.2f MB\n",
+            build.name, build.thread_count, best_time * 1e3, bvh.top.nodes.size(), bvh.top.depth,
+            bvh.get_memory_usage() / (1024.0 * 1024.0)
+        );
+    }
+
+    if (bvh.top.nodes.empty()) {
+        LOG_ERROR("The scene has no meshes to query.");
+        return false;
+    }
+
+    const AABB scene_bounds = bvh.top.nodes[0].bounds;
+    const glm::vec3 scene_size = scene_bounds.max - scene_bounds.min;
+
+    auto random_point = [&](uint seed) {
+        return scene_bounds.min + scene_size * glm::vec3(indices::hash_to_unit(4 * seed),
+                                                         indices::hash_to_unit(4 * seed + 1),
+                                                         indices::hash_to_unit(4 * seed + 2));
+    };
+
+    // Uniform on the unit sphere
+    auto random_direction = [&](uint seed) {
+        float z = 2.0f * indices::hash_to_unit(4 * seed + 3) - 1.0f;
+        float phi = 2.0f * static_cast<float>(PI) * indices::hash_to_unit(4 * seed + 1);
+        float r = sqrtf(MAX(1.0f - z * z, 0.0f));
+
+        return glm::vec3(r * cosf(phi), r * sinf(phi), z);
+    };
+
+    auto random_frustum = [&](uint seed) {
+        glm::vec3 position = random_point(seed);
+        glm::vec3 front = random_direction(seed);
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, NEAR_PLANE, FAR_PLANE);
+        glm::mat4 view = glm::lookAt(position, position + front, fabsf(front.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                                                                         : glm::vec3(0.0f, 1.0f, 0.0f));
+
+        Frustum ret;
+        ret.init(projection * view);
+
+        return ret;
+    };
+
+    const float sphere_radius = 0.05f * glm::length(scene_size);
+    const glm::vec3 box_extent = 0.05f * scene_size;
+
+    auto random_box = [&](uint seed) {
+        glm::vec3 center = random_point(seed);
+
+        return AABB{center - box_extent, center + box_extent};
+    };
+
+    // Brute force mesh level queries, reported as the number of meshes and the sum of their indices
+    auto brute_force = [&](auto &&overlaps, size_t &count, size_t &idx_sum) {
+        count = idx_sum = 0;
+
+        for (size_t i = 0; i < meshes.size(); ++i) {
+            if (!meshes[i].vertices.empty() && overlaps(meshes[i].bounds)) {
+                ++count;
+                idx_sum += i;
+            }
+        }
+    };
+
+    size_t num_mismatches = 0;
+
+    printf("Queries:\n");
+
+    // Rays, closest hit against the triangles
+    {
+        size_t num_hits = 0;
+        double bvh_time = time_queries(BVH_BENCHMARK_RAYS, [&](uint i) {
+            Ray_Hit hit;
+            num_hits += bvh.ray(random_point(i), random_direction(i), FLT_MAX, hit);
+        });
+
+        std::vector<float> expected_t(BVH_BENCHMARK_CHECKS);
+
+        double brute_force_time = time_queries(BVH_BENCHMARK_CHECKS, [&](uint i) {
+            const Ray ray = make_ray(random_point(i), random_direction(i));
+
+            float closest_t = FLT_MAX, t;
+            for (const auto &mesh : meshes) {
+                for (size_t j = 0; j + 2 < mesh.indices.size(); j += 3) {
+                    if (intersect_ray_triangle(ray, mesh.vertices[mesh.indices[j]].position,
+                                               mesh.vertices[mesh.indices[j + 1]].position,
+                                               mesh.vertices[mesh.indices[j + 2]].position, closest_t, t)) {
+                        closest_t = t;
+                    }
+                }
+            }
+
+            expected_t[i] = closest_t;
+        });
+
+        for (uint i = 0; i < BVH_BENCHMARK_CHECKS; ++i) {
+            Ray_Hit hit;
+            bool is_hit = bvh.ray(random_point(i), random_direction(i), FLT_MAX, hit);
+
+            if (is_hit != (expected_t[i] < FLT_MAX) ||
+                (is_hit && fabsf(hit.t - expected_t[i]) > 1e-4f * MAX(1.0f, expected_t[i]))) {
+                ++num_mismatches;
+            }
+        }
+
+        print_throughput("Ray", BVH_BENCHMARK_RAYS, bvh_time, brute_force_time, num_hits);
+    }
+
+    // Frusta, spheres and boxes report overlapping meshes. 'query' runs the i-th query on the
+    // BVH, 'make_overlaps' returns the matching test for the brute force loop.
+    auto benchmark_query = [&](const char *name, uint count, auto &&query, auto &&make_overlaps) {
+        size_t num_results = 0;
+        double bvh_time = time_queries(count, [&](uint i) {
+            query(i, [&](uint) { ++num_results; });
+        });
+
+        std::vector<size_t> expected_counts(BVH_BENCHMARK_CHECKS), expected_sums(BVH_BENCHMARK_CHECKS);
+
+        double brute_force_time = time_queries(BVH_BENCHMARK_CHECKS, [&](uint i) {
+            brute_force(make_overlaps(i), expected_counts[i], expected_sums[i]);
+        });
+
+        for (uint i = 0; i < BVH_BENCHMARK_CHECKS; ++i) {
+            size_t actual_count = 0, actual_sum = 0;
+            query(i, [&](uint mesh_idx) {
+                ++actual_count;
+                actual_sum += mesh_idx;
+            });
+
+            if (actual_count != expected_counts[i] || actual_sum != expected_sums[i]) {
+                ++num_mismatches;
+            }
+        }
+
+        print_throughput(name, count, bvh_time, brute_force_time, num_results);
+    };
+
+    benchmark_query(
+        "Frustum", BVH_BENCHMARK_FRUSTA,
+        [&](uint i, auto &&visit) { bvh.query_frustum(random_frustum(i), visit); },
+        [&](uint i) {
+            const Frustum frustum = random_frustum(i);
+            return [frustum](const AABB &box) { return frustum.intersects(box); };
+        }
+    );
+
+    benchmark_query(
+        "Sphere", BVH_BENCHMARK_SPHERES,
+        [&](uint i, auto &&visit) { bvh.query_sphere(random_point(i), sphere_radius, visit); },
+        [&](uint i) {
+            const glm::vec3 center = random_point(i);
+            return [&, center](const AABB &box) { return sphere_overlaps_aabb(center, sphere_radius, box); };
+        }
+    );
+
+    benchmark_query(
+        "AABB", BVH_BENCHMARK_BOXES,
+        [&](uint i, auto &&visit) { bvh.query_aabb(random_box(i), visit); },
+        [&](uint i) {
+            const AABB query_box = random_box(i);
+            return [query_box](const AABB &box) { return aabbs_overlap(query_box, box); };
+        }
+    );
+
+    if (num_mismatches > 0) {
+        LOG_ERROR("%zu BVH queries did not match brute force.", num_mismatches);
+        return false;
+    }
+
+    return true;
+}
+
+// Same type, color and boxes, and the same bytes in the vertices and indices
+bool meshes_match(const Mesh &a, const Mesh &b) {
+    if (a.type != b.type || a.color != b.color || a.base_vert_count != b.base_vert_count) {
+        return false;
+    }
+
+    if (memcmp(&a.aabb, &b.aabb, sizeof(AABB)) != 0 || memcmp(&a.bounds, &b.bounds, sizeof(AABB)) != 0) {
+        return false;
+    }
+
+    if (a.vertices.size() != b.vertices.size() || a.indices.size() != b.indices.size()) {
+        return false;
+    }
+
+    return (a.vertices.empty() || memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(Vertex)) == 0)
+           && (a.indices.empty() || memcmp(a.indices.data(), b.indices.data(), a.indices.size() * sizeof(uint)) == 0);
+}
+
+// The COLLADA number scanner against 'strtof' on the tokens where 'std::from_chars' differs from it,
+// the same bits and the same characters read
+bool scan_number_matches_strtof() {
+    const char *tokens[] = {
+        "1.5", "-1.5", "+1.5", "+0", "-0", ".5", "5.", "1e", "0.1", "1e-40", "1e-46", "-1e-46",
+        "1e-400", "3.4028235e38", "3.4028236e38", "3.4e39", "-3.4e39", "+3.4e39", "1e400", "inf", "-inf",
+    };
+
+    size_t num_mismatches = 0;
+
+    for (const char *token : tokens) {
+        char *strtof_end;
+        float expected = strtof(token, &strtof_end);
+
+        float actual = 0.0f;
+        const char *cur = token;
+        const char *end = token + strlen(token);
+
+        if (!scan_number(actual, cur, end) || cur != strtof_end || memcmp(&actual, &expected, sizeof(float)) != 0) {
+            LOG_ERROR("Scanned '%s' as %g, 'strtof' gives %g.", token, actual, expected);
+            ++num_mismatches;
+        }
+    }
+
+    return num_mismatches == 0;
+}
+
+// Loads from 1 thread up to one per hardware thread, doubling, best of a few, with the throughput
+// over the size of the source file. Every load has to match the first single threaded one mesh
+// by mesh, so a race that reorders or moves any of them fails the benchmark.
+bool benchmark_loaders() {
+    if (!scan_number_matches_strtof()) {
+        return false;
+    }
+
+    // Parsing is what is timed
+    global::scene_cache = false;
+
+    const char *file_paths[] = {
+        "res/models/geojson/manhattan_buildings.geojson",
+        "res/models/collada/manhattan.dae",
+    };
+
+    uint max_thread_count = get_thread_count(0);
+
+    std::vector<uint> thread_counts;
+    for (uint thread_count = 1; thread_count < max_thread_count; thread_count *= 2) {
+        thread_counts.push_back(thread_count);
+    }
+    thread_counts.push_back(max_thread_count);
+
+    size_t num_mismatches = 0;
+
+    for (const char *file_path : file_paths) {
+        // Missing files fail the loads below, which already warns
+        double file_megabytes = 0.0;
+
+        Mapped_File file;
+        if (map_file(file, file_path)) {
+            file_megabytes = static_cast<double>(file.size) / MEGABYTES(1);
+            destroy(file);
+        }
+
+        printf("%s: %.2f MB\n", file_path, file_megabytes);
+
+        // The first single threaded load, every other one is compared to it
+        Model reference;
+        double single_thread_time = 0.0;
+
+        for (uint thread_count : thread_counts) {
+            global::loader_thread_count = thread_count;
+
+            double best_time = DBL_MAX;
+
+            for (int i = 0; i < LOADER_BENCHMARK_LOADS; ++i) {
+                // Same colors on every load
+                srand(1);
+
+                Model model;
+
+                double time_begin = get_time();
+                model.init(file_path, 0.0f, 0.0f, 0.0f);
+                best_time = MIN(best_time, get_time() - time_begin);
+
+                if (thread_count == 1 && i == 0) {
+                    reference.meshes = std::move(model.meshes);
+                    continue;
+                }
+
+                bool match = model.meshes.size() == reference.meshes.size();
+                for (size_t j = 0; match && j < model.meshes.size(); ++j) {
+                    match = meshes_match(model.meshes[j], reference.meshes[j]);
+                }
+
+                if (!match) {
+                    ++num_mismatches;
+                }
+            }
+
+            if (thread_count == 1) {
+                single_thread_time = best_time;
+
+                if (reference.meshes.empty()) {
+                    LOG_WARNING("No meshes were loaded from '%s'.", file_path);
+                    break;
+                }
+
+                size_t vertex_count = 0, index_count = 0;
+                for (const auto &mesh : reference.meshes) {
+                    vertex_count += mesh.vertices.size();
+                    index_count += mesh.indices.size();
+                }
+
+                printf("  %zu meshes, %zu vertices, %zu triangles\n", reference.meshes.size(), vertex_count, index_count / 3);
+            }
+
+            printf(
+                "  %2u thread(s) %10.3f ms, %5.2fx, %8.2f MB/s\n",
+                thread_count, best_time * 1e3, single_thread_time / best_time, file_megabytes / best_time
+            );
+        }
+    }
+
+    global::loader_thread_count = 0;
+    global::scene_cache = true;
+
+    if (num_mismatches > 0) {
+        LOG_ERROR("%zu loads did not match the single threaded one.", num_mismatches);
+        return false;
+    }
+
+    return true;
+}
+
+// Footprint of about 'count' vertices on a circle, every other one pulled in by a random amount
+// up to 'jag', with 'courtyards' by 'courtyards' square holes. 'area' receives the exact area.
+void make_footprint(Mesh &dst, Polygon_Rings &rings, double &area, uint count, float jag, uint courtyards) {
+    const float radius = 100.0f;
+
+    dst = {};
+    rings.clear();
+
+    // Counter-clockwise seen from above, x east and -z north
+    for (uint i = 0; i < count; ++i) {
+        float angle = 2.0f * static_cast<float>(PI) * i / count;
+        float r = radius * ((i % 2 == 1) ? 1.0f - jag * indices::hash_to_unit(i) : 1.0f);
+
+        dst.vertices.push_back({glm::vec3(r * cosf(angle), 0.0f, -r * sinf(angle)), glm::vec3(0.0f)});
+    }
+
+    rings.ring_ends.push_back(count);
+
+    // Clockwise, inside the square inscribed in the inner radius
+    float extent = (1.0f - jag) * radius * 0.7f;
+    float cell = 2.0f * extent / MAX(courtyards, 1u);
+
+    for (uint i = 0; i < courtyards * courtyards; ++i) {
+        float x = -extent + cell * (i % courtyards + 0.25f);
+        float y = -extent + cell * (i / courtyards + 0.25f);
+        float side = cell * 0.5f;
+
+        dst.vertices.push_back({glm::vec3(x, 0.0f, -y), glm::vec3(0.0f)});
+        dst.vertices.push_back({glm::vec3(x, 0.0f, -(y + side)), glm::vec3(0.0f)});
+        dst.vertices.push_back({glm::vec3(x + side, 0.0f, -(y + side)), glm::vec3(0.0f)});
+        dst.vertices.push_back({glm::vec3(x + side, 0.0f, -y), glm::vec3(0.0f)});
+
+        rings.ring_ends.push_back(static_cast<uint>(dst.vertices.size()));
+    }
+
+    rings.polygon_ends.push_back(static_cast<uint>(rings.ring_ends.size()));
+
+    dst.base_vert_count = dst.vertices.size();
+
+    area = 0.0;
+    for (uint r = 0, ring_begin = 0; r < rings.ring_ends.size(); ring_begin = rings.ring_ends[r++]) {
+        for (uint i = ring_begin, j = rings.ring_ends[r] - 1; i < rings.ring_ends[r]; j = i++) {
+            const glm::vec3 &p = dst.vertices[j].position, &q = dst.vertices[i].position;
+            area += 0.5 * (static_cast<double>(p.x) * -q.z - static_cast<double>(q.x) * -p.z);
+        }
+    }
+}
+
+// Every footprint has to be covered exactly, by triangles that all face up
+bool benchmark_triangulation() {
+    struct {
+        const char *name;
+        float       jag;
+        uint        courtyards;
+    } shapes[] = {
+        {"Smooth",     0.02f, 0},
+        {"Jagged",     0.5f,  0},
+        {"Courtyards", 0.02f, 8},
+    };
+
+    const uint counts[] = {1000, 4000, 16000};
+
+    size_t num_mismatches = 0;
+
+    Mesh mesh;
+    Polygon_Rings rings;
+
+    for (const auto &shape : shapes) {
+        printf("%s:\n", shape.name);
+
+        for (uint count : counts) {
+            double area;
+            make_footprint(mesh, rings, area, count, shape.jag, shape.courtyards);
+
+            double best_time = DBL_MAX;
+            bool triangulated = true;
+
+            for (int i = 0; i < TRIANGULATION_BENCHMARK_RUNS; ++i) {
+                mesh.indices.clear();
+
+                double time_begin = get_time();
+                triangulated = mesh.triangulate_face(0, rings);
+                best_time = MIN(best_time, get_time() - time_begin);
+            }
+
+            double triangle_area = 0.0;
+            size_t num_flipped = 0;
+
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                const glm::vec3 &a = mesh.vertices[mesh.indices[i]].position;
+                const glm::vec3 &b = mesh.vertices[mesh.indices[i + 1]].position;
+                const glm::vec3 &c = mesh.vertices[mesh.indices[i + 2]].position;
+
+                float up = glm::cross(b - a, c - a).y;
+                num_flipped += up < 0.0f;
+                triangle_area += 0.5 * up;
+            }
+
+            bool covered = fabs(triangle_area - area) <= 1e-4 * area;
+            if (!triangulated || !covered || num_flipped > 0) {
+                ++num_mismatches;
+            }
+
+            printf(
+                "  %6zu vertices %3zu rings %10.3f ms, %6zu triangles, %s\n",
+                mesh.vertices.size(), rings.ring_ends.size(), best_time * 1e3, mesh.indices.size() / 3,
+                (triangulated && covered && num_flipped == 0) ? "covered" : "NOT covered"
+            );
+        }
+    }
+
+    if (num_mismatches > 0) {
+        LOG_ERROR("%zu footprints were not triangulated exactly.", num_mismatches);
+        return false;
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+int run(int argc, char **argv) {
+    Options options;
+    if (!parse_args(options, argc, argv)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Needs no context at all
+    if (options.benchmark_triangulation) {
+        return benchmark_triangulation() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Platform initialization
+    if (!window::init(options.width, options.height)) {
+        return EXIT_FAILURE;
+    }
+
+    global::init(window::width, window::height);
+
+    global::reduction_mode = options.reduction_mode;
+    global::reduction_mode_name = options.reduction_name;
+    global::readback_depth = options.readback_depth;
+    global::batch_size = options.batch_size;
+    global::indices_resolution = options.resolution;
+    global::occlusion_culling = options.occlusion;
+    global::occluder_count = options.occluder_count;
+    global::multi_draw = options.multi_draw;
+    global::gpu_culling = options.gpu_culling;
+
+    if (options.gl_debug >= 0) {
+        gl_set_debug_severity(static_cast<Debug_Severity>(options.gl_debug));
+    }
+
+    if (options.verify) {
+        SET_FLAG(global::config_flags, CONFIG_FLAGS_VERIFY_INDICES);
+    }
+
+    if (options.panoramic) {
+        SET_FLAG(global::config_flags, CONFIG_FLAGS_PANORAMIC_INDICES);
+    }
+
+    if (options.sampled) {
+        SET_FLAG(global::config_flags, CONFIG_FLAGS_SAMPLED_INDICES);
+    }
+
+    // Falls back to the CPU reduction when compute shaders are unavailable
+    indices::init();
+
+    stbi_flip_vertically_on_write(true);
+
+    // Only needs the context, the scene is not loaded
+    if (options.benchmark_loaders) {
+        int ret = benchmark_loaders() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        indices::shutdown();
+        global::shutdown();
+        window::shutdown();
+
+        return ret;
+    }
+
+    global::loader_thread_count = static_cast<uint>(options.loader_threads);
+    global::scene_cache = options.scene_cache;
+
+    renderer::init(RENDER_MODE_COLLADA);
+
+    if (options.benchmark_bvh) {
+        int ret = benchmark_bvh() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        indices::shutdown();
+        renderer::shutdown();
+        global::shutdown();
+        window::shutdown();
+
+        return ret;
+    }
+
+    // Same render state the interactive main loop sets before computing indices
+    if (HAS_FLAG(global::config_flags, CONFIG_FLAGS_ENABLE_CULLING)) {
+        GL_CALL(glEnable(GL_CULL_FACE));
+        GL_CALL(glCullFace(global::culling_mode));
+    }
+
+    global::experiment_name = options.experiment_name;
+    memcpy(global::granularity, options.granularity, sizeof(global::granularity));
+
+    int ret = EXIT_SUCCESS;
+
+    // Building ids are the picking ids shown by the viewer, i.e. 1-based positions in 'building_indices'
+    for (int building_id : options.building_ids) {
+        if (building_id <= 0 || static_cast<size_t>(building_id) > renderer::building_indices.size()) {
+            LOG_ERROR("Building id %d is out of range [1, %zu].", building_id, renderer::building_indices.size());
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        global::picked_id = building_id;
+        global::picked_mesh_idx = renderer::building_indices[building_id - 1];
+
+        indices::compute();
+    }
+
+    // Platform shutdown
+    indices::shutdown();
+
+    renderer::shutdown();
+
+    global::shutdown();
+
+    window::shutdown();
+
+    return ret;
+}
+} // namespace batch
+
+// --------------------------------------------------------------------------------
+
+#endif // BATCH_HPP
\ No newline at end of file
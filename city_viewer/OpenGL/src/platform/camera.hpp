@@ -14,6 +14,8 @@
 #define SENSITIVITY   0.1f
 #define ZOOM         45.0f
 #define MAX_ZOOM     90.0f
+#define NEAR_PLANE    1.0f
+#define FAR_PLANE  1000.0f
 
 // --------------------------------------------------------------------------------
 
@@ -0,0 +1,152 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+#include "camera.hpp"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// --------------------------------------------------------------------------------
+
+// Headless stand-in for window.hpp: creates a surfaceless EGL context (Mesa llvmpipe
+// works) and exposes the same 'window' dimensions the renderer and indices code read.
+namespace window {
+const char *get_egl_error_name(int err_code) {
+    switch (err_code) {
+    case EGL_SUCCESS:             return "EGL_SUCCESS";
+    case EGL_NOT_INITIALIZED:     return "EGL_NOT_INITIALIZED";
+    case EGL_BAD_ACCESS:          return "EGL_BAD_ACCESS";
+    case EGL_BAD_ALLOC:           return "EGL_BAD_ALLOC";
+    case EGL_BAD_ATTRIBUTE:       return "EGL_BAD_ATTRIBUTE";
+    case EGL_BAD_CONFIG:          return "EGL_BAD_CONFIG";
+    case EGL_BAD_CONTEXT:         return "EGL_BAD_CONTEXT";
+    case EGL_BAD_CURRENT_SURFACE: return "EGL_BAD_CURRENT_SURFACE";
+    case EGL_BAD_DISPLAY:         return "EGL_BAD_DISPLAY";
+    case EGL_BAD_MATCH:           return "EGL_BAD_MATCH";
+    case EGL_BAD_PARAMETER:       return "EGL_BAD_PARAMETER";
+    case EGL_BAD_SURFACE:         return "EGL_BAD_SURFACE";
+    default:                      return "EGL_UNKNOWN_ERROR";
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+EGLDisplay display = EGL_NO_DISPLAY;
+EGLContext context = EGL_NO_CONTEXT;
+int        width;
+int        height;
+float      aspect_ratio;
+
+// --------------------------------------------------------------------------------
+
+void shutdown() {
+    if (display == EGL_NO_DISPLAY) {
+        return;
+    }
+
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+    if (context != EGL_NO_CONTEXT) {
+        eglDestroyContext(display, context);
+        context = EGL_NO_CONTEXT;
+    }
+
+    eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+}
+
+bool init(int win_width, int win_height) {
+    auto get_platform_display =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+    if (get_platform_display != nullptr) {
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    if (display == EGL_NO_DISPLAY) {
+        LOG_ERROR("Failed to get an EGL display.");
+        return false;
+    }
+
+    int major, minor;
+    if (!eglInitialize(display, &major, &minor)) {
+        LOG_ERROR("Failed to initialize EGL: %s.", get_egl_error_name(eglGetError()));
+        shutdown();
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        LOG_ERROR("Failed to bind the OpenGL API: %s.", get_egl_error_name(eglGetError()));
+        shutdown();
+        return false;
+    }
+
+    // No surface is ever created, so any surface type is acceptable
+    const EGLint config_attribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_SURFACE_TYPE,    0,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    int num_configs = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs)) {
+        LOG_ERROR("Failed to choose an EGL config: %s.", get_egl_error_name(eglGetError()));
+        shutdown();
+        return false;
+    }
+
+    // NOTE(paalf): Mesa's surfaceless platform exposes no configs at all, which is fine
+    // as long as EGL_KHR_no_config_context is supported
+    if (num_configs == 0) {
+        config = EGL_NO_CONFIG_KHR;
+    }
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION,       3,
+        EGL_CONTEXT_MINOR_VERSION,       3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+#ifdef DEBUG_MODE
+        EGL_CONTEXT_OPENGL_DEBUG,        EGL_TRUE,
+#endif // DEBUG_MODE
+        EGL_NONE
+    };
+
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if (context == EGL_NO_CONTEXT) {
+        LOG_ERROR("Failed to create EGL context: %s.", get_egl_error_name(eglGetError()));
+        shutdown();
+        return false;
+    }
+
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        LOG_ERROR("Failed to make surfaceless EGL context current: %s.", get_egl_error_name(eglGetError()));
+        shutdown();
+        return false;
+    }
+
+    fprintf(stderr, "-- EGL %d.%d Loaded --\n", major, minor);
+
+    width = win_width;
+    height = win_height;
+    aspect_ratio = static_cast<float>(width) / height;
+
+    // Core profile entry points are only resolved by GLEW in experimental mode
+    glewExperimental = GL_TRUE;
+
+    gl_init();
+
+    // Without a surface the default viewport is 0x0
+    GL_CALL(glViewport(0, 0, width, height));
+
+    return true;
+}
+} // namespace window
+
+// --------------------------------------------------------------------------------
+
+#endif // HEADLESS_HPP
\ No newline at end of file
@@ -7,70 +7,263 @@
 
 // --------------------------------------------------------------------------------
 
-struct View_Indices {
+// Per-setup reduction of the indices frame buffer, laid out like the compute shaders' result buffer
+struct View_Reduction {
     //   0      1         2        3       4      5
     // [Sky, Building, Amenity, Landmark, Tree, Water]
     uint  color[6];
-    float depth;
+    float min_depth;
+    float max_depth;
+    float depth_sum;
+};
+
+static_assert(sizeof(View_Reduction) == 9 * sizeof(uint), "View_Reduction must match the std430 result buffer.");
+
+// Results of one indices run, stored column by column with one row per camera setup ordinal
+struct Indices_Table {
+    size_t                 count;
+
+    std::vector<glm::vec3> positions;
+    std::vector<float>     yaws;
+
+    //   0      1         2        3       4      5
+    // [Sky, Building, Amenity, Landmark, Tree, Water]
+    std::vector<uint>      class_counts[INDICES_CLASS_COUNT];
+
+    std::vector<float>     min_depths;
+    std::vector<float>     max_depths;
+    std::vector<float>     avg_depths;
+
+    // Every column keeps its capacity, so runs of the same size never reallocate
+    void init(const std::vector<Camera_Setup> &setups) {
+        count = setups.size();
+
+        positions.resize(count);
+        yaws.resize(count);
+
+        for (size_t i = 0; i < count; ++i) {
+            positions[i] = setups[i].position;
+            yaws[i] = setups[i].yaw;
+        }
+
+        for (auto &counts : class_counts) {
+            counts.assign(count, 0);
+        }
+
+        min_depths.assign(count, 0.0f);
+        max_depths.assign(count, 0.0f);
+        avg_depths.assign(count, 0.0f);
+    }
+
+    void store(size_t row, const View_Reduction &reduction, int num_pixels) {
+        ASSERT(row < count);
+
+        for (uint i = 0; i < INDICES_CLASS_COUNT; ++i) {
+            class_counts[i][row] = reduction.color[i];
+        }
+
+        min_depths[row] = reduction.min_depth;
+        max_depths[row] = reduction.max_depth;
+        avg_depths[row] = reduction.depth_sum / num_pixels;
+    }
+
+    Camera_Setup get_setup(size_t row) const {
+        return {positions[row], yaws[row]};
+    }
+
+    size_t get_memory_usage() const {
+        size_t ret = sizeof(*this);
+
+        ret += positions.capacity() * sizeof(glm::vec3);
+        ret += yaws.capacity() * sizeof(float);
+
+        for (const auto &counts : class_counts) {
+            ret += counts.capacity() * sizeof(uint);
+        }
+
+        ret += (min_depths.capacity() + max_depths.capacity() + avg_depths.capacity()) * sizeof(float);
+
+        return ret;
+    }
+};
+
+// One in-flight readback of the indices frame buffer: distances followed by class ids
+struct Readback_Slot {
+    Pixel_Pack_Buffer pbo;
+    GLsync            fence;
+    size_t            setup_idx;
+};
+
+// One in-flight setup of the occlusion query reduction: a samples-passed query per class
+struct Query_Slot {
+    uint              queries[INDICES_CLASS_COUNT];
+    size_t            setup_idx;
+    bool              pending;
 };
 
 // --------------------------------------------------------------------------------
 
 namespace indices {
 const Mesh                                                        *picked_mesh      = nullptr;
+int                                                                picked_id        = -1;
 
-std::unordered_map<Camera_Setup, View_Indices, Camera_Setup_Hash>  computed_indices;
+Indices_Table                                                      computed_indices = {};
 
 std::vector<Camera_Setup>                                          camera_setups;
 
-//Shader                                                             color_shader;
-//Shader                                                             depth_shader;
+Shader                                                             color_shader;
+Shader                                                             depth_shader;
+
+Storage_Buffer                                                     reduction_buffer;
+Storage_Buffer                                                     partial_buffer;
+uint                                                               partial_capacity = 0;
+
+std::vector<Readback_Slot>                                         readback_ring;
+size_t                                                             readback_size    = 0;
+
+std::vector<Query_Slot>                                            query_ring;
+
+Indices_Frame_Buffer                                               panorama_buffer  = {};
+
+bool                                                               gpu_reduction    = false;
+uint                                                               mismatch_count   = 0;
+
+// Stochastic sampling of the current run and its widest confidence interval
+bool                                                               sampling         = false;
+float                                                              max_rate_error   = 0.0f;
+
+// Meshes drawn, frustum culled and occluded over every indices pass of the current run
+Culling_Stats                                                      culling_totals   = {};
+
+// What the GPU culled passes had counted when the run began, they only count on the GPU
+Culling_Stats                                                      gpu_culling_begin = {};
 
 timespec                                                           time_begin;
 timespec                                                           time_end;
-size_t                                                             memory_usage     = 0;
 
 // --------------------------------------------------------------------------------
 
-size_t set_memory_usage() {
-    size_t total_usage = sizeof(computed_indices);
+void init() {
+    if (!GLEW_VERSION_4_3 && !(GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object)) {
+        LOG_WARNING("Compute shaders are not supported, indices will be reduced on the CPU.");
+
+        if (global::reduction_mode == REDUCTION_MODE_GPU) {
+            global::reduction_mode = REDUCTION_MODE_CPU;
+            global::reduction_mode_name = "CPU";
+        }
 
-    for (const auto &p : computed_indices) {
-        total_usage += sizeof(p.first) + sizeof(p.second);
+        return;
     }
 
-    size_t ret = total_usage - memory_usage;
+    color_shader = make_compute_shader("res/shaders/color_comp.glsl");
+    depth_shader = make_compute_shader("res/shaders/depth_comp.glsl");
+
+    if (color_shader.id == 0 || depth_shader.id == 0) {
+        LOG_ERROR("Failed to create the reduction shaders, indices will be reduced on the CPU.");
+
+        if (global::reduction_mode == REDUCTION_MODE_GPU) {
+            global::reduction_mode = REDUCTION_MODE_CPU;
+            global::reduction_mode_name = "CPU";
+        }
+
+        return;
+    }
 
-    memory_usage = total_usage;
+    reduction_buffer = make_storage_buffer();
+    reduction_buffer.init(nullptr, sizeof(View_Reduction));
 
-    return ret;
+    partial_buffer = make_storage_buffer();
+
+    gpu_reduction = true;
 }
 
-// --------------------------------------------------------------------------------
+void destroy_readback_ring() {
+    for (auto &slot : readback_ring) {
+        if (slot.fence != nullptr) {
+            GL_CALL(glDeleteSync(slot.fence));
+        }
 
-void init() {
-    //color_shader = make_shader("res/shaders/color_comp.glsl", global::transient_storage);
-    //depth_shader = make_shader("res/shaders/depth_comp.glsl", global::transient_storage);
+        destroy(slot.pbo);
+    }
+
+    readback_ring.clear();
+    readback_size = 0;
+}
+
+void init_readback_ring(int depth, size_t size) {
+    if (readback_ring.size() == static_cast<size_t>(depth) && readback_size == size) {
+        return;
+    }
+
+    destroy_readback_ring();
+
+    readback_ring.resize(depth);
+    for (auto &slot : readback_ring) {
+        slot.pbo = make_pixel_pack_buffer();
+        slot.pbo.init(size);
+        slot.fence = nullptr;
+        slot.setup_idx = 0;
+    }
+
+    readback_size = size;
+}
+
+void destroy_query_ring() {
+    for (auto &slot : query_ring) {
+        GL_CALL(glDeleteQueries(INDICES_CLASS_COUNT, slot.queries));
+    }
+
+    query_ring.clear();
+}
+
+void init_query_ring(int depth) {
+    if (query_ring.size() == static_cast<size_t>(depth)) {
+        return;
+    }
+
+    destroy_query_ring();
+
+    query_ring.resize(depth);
+    for (auto &slot : query_ring) {
+        GL_CALL(glGenQueries(INDICES_CLASS_COUNT, slot.queries));
+        slot.setup_idx = 0;
+        slot.pending = false;
+    }
 }
 
 void shutdown() {
-    //destroy(color_shader);
-    //destroy(depth_shader);
+    destroy_query_ring();
+    destroy_readback_ring();
+
+    if (panorama_buffer.id != 0) {
+        destroy(panorama_buffer);
+    }
+
+    if (gpu_reduction) {
+        destroy(partial_buffer);
+        destroy(reduction_buffer);
+        destroy(depth_shader);
+        destroy(color_shader);
+    }
 }
 
 // --------------------------------------------------------------------------------
 
 void set_camera_setups() {
+    // Picking another building while the computation runs must not affect it
     picked_mesh = &renderer::buildings_model.meshes[global::picked_mesh_idx];
+    picked_id = global::picked_id;
 
     // TODO(paalf): double check this
     camera_setups.reserve(global::granularity[0] * global::granularity[1] * global::granularity[2] * picked_mesh->base_vert_count);
 
-    std::vector<Vertex> verts;
+    // Lives until the end of the run's scope
+    Vertex *verts;
+    size_t vert_count;
     if (renderer::mode == RENDER_MODE_GEOJSON) {
-        verts = picked_mesh->subdivide(global::granularity[0], global::granularity[1]);
+        verts = picked_mesh->subdivide(global::transient_storage, global::granularity[0], global::granularity[1], vert_count);
     } else {
-        verts = picked_mesh->subdivide_aabb(global::granularity);
+        verts = picked_mesh->subdivide_aabb(global::transient_storage, global::granularity, vert_count);
     }
 
     uint ares = global::granularity[2];
@@ -80,7 +273,9 @@ void set_camera_setups() {
     float yaw_step = 180.0f / ares;
     float yaw;
 
-    for (const auto &vert : verts) {
+    for (size_t j = 0; j < vert_count; ++j) {
+        const auto &vert = verts[j];
+
         base_yaw = glm::degrees(atan2f(vert.normal.z, vert.normal.x));
         min_yaw = base_yaw - 90.0f, max_yaw = base_yaw + 90.0f;
 
@@ -93,144 +288,830 @@ void set_camera_setups() {
 
 // --------------------------------------------------------------------------------
 
-uint get_color_id(const ubyte *color_pixels) {
-    if (color_pixels[0] == 255 && color_pixels[1] == 0 && color_pixels[2] == 0) {
-        return 1; // Building
+void reduce_pixels(View_Reduction &dst, const ubyte *class_pixels, const float *distance_pixels, uint num_pixels) {
+    dst = {};
+
+    // Color index computation
+    for (uint j = 0; j < num_pixels; ++j) {
+        ++dst.color[MIN(class_pixels[j], INDICES_CLASS_COUNT - 1)];
     }
 
-    if (color_pixels[0] == 255 && color_pixels[1] == 255 && color_pixels[2] == 0) {
-        return 2; // Amenity
+    // Depth index computation
+    dst.min_depth = FLT_MAX;
+    dst.max_depth = 0.0f;
+
+    // NOTE(paalf): a float accumulator drifts noticeably over a full frame of distances
+    double depth_sum = 0.0;
+
+    for (uint j = 0; j < num_pixels; ++j) {
+        dst.min_depth = MIN(dst.min_depth, distance_pixels[j]);
+        dst.max_depth = MAX(dst.max_depth, distance_pixels[j]);
+
+        depth_sum += distance_pixels[j];
     }
 
-    if (color_pixels[0] == 255 && color_pixels[1] == 0 && color_pixels[2] == 255) {
-        return 3; // Landmark
+    dst.depth_sum = static_cast<float>(depth_sum);
+}
+
+void reduce_cpu(View_Reduction &dst, int layer = 0) {
+    uint num_pixels = global::indices_buffer.width * global::indices_buffer.height;
+
+    ubyte *class_pixels = global::indices_buffer.retrieve_class_pixels(layer);
+    float *distance_pixels = global::indices_buffer.retrieve_distance_pixels(layer);
+
+    reduce_pixels(dst, class_pixels, distance_pixels, num_pixels);
+}
+
+void reduce_gpu(View_Reduction &dst, int layer) {
+    // Must match GROUP_SIZE in the shaders; each invocation walks roughly 'pixels_per_invocation'
+    // pixels, which keeps the number of work groups (and barriers) low
+    constexpr uint group_size            = 256;
+    constexpr uint pixels_per_invocation = 32;
+
+    const Indices_Frame_Buffer &fb = global::indices_buffer;
+
+    uint num_pixels = fb.width * fb.height;
+    uint partial_count = (num_pixels + group_size * pixels_per_invocation - 1) / (group_size * pixels_per_invocation);
+
+    if (partial_count > partial_capacity) {
+        partial_buffer.init(nullptr, partial_count * sizeof(float));
+        partial_capacity = partial_count;
+    }
+
+    View_Reduction initial = {};
+    initial.min_depth = FLT_MAX;
+    initial.max_depth = 0.0f;
+
+    reduction_buffer.write(&initial, sizeof(initial));
+
+    reduction_buffer.bind_base(0);
+    partial_buffer.bind_base(1);
+
+    GL_CALL(glActiveTexture(GL_TEXTURE0));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, fb.class_texture));
+    GL_CALL(glActiveTexture(GL_TEXTURE1));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, fb.distance_texture));
+
+    // Class histogram
+    color_shader.bind();
+    color_shader.set_uniform_1i(UNIFORM_LAYER, layer);
+    GL_CALL(glDispatchCompute(partial_count, 1, 1));
+
+    // Depth min/max and per-group sums
+    depth_shader.bind();
+    depth_shader.set_uniform_1i(UNIFORM_LAYER, layer);
+    depth_shader.set_uniform_1ui(UNIFORM_PARTIAL_COUNT, partial_count);
+    depth_shader.set_uniform_1i(UNIFORM_RESOLVE, 0);
+    GL_CALL(glDispatchCompute(partial_count, 1, 1));
+
+    GL_CALL(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+
+    // Depth sum resolve
+    depth_shader.set_uniform_1i(UNIFORM_RESOLVE, 1);
+    GL_CALL(glDispatchCompute(1, 1, 1));
+
+    GL_CALL(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
+
+    reduction_buffer.read(&dst, sizeof(dst));
+
+    depth_shader.unbind();
+
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+    GL_CALL(glActiveTexture(GL_TEXTURE0));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+}
+
+bool class_counts_match(const View_Reduction &a, const View_Reduction &b) {
+    for (uint i = 0; i < ARRAY_SIZE(a.color); ++i) {
+        if (a.color[i] != b.color[i]) {
+            return false;
+        }
     }
 
-    if (color_pixels[0] == 0 && color_pixels[1] == 255 && color_pixels[2] == 0) {
-        return 4; // Tree
+    return true;
+}
+
+bool reductions_match(const View_Reduction &a, const View_Reduction &b) {
+    if (!class_counts_match(a, b)) {
+        return false;
     }
 
-    if (color_pixels[0] == 0 && color_pixels[1] == 0 && color_pixels[2] == 255) {
-        return 5; // Water
+    // Distances are stored as floats, so both sides see exactly the same values
+    if (a.min_depth != b.min_depth || a.max_depth != b.max_depth) {
+        return false;
     }
 
-    return 0; // Sky
+    // Both sides sum in a different order, so the sum only has to agree up to rounding
+    return fabsf(a.depth_sum - b.depth_sum) <= 1e-4f * MAX(fabsf(b.depth_sum), 1.0f);
+}
+
+void reduce(View_Reduction &dst, int layer) {
+    if (global::reduction_mode == REDUCTION_MODE_GPU && gpu_reduction) {
+        reduce_gpu(dst, layer);
+    } else {
+        reduce_cpu(dst, layer);
+    }
 }
 
 // --------------------------------------------------------------------------------
 
-void compute() {
+void issue_readback(Readback_Slot &slot, size_t setup_idx, int layer) {
+    const Indices_Frame_Buffer &fb = global::indices_buffer;
+
+    // Distances first so that they stay 4-byte aligned, class ids right after
+    size_t distance_size = sizeof(float) * fb.width * fb.height;
+
+    fb.pack_distance_pixels(slot.pbo, 0, layer);
+    fb.pack_class_pixels(slot.pbo, distance_size, layer);
+
+    GL_CALL(slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    slot.setup_idx = setup_idx;
+}
+
+void resolve_readback(Readback_Slot &slot, View_Reduction &dst) {
+    constexpr uint64_t timeout_ns = 1000000;
+
+    const Indices_Frame_Buffer &fb = global::indices_buffer;
+
+    uint num_pixels = fb.width * fb.height;
+    size_t distance_size = sizeof(float) * num_pixels;
+
+    // Only stalls when the GPU is more than 'readback_depth' setups behind
+    uint status = GL_TIMEOUT_EXPIRED;
+    while (status == GL_TIMEOUT_EXPIRED) {
+        GL_CALL(status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns));
+    }
+
+    if (status == GL_WAIT_FAILED) {
+        LOG_ERROR("Failed to wait for the readback of camera setup %zu.", slot.setup_idx);
+    }
+
+    GL_CALL(glDeleteSync(slot.fence));
+    slot.fence = nullptr;
+
+    const ubyte *pixels = static_cast<const ubyte *>(slot.pbo.map(readback_size));
+    ASSERT(pixels != nullptr);
+
+    reduce_pixels(dst, pixels + distance_size, reinterpret_cast<const float *>(pixels), num_pixels);
+
+    slot.pbo.unmap();
+}
+
+// --------------------------------------------------------------------------------
+
+// Called after every indices pass
+void accumulate_culling_stats() {
+    const Culling_Stats &stats = global::culling_stats[RENDER_PASS_INDICES];
+
+    culling_totals.drawn += stats.drawn;
+    culling_totals.culled += stats.culled;
+    culling_totals.occluded += stats.occluded;
+}
+
+// --------------------------------------------------------------------------------
+
+void issue_queries(Query_Slot &slot, size_t setup_idx) {
+    renderer::render_indices_queries(slot.queries);
+    accumulate_culling_stats();
+
+    slot.setup_idx = setup_idx;
+    slot.pending = true;
+}
+
+// Class counts only, the queries carry no distances: the depths are flagged with -1
+void resolve_queries(Query_Slot &slot, View_Reduction &dst, uint num_pixels) {
+    dst = {};
+
+    // Only stalls when the GPU is more than 'readback_depth' setups behind
+    uint covered = 0;
+    for (uint i = INDICES_CLASS_SKY + 1; i < INDICES_CLASS_COUNT; ++i) {
+        GL_CALL(glGetQueryObjectuiv(slot.queries[i], GL_QUERY_RESULT, &dst.color[i]));
+        covered += dst.color[i];
+    }
+
+    // NOTE(paalf): coplanar surfaces of different classes pass the equal test in both
+    // passes, so the covered count can exceed the frame
+    dst.color[INDICES_CLASS_SKY] = covered < num_pixels ? num_pixels - covered : 0;
+
+    dst.min_depth = -1.0f;
+    dst.max_depth = -1.0f;
+    dst.depth_sum = -1.0f * num_pixels;
+
+    slot.pending = false;
+}
+
+// --------------------------------------------------------------------------------
+
+// Jittering the projection by up to half a pixel turns every pixel of a render into a uniform
+// sample of its own cell of the image plane, i.e. a stratified sample of the exact view
+float hash_to_unit(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+
+    return static_cast<float>(x >> 8) / (1u << 24);
+}
+
+// Deterministic per setup, so sampled runs are reproducible
+void jitter_projection(size_t setup_idx) {
+    const Indices_Frame_Buffer &fb = global::indices_buffer;
+
+    float jitter_x = (hash_to_unit(2 * static_cast<uint>(setup_idx)) - 0.5f) * 2.0f / fb.width;
+    float jitter_y = (hash_to_unit(2 * static_cast<uint>(setup_idx) + 1) - 0.5f) * 2.0f / fb.height;
+
+    renderer::projection = glm::translate(glm::mat4(1.0f), glm::vec3(jitter_x, jitter_y, 0.0f)) * renderer::projection;
+}
+
+// NOTE(paalf): Wilson score interval of the binomial rate, which unlike the normal approximation
+// does not collapse to zero width when a class is absent from, or fills, every sample. The bound is
+// the farther end of the interval from the rate, since the interval is not centered on it.
+// Stratification only makes the actual error smaller, so this is a conservative bound.
+float get_rate_error(uint count, int num_samples) {
+    double n = static_cast<double>(num_samples);
+    double rate = count / n;
+    double z2 = RATE_ERROR_Z * RATE_ERROR_Z;
+
+    double denom = 1.0 + z2 / n;
+    double center = (rate + z2 / (2.0 * n)) / denom;
+    double half_width = RATE_ERROR_Z * sqrt(rate * (1.0 - rate) / n + z2 / (4.0 * n * n)) / denom;
+
+    return static_cast<float>(fabs(center - rate) + half_width);
+}
+
+// --------------------------------------------------------------------------------
+
+void store_reduction(Experiment &experiment, size_t setup_idx, const View_Reduction &reduction, int num_pixels) {
+    Indices_Table &table = computed_indices;
+
+    table.store(setup_idx, reduction, num_pixels);
+
+    // Color index computation
+    float sky_rate = static_cast<float>(table.class_counts[INDICES_CLASS_SKY][setup_idx]) / num_pixels;
+    float building_rate = static_cast<float>(table.class_counts[INDICES_CLASS_BUILDING][setup_idx]) / num_pixels;
+    float amenity_rate = static_cast<float>(table.class_counts[INDICES_CLASS_AMENITY][setup_idx]) / num_pixels;
+    float landmark_rate = static_cast<float>(table.class_counts[INDICES_CLASS_LANDMARK][setup_idx]) / num_pixels;
+    float tree_rate = static_cast<float>(table.class_counts[INDICES_CLASS_TREE][setup_idx]) / num_pixels;
+    float water_rate = static_cast<float>(table.class_counts[INDICES_CLASS_WATER][setup_idx]) / num_pixels;
+
+    // Half-widths of the 95% confidence intervals, only meaningful when pixels are stochastic samples
+    float rate_errors[INDICES_CLASS_COUNT] = {};
+
+    if (sampling) {
+        for (uint i = 0; i < INDICES_CLASS_COUNT; ++i) {
+            rate_errors[i] = get_rate_error(table.class_counts[i][setup_idx], num_pixels);
+            max_rate_error = MAX(max_rate_error, rate_errors[i]);
+        }
+    }
+
+    // Depth index computation, distances are already linear (and -1 when unavailable)
+    float min_depth = table.min_depths[setup_idx];
+    float max_depth = table.max_depths[setup_idx];
+    float avg_depth = table.avg_depths[setup_idx];
+
+    Camera_Setup actual_cur_setup = table.get_setup(setup_idx);
+    actual_cur_setup.position -= picked_mesh->aabb.min;
+
+    // Partial results for the menu
+    ++global::indices_progress.num_done;
+    for (uint i = 0; i < INDICES_CLASS_COUNT; ++i) {
+        global::indices_progress.rate_sums[i] += static_cast<double>(table.class_counts[i][setup_idx]) / num_pixels;
+    }
+
+    experiment.write_data(picked_id, picked_mesh->aabb.min,
+                          actual_cur_setup,
+                          building_rate, landmark_rate, amenity_rate, tree_rate, water_rate, sky_rate,
+                          min_depth, max_depth, avg_depth, rate_errors);
+}
+
+// --------------------------------------------------------------------------------
+
+// Cube faces of the panorama, in layer order: +X, +Z, -X, -Z, +Y, -Y. The first four are the
+// yaws 0, 90, 180 and 270 of the camera.
+struct Panorama_Face {
+    glm::vec3 front;
+    glm::vec3 up;
+};
+
+const Panorama_Face panorama_faces[6] = {
+    {{ 1.0f,  0.0f,  0.0f}, {0.0f, 1.0f,  0.0f}},
+    {{ 0.0f,  0.0f,  1.0f}, {0.0f, 1.0f,  0.0f}},
+    {{-1.0f,  0.0f,  0.0f}, {0.0f, 1.0f,  0.0f}},
+    {{ 0.0f,  0.0f, -1.0f}, {0.0f, 1.0f,  0.0f}},
+    {{ 0.0f,  1.0f,  0.0f}, {0.0f, 0.0f, -1.0f}},
+    {{ 0.0f, -1.0f,  0.0f}, {0.0f, 0.0f,  1.0f}}
+};
+
+// Face size that matches the pixel density at the center of the camera's view
+int get_panorama_face_size() {
+    int max_size = 0;
+    GL_CALL(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size));
+
+    int face_size = static_cast<int>(ceilf(global::indices_buffer.height / tanf(glm::radians(camera::zoom) * 0.5f)));
+
+    return MIN(face_size, max_size);
+}
+
+// The side faces reach 35.26 degrees above and below the horizon at their corners, so the
+// top and bottom faces are only needed when the view can look further up or down than that
+uint get_panorama_face_count() {
+    float max_elevation = camera::zoom * 0.5f + fabsf(camera::pitch);
+
+    return max_elevation > glm::degrees(atanf(1.0f / sqrtf(2.0f))) ? 6 : 4;
+}
+
+void capture_panorama(glm::vec3 position, uint face_count) {
+    glm::mat4 face_views[6];
+    for (uint i = 0; i < face_count; ++i) {
+        face_views[i] = glm::lookAt(position, position + panorama_faces[i].front, panorama_faces[i].up);
+    }
+
+    renderer::render_panorama(panorama_buffer, face_views, face_count);
+}
+
+void resample_panorama() {
+    glm::mat3 face_rotations[6];
+    for (uint i = 0; i < ARRAY_SIZE(face_rotations); ++i) {
+        face_rotations[i] = glm::mat3(glm::lookAt(glm::vec3(0.0f), panorama_faces[i].front, panorama_faces[i].up));
+    }
+
+    renderer::resample_panorama(panorama_buffer, face_rotations);
+}
+
+// --------------------------------------------------------------------------------
+
+void _reduce_setup(Experiment &experiment, size_t setup_idx, int layer, int num_pixels, bool async_readback, bool verify) {
+    View_Reduction reduction;
+
+    if (global::reduction_mode == REDUCTION_MODE_QUERY) {
+        Query_Slot &slot = query_ring[setup_idx % query_ring.size()];
+        if (slot.pending) {
+            resolve_queries(slot, reduction, num_pixels);
+            store_reduction(experiment, slot.setup_idx, reduction, num_pixels);
+        }
+
+        issue_queries(slot, setup_idx);
+
+        // Verification waits on the queries right away, which defeats the point of the ring
+        if (verify) {
+            resolve_queries(slot, reduction, num_pixels);
+
+            View_Reduction reference;
+            reduce_cpu(reference, layer);
+
+            if (!class_counts_match(reduction, reference)) {
+                LOG_ERROR("Class counts differ from the CPU ones for camera setup %zu.", setup_idx);
+                ++mismatch_count;
+            }
+
+            store_reduction(experiment, setup_idx, reduction, num_pixels);
+        }
+
+        return;
+    }
+
+    if (async_readback) {
+        // Reduce the oldest setup in flight before its slot is reused, so rendering of the
+        // next setups overlaps with the readback and reduction of the previous ones
+        Readback_Slot &slot = readback_ring[setup_idx % readback_ring.size()];
+        if (slot.fence != nullptr) {
+            resolve_readback(slot, reduction);
+            store_reduction(experiment, slot.setup_idx, reduction, num_pixels);
+        }
+
+        issue_readback(slot, setup_idx, layer);
+
+        return;
+    }
+
+    reduce(reduction, layer);
+
+    if (verify) {
+        View_Reduction reference;
+        reduce_cpu(reference, layer);
+
+        if (!reductions_match(reduction, reference)) {
+            LOG_ERROR("Reduction differs from the CPU one for camera setup %zu.", setup_idx);
+            ++mismatch_count;
+        }
+    }
+
+    store_reduction(experiment, setup_idx, reduction, num_pixels);
+}
+
+// Reduces one layer of the indices frame buffer, either right away or through the readback ring.
+// Anything the reduction takes from the transient storage is released before the next setup.
+void reduce_setup(Experiment &experiment, size_t setup_idx, int layer, int num_pixels, bool async_readback, bool verify) {
+    Arena_Scope setup_scope = global::transient_storage.begin_scope();
+
+    _reduce_setup(experiment, setup_idx, layer, num_pixels, async_readback, verify);
+
+    global::transient_storage.end_scope(setup_scope);
+}
+
+// --------------------------------------------------------------------------------
+
+// State of an indices run, carried over from one 'step' to the next
+struct Indices_Job {
+    Experiment  *experiment;
+    Arena_Scope  run_scope;
+
+    int          resolution_x;
+    int          resolution_y;
+    float        aspect_ratio;
+    int          num_pixels;
+
+    // The camera may be turned and zoomed between steps, every setup uses what the run began with
+    float        zoom;
+    float        pitch;
+
+    bool         query_reduction;
+    bool         async_readback;
+    bool         verify;
+    bool         panoramic;
+    size_t       batch_size;
+    uint         face_count;
+
+    // First camera setup that has not been rendered yet
+    size_t       next_setup;
+
+    size_t       heap_allocations_begin;
+};
+
+Indices_Job job = {};
+
+// --------------------------------------------------------------------------------
+
+double get_elapsed_time() {
+    timespec time_now;
+    timespec_get(&time_now, TIME_UTC);
+
+    return (time_now.tv_sec - time_begin.tv_sec) + (time_now.tv_nsec - time_begin.tv_nsec) * 1e-9;
+}
+
+void begin() {
     if (global::saved_experiments.find(global::experiment_name) == global::saved_experiments.end()) {
         global::saved_experiments.emplace(global::experiment_name, global::experiment_name.c_str());
     }
 
-    Experiment &experiment = global::saved_experiments[global::experiment_name];
+    job = {};
+    job.experiment = &global::saved_experiments[global::experiment_name];
 
     timespec_get(&time_begin, TIME_UTC);
 
+    // The indices pass renders offscreen, at the window's aspect ratio whatever its resolution, so
+    // a lower resolution is a coarser sample of the same view and not a narrower one
+    job.aspect_ratio = static_cast<float>(window::width) / window::height;
+
+    job.zoom = camera::zoom;
+    job.pitch = camera::pitch;
+
+    job.resolution_x = window::width;
+    job.resolution_y = window::height;
+
+    if (global::indices_resolution != INDICES_RESOLUTION_WINDOW) {
+        int short_side = static_cast<int>(lroundf(global::indices_resolution * MIN(job.aspect_ratio, 1.0f / job.aspect_ratio)));
+        short_side = MAX(short_side, 1);
+
+        if (window::width >= window::height) {
+            job.resolution_x = global::indices_resolution;
+            job.resolution_y = short_side;
+        } else {
+            job.resolution_x = short_side;
+            job.resolution_y = global::indices_resolution;
+        }
+    }
+
+    if (global::indices_buffer.width != job.resolution_x || global::indices_buffer.height != job.resolution_y) {
+        global::indices_buffer.resize(job.resolution_x, job.resolution_y);
+    }
+
+    // Room for the camera setup generation plus a couple of full frame readbacks per setup, so
+    // that the arena does not have to fall back to the heap on the first run at a new resolution
+    size_t frame_size = (sizeof(float) + sizeof(ubyte)) * global::indices_buffer.width * global::indices_buffer.height;
+    global::transient_storage.reserve(2 * frame_size + MEGABYTES(1));
+
+    global::transient_storage.reset_counters();
+
+    job.run_scope = global::transient_storage.begin_scope();
+
     set_camera_setups();
 
-    Camera_Setup original_setup = {camera::position, camera::yaw};
+    // One row per setup ordinal, every setup is reduced exactly once
+    computed_indices.init(camera_setups);
+
+    job.num_pixels = job.resolution_x * job.resolution_y;
+
+    job.query_reduction = global::reduction_mode == REDUCTION_MODE_QUERY;
+    job.async_readback = global::reduction_mode == REDUCTION_MODE_CPU_ASYNC;
+    job.verify = HAS_FLAG(global::config_flags, CONFIG_FLAGS_VERIFY_INDICES)
+                 && (global::reduction_mode == REDUCTION_MODE_GPU || job.query_reduction);
+
+    if (job.async_readback) {
+        global::readback_depth = CLAMP(global::readback_depth, 1, MAX_READBACK_DEPTH);
+        init_readback_ring(global::readback_depth, frame_size);
+    }
+
+    if (job.query_reduction) {
+        global::readback_depth = CLAMP(global::readback_depth, 1, MAX_READBACK_DEPTH);
+        init_query_ring(global::readback_depth);
+    }
+
+    job.panoramic = HAS_FLAG(global::config_flags, CONFIG_FLAGS_PANORAMIC_INDICES);
+
+    // The queries count the pixels of the whole frame buffer, so every setup needs a pass of its own
+    if (job.query_reduction && (job.panoramic || global::batch_size > 1)) {
+        LOG_WARNING("Occlusion queries render one camera setup per pass.");
+        job.panoramic = false;
+    }
+
+    // The panorama is resampled at pixel centers, there is nothing to jitter
+    sampling = HAS_FLAG(global::config_flags, CONFIG_FLAGS_SAMPLED_INDICES);
+    if (sampling && job.panoramic) {
+        LOG_WARNING("Stochastic sampling is not supported with panoramic capture.");
+        sampling = false;
+    }
+
+    max_rate_error = 0.0f;
+
+    culling_totals = {};
+
+    Culling_Stats gpu_totals[RENDER_PASS_COUNT];
+    renderer::get_gpu_culling_totals(gpu_totals);
+    gpu_culling_begin = gpu_totals[RENDER_PASS_INDICES];
+
+    // Every setup of a batch is rendered into its own layer of the indices frame buffer
+    global::batch_size = CLAMP(global::batch_size, 1, MAX_BATCH_SIZE);
+
+    job.batch_size = job.panoramic || job.query_reduction ? 1 : global::batch_size;
+    if (global::indices_buffer.layers != static_cast<int>(job.batch_size)) {
+        global::indices_buffer.resize(global::indices_buffer.width, global::indices_buffer.height, job.batch_size);
+    }
+
+    if (job.panoramic) {
+        int face_size = get_panorama_face_size();
+
+        if (panorama_buffer.id == 0) {
+            panorama_buffer = make_indices_frame_buffer();
+            panorama_buffer.init(face_size, face_size, 6);
+        } else if (panorama_buffer.width != face_size) {
+            panorama_buffer.resize(face_size, face_size);
+        }
+
+        job.face_count = get_panorama_face_count();
+    }
+
+    mismatch_count = 0;
+
+    global::indices_progress = {};
+    global::indices_progress.running = true;
+    global::indices_progress.num_setups = camera_setups.size();
+
+    // Everything from here on is expected to run out of the arena without touching the heap
+    job.heap_allocations_begin = global::transient_storage.num_heap_allocations;
+}
+
+// Renders and reduces the next group of camera setups: the yaws of one panorama, one batch or
+// a single setup
+void advance() {
+    Experiment &experiment = *job.experiment;
+
+    size_t i = job.next_setup;
+
+    if (job.panoramic) {
+        // All the yaws at one facade point share the panorama captured there
+        size_t view_count = 1;
+        while (i + view_count < camera_setups.size() && camera_setups[i + view_count].position == camera_setups[i].position) {
+            ++view_count;
+        }
 
-    constexpr uint color_num_channels = 4;
-    constexpr uint depth_num_channels = 1;
+        renderer::update_mvp(job.aspect_ratio);
 
-    int num_pixels = window::width * window::height;
+        capture_panorama(camera_setups[i].position, job.face_count);
+        accumulate_culling_stats();
 
-    uint color_len = color_num_channels * num_pixels;
-    uint depth_len = depth_num_channels * num_pixels;
+        for (size_t j = 0; j < view_count; ++j) {
+            camera::position = camera_setups[i + j].position;
+            camera::set_yaw(camera_setups[i + j].yaw);
 
-    ubyte *mesh_color_pixels = nullptr;
-    float *cur_depth_pixels = nullptr;
+            resample_panorama();
 
-    char tmp_name[2] = "a";
+            reduce_setup(experiment, i + j, 0, job.num_pixels, job.async_readback, job.verify);
+        }
 
-    for (size_t i = 0; i < camera_setups.size(); ++i) {
+        job.next_setup += view_count;
+    } else if (job.batch_size == 1) {
         const auto &cur_setup = camera_setups[i];
 
         camera::position = cur_setup.position;
         camera::set_yaw(cur_setup.yaw);
 
         // MVP update
-        renderer::update_mvp();
-
-        // Indices shader update
-        renderer::set_mvp_uniform(renderer::indices_shader);
+        renderer::update_mvp(job.aspect_ratio);
 
-        renderer::render_indices();
+        if (sampling) {
+            jitter_projection(i);
+        }
 
-        // TMP
-        //save_screenshot(tmp_name, SCREENSHOT_INDICES);
-        //++tmp_name[0];
+        // Frame uniforms update, for the jittered projection too
+        renderer::set_frame_uniforms();
 
-        // Color index computation
-        mesh_color_pixels = global::indices_buffer.retrieve_color_pixels();
-        uint cur_color_id;
-        for (uint j = 0; j < color_len; j += color_num_channels) {
-            cur_color_id = get_color_id(mesh_color_pixels + j);
-            ++computed_indices[cur_setup].color[cur_color_id];
+        // The query reduction renders when it issues its queries
+        if (!job.query_reduction) {
+            renderer::render_indices();
+            accumulate_culling_stats();
         }
-        free(mesh_color_pixels);
 
-        float sky_rate = static_cast<float>(computed_indices[cur_setup].color[0]) / num_pixels;
-        float building_rate = static_cast<float>(computed_indices[cur_setup].color[1]) / num_pixels;
-        float amenity_rate = static_cast<float>(computed_indices[cur_setup].color[2]) / num_pixels;
-        float landmark_rate = static_cast<float>(computed_indices[cur_setup].color[3]) / num_pixels;
-        float tree_rate = static_cast<float>(computed_indices[cur_setup].color[4]) / num_pixels;
-        float water_rate = static_cast<float>(computed_indices[cur_setup].color[5]) / num_pixels;
+        reduce_setup(experiment, i, 0, job.num_pixels, job.async_readback, job.verify);
 
-        // Depth index computation
-        float min_depth = FLT_MAX;
-        float max_depth = FLT_MIN;
+        ++job.next_setup;
+    } else {
+        glm::mat4 batch_views[MAX_BATCH_SIZE];
+
+        size_t view_count = MIN(job.batch_size, camera_setups.size() - i);
 
-        cur_depth_pixels = global::indices_buffer.retrieve_depth_pixels();
-        float cur_depth_sum = 0.0f;
-        for (uint j = 0; j < depth_len; j += depth_num_channels) {
-            min_depth = MIN(min_depth, cur_depth_pixels[j]);
-            max_depth = MAX(max_depth, cur_depth_pixels[j]);
+        for (size_t j = 0; j < view_count; ++j) {
+            camera::position = camera_setups[i + j].position;
+            camera::set_yaw(camera_setups[i + j].yaw);
 
-            cur_depth_sum += cur_depth_pixels[j];
+            batch_views[j] = camera::get_view_matrix();
         }
-        free(cur_depth_pixels);
 
-        float avg_depth = cur_depth_sum / (window::width * window::height);
+        // MVP update, the view matrices come from the batch
+        renderer::update_mvp(job.aspect_ratio);
 
-        constexpr float near_ = 1.0f;
-        constexpr float far_ = 1000.0f;
+        // One jitter per batch, every layer is still a stratified sample
+        if (sampling) {
+            jitter_projection(i);
+        }
 
-        float actual_min_depth = near_ * far_ / (far_ - min_depth * (far_ - near_));
-        float actual_max_depth = near_ * far_ / (far_ - max_depth * (far_ - near_));
-        float actual_avg_depth = near_ * far_ / (far_ - avg_depth * (far_ - near_));
+        // Indices batch shader update
+        renderer::set_batch_uniforms(batch_views, view_count);
 
-        computed_indices[cur_setup].depth = actual_avg_depth;
+        renderer::render_indices_batch(view_count);
+        accumulate_culling_stats();
 
-        Camera_Setup actual_cur_setup = cur_setup;
-        actual_cur_setup.position -= picked_mesh->aabb.min;
+        // Each layer is reduced exactly like a single setup would be
+        for (size_t j = 0; j < view_count; ++j) {
+            reduce_setup(experiment, i + j, static_cast<int>(j), job.num_pixels, job.async_readback, job.verify);
+        }
 
-        experiment.write_data(global::picked_id, picked_mesh->aabb.min,
-                              actual_cur_setup,
-                              building_rate, landmark_rate, amenity_rate, tree_rate, water_rate, sky_rate,
-                              actual_min_depth, actual_max_depth, actual_avg_depth);
+        job.next_setup += view_count;
     }
+}
 
-    camera::position = original_setup.position;
-    camera::set_yaw(original_setup.yaw);
+// Waits for the setups still in flight, oldest first, and stores their results unless cancelled
+void drain(bool store) {
+    View_Reduction reduction;
+
+    if (job.async_readback) {
+        for (size_t j = job.next_setup; j < job.next_setup + readback_ring.size(); ++j) {
+            Readback_Slot &slot = readback_ring[j % readback_ring.size()];
+            if (slot.fence != nullptr) {
+                resolve_readback(slot, reduction);
+                if (store) {
+                    store_reduction(*job.experiment, slot.setup_idx, reduction, job.num_pixels);
+                }
+            }
+        }
+    }
+
+    if (job.query_reduction) {
+        for (size_t j = job.next_setup; j < job.next_setup + query_ring.size(); ++j) {
+            Query_Slot &slot = query_ring[j % query_ring.size()];
+            if (slot.pending) {
+                resolve_queries(slot, reduction, job.num_pixels);
+                if (store) {
+                    store_reduction(*job.experiment, slot.setup_idx, reduction, job.num_pixels);
+                }
+            }
+        }
+    }
+}
+
+void end() {
+    global::transient_storage.end_scope(job.run_scope);
+
+    global::indices_progress.running = false;
+    global::indices_progress.cancel_requested = false;
+
+    UNSET_FLAG(global::config_flags, CONFIG_FLAGS_COMPUTE_INDICES);
+
+    camera_setups.clear();
+}
+
+void finish() {
+    drain(true);
+
+    size_t heap_allocations = global::transient_storage.num_heap_allocations - job.heap_allocations_begin;
 
     timespec_get(&time_end, TIME_UTC);
-    LOG_TRACE("Done computing indices for experiment '%s'.", global::experiment_name);
+
+    Culling_Stats gpu_totals[RENDER_PASS_COUNT];
+    renderer::get_gpu_culling_totals(gpu_totals);
+
+    culling_totals.drawn += gpu_totals[RENDER_PASS_INDICES].drawn - gpu_culling_begin.drawn;
+    culling_totals.culled += gpu_totals[RENDER_PASS_INDICES].culled - gpu_culling_begin.culled;
+    LOG_TRACE("Done computing indices for experiment '%s'.", global::experiment_name.c_str());
+    LOG_TRACE("Meshes drawn: %zu, frustum culled: %zu, occluded: %zu.",
+              culling_totals.drawn, culling_totals.culled, culling_totals.occluded);
+
+    if (job.verify) {
+        if (mismatch_count == 0) {
+            LOG_TRACE("Reduction matched the CPU one for all %zu camera setups.", camera_setups.size());
+        } else {
+            LOG_ERROR("Reduction differed from the CPU one for %u of %zu camera setups.", mismatch_count, camera_setups.size());
+        }
+    }
+
+    if (heap_allocations > 0) {
+        LOG_WARNING("Transient storage fell back to the heap %zu times.", heap_allocations);
+    }
+
     double exe_time = (time_end.tv_sec - time_begin.tv_sec) + (time_end.tv_nsec - time_begin.tv_nsec) * 1e-9;
 
     uint num_cam_setups =
         global::granularity[0] * global::granularity[1] * global::granularity[2] * global::granularity[3]
         * picked_mesh->base_vert_count;
 
-    size_t cur_usage = set_memory_usage();
+    double setups_per_sec = exe_time > 0.0 ? camera_setups.size() / exe_time : 0.0;
 
-    experiment.write_performance(global::picked_id, num_cam_setups, exe_time, cur_usage);
+    size_t cur_usage = computed_indices.get_memory_usage();
 
-    UNSET_FLAG(global::config_flags, CONFIG_FLAGS_COMPUTE_INDICES);
+    job.experiment->write_performance(picked_id, num_cam_setups, exe_time, cur_usage,
+                                      global::reduction_mode_name, job.async_readback || job.query_reduction ? global::readback_depth : 0,
+                                      static_cast<int>(job.batch_size), job.panoramic, setups_per_sec,
+                                      job.resolution_x, job.resolution_y, job.aspect_ratio, sampling, max_rate_error,
+                                      global::occlusion_culling, culling_totals);
 
-    camera_setups.clear();
+    end();
+}
+
+// The rows already written to the data file stay, no performance row is written
+void cancel() {
+    drain(false);
+
+    LOG_WARNING("Cancelled indices computation after %zu of %zu camera setups.",
+                global::indices_progress.num_done, camera_setups.size());
+
+    end();
+}
+
+// Processes camera setups until 'budget' seconds have passed, leaving the camera and viewport
+// as they were. Returns true once the run is over, either finished or cancelled.
+bool step(double budget) {
+    if (global::indices_progress.cancel_requested) {
+        cancel();
+        return true;
+    }
+
+    timespec step_begin;
+    timespec_get(&step_begin, TIME_UTC);
+
+    Camera_Setup original_setup = {camera::position, camera::yaw};
+    float original_zoom = camera::zoom;
+    float original_pitch = camera::pitch;
+
+    camera::zoom = job.zoom;
+    camera::pitch = job.pitch;
+
+    GL_CALL(glViewport(0, 0, job.resolution_x, job.resolution_y));
+
+    double step_time = 0.0;
+    while (job.next_setup < camera_setups.size() && step_time < budget) {
+        advance();
+
+        timespec time_now;
+        timespec_get(&time_now, TIME_UTC);
+
+        step_time = (time_now.tv_sec - step_begin.tv_sec) + (time_now.tv_nsec - step_begin.tv_nsec) * 1e-9;
+    }
+
+    camera::position = original_setup.position;
+    camera::zoom = original_zoom;
+    camera::pitch = original_pitch;
+    camera::set_yaw(original_setup.yaw);
+
+    GL_CALL(glViewport(0, 0, window::width, window::height));
+
+    global::indices_progress.elapsed_time = get_elapsed_time();
+
+    if (job.next_setup < camera_setups.size()) {
+        return false;
+    }
+
+    finish();
+
+    return true;
+}
+
+// Runs a whole computation at once
+void compute() {
+    begin();
+
+    while (!step(DBL_MAX)) {
+    }
 }
 } // namespace indices
 
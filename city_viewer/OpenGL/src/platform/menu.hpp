@@ -171,7 +171,140 @@ void setup() {
 
         ImGui::Spacing();
 
-        if (ImGui::Button("Compute Indices")) {
+        // The running computation holds on to the settings it started with
+        bool computing = global::indices_progress.running;
+
+        ImGui::BeginDisabled(computing);
+
+        static const char *reduction_mode_names[] = {"CPU", "CPU (Async)", "GPU", "Occlusion Query"};
+
+        if (ImGui::BeginCombo("##reduction_mode", global::reduction_mode_name)) {
+            for (size_t i = 0; i < ARRAY_SIZE(reduction_mode_names); ++i) {
+                bool selected = (i == global::reduction_mode);
+                if (ImGui::Selectable(reduction_mode_names[i], selected)) {
+                    global::reduction_mode = static_cast<Reduction_Mode>(i);
+                    global::reduction_mode_name = reduction_mode_names[i];
+                }
+
+                if (selected) {
+                    ImGui::SetItemDefaultFocus();
+                }
+            }
+
+            ImGui::EndCombo();
+        }
+        ImGui::SameLine();
+        ImGui::Text("Reduction Mode");
+
+        if (global::reduction_mode == REDUCTION_MODE_CPU_ASYNC || global::reduction_mode == REDUCTION_MODE_QUERY) {
+            ImGui::Spacing();
+
+            ImGui::SliderInt("Readback Depth", &global::readback_depth, 1, MAX_READBACK_DEPTH);
+        }
+
+        ImGui::Spacing();
+
+        static const char *resolution_names[] = {"Window", "64 px", "128 px", "256 px", "512 px"};
+        static const int   resolutions[]      = {INDICES_RESOLUTION_WINDOW, 64, 128, 256, 512};
+
+        size_t resolution_idx = 0;
+        for (size_t i = 0; i < ARRAY_SIZE(resolutions); ++i) {
+            if (resolutions[i] == global::indices_resolution) {
+                resolution_idx = i;
+            }
+        }
+
+        if (ImGui::BeginCombo("##indices_resolution", resolution_names[resolution_idx])) {
+            for (size_t i = 0; i < ARRAY_SIZE(resolution_names); ++i) {
+                bool selected = (i == resolution_idx);
+                if (ImGui::Selectable(resolution_names[i], selected)) {
+                    global::indices_resolution = resolutions[i];
+                }
+
+                if (selected) {
+                    ImGui::SetItemDefaultFocus();
+                }
+            }
+
+            ImGui::EndCombo();
+        }
+        ImGui::SameLine();
+        ImGui::Text("Resolution");
+
+        ImGui::Spacing();
+
+        ImGui::CheckboxFlags("Stochastic Sampling", &global::config_flags, CONFIG_FLAGS_SAMPLED_INDICES);
+
+        // Occlusion queries count whole frames, so they always render one setup per pass
+        if (global::reduction_mode != REDUCTION_MODE_QUERY) {
+            ImGui::Spacing();
+
+            ImGui::CheckboxFlags("Panoramic Capture", &global::config_flags, CONFIG_FLAGS_PANORAMIC_INDICES);
+
+            // Setups are resampled one at a time from the panorama, so there is nothing to batch
+            if (!HAS_FLAG(global::config_flags, CONFIG_FLAGS_PANORAMIC_INDICES)) {
+                ImGui::Spacing();
+
+                ImGui::SliderInt("Batch Size", &global::batch_size, 1, MAX_BATCH_SIZE);
+            }
+        }
+
+        ImGui::Spacing();
+
+        ImGui::CheckboxFlags("Verify Against CPU", &global::config_flags, CONFIG_FLAGS_VERIFY_INDICES);
+
+        ImGui::EndDisabled();
+
+        ImGui::Spacing();
+
+        ImGui::SliderFloat("Frame Budget (ms)", &global::indices_budget, 1.0f, 100.0f, "%.0f");
+
+        ImGui::Spacing();
+
+        ImGui::Checkbox("Disable VSync While Computing", &global::indices_no_vsync);
+
+        ImGui::Spacing();
+
+        if (computing) {
+            const Indices_Progress &progress = global::indices_progress;
+
+            float fraction = progress.num_setups > 0 ? static_cast<float>(progress.num_done) / progress.num_setups : 0.0f;
+
+            char overlay[32];
+            snprintf(overlay, sizeof(overlay), "%zu / %zu", progress.num_done, progress.num_setups);
+
+            ImGui::ProgressBar(fraction, ImVec2(-FLT_MIN, 0.0f), overlay);
+
+            double setups_per_sec = progress.elapsed_time > 0.0 ? progress.num_done / progress.elapsed_time : 0.0;
+            double eta = setups_per_sec > 0.0 ? (progress.num_setups - progress.num_done) / setups_per_sec : 0.0;
+
+            ImGui::Text("%.1f setups/s, ETA %02d:%02d", setups_per_sec, static_cast<int>(eta) / 60, static_cast<int>(eta) % 60);
+
+            // Partial results, averaged over the setups done so far
+            if (progress.num_done > 0) {
+                static const char *class_names[INDICES_CLASS_COUNT] = {"Sky", "Building", "Amenity", "Landmark", "Tree", "Water"};
+
+                ImGui::BeginTable("Partial Indices", 2, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg);
+
+                ImGui::TableSetupColumn("Class", ImGuiTableColumnFlags_WidthFixed, 80.0f);
+
+                for (uint i = 0; i < INDICES_CLASS_COUNT; ++i) {
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%s", class_names[i]);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.4f", progress.rate_sums[i] / progress.num_done);
+                }
+
+                ImGui::EndTable();
+            }
+
+            ImGui::Spacing();
+
+            if (ImGui::Button("Cancel Computation")) {
+                global::indices_progress.cancel_requested = true;
+            }
+        } else if (ImGui::Button("Compute Indices")) {
             if (global::picked_mesh_idx < 0) {
                 LOG_ERROR("No building was selected.");
             } else {
@@ -277,6 +410,33 @@ void setup_debug() {
         ImGui::Separator();
         ImGui::Spacing();
 
+        ImGui::Checkbox("Render On Demand", &global::render_on_demand);
+
+        if (gl_debug_output) {
+            ImGui::Spacing();
+
+            if (ImGui::BeginCombo("##gl_debug_severity", debug_severity_names[gl_debug_severity])) {
+                for (size_t i = 0; i < ARRAY_SIZE(debug_severity_names); ++i) {
+                    bool selected = (i == gl_debug_severity);
+                    if (ImGui::Selectable(debug_severity_names[i], selected)) {
+                        gl_set_debug_severity(static_cast<Debug_Severity>(i));
+                    }
+
+                    if (selected) {
+                        ImGui::SetItemDefaultFocus();
+                    }
+                }
+
+                ImGui::EndCombo();
+            }
+            ImGui::SameLine();
+            ImGui::Text("OpenGL Debug Messages");
+        }
+
+        ImGui::Spacing();
+        ImGui::Separator();
+        ImGui::Spacing();
+
         static const char *screenshot_mode_names[] = {"Picking", "Indices", "AABB"};
 
         ImGui::Spacing();
@@ -433,6 +593,92 @@ void setup_debug() {
         ImGui::Spacing();
     }
 
+    // Memory section
+    if (ImGui::CollapsingHeader("Memory", ImGuiTreeNodeFlags_DefaultOpen)) {
+        ImGui::Spacing();
+
+        const Linear_Allocator &storage = global::transient_storage;
+
+        ImGui::BeginTable("Memory Info", 2, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg);
+
+        ImGui::TableSetupColumn("Parameter", ImGuiTableColumnFlags_WidthFixed, 120.0f);
+
+        // Transient storage capacity and peak usage since the last indices run
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("Transient Size");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f MB", storage.capacity / (1024.0 * 1024.0));
+
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("Transient Peak");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f MB", storage.peak_usage / (1024.0 * 1024.0));
+
+        // Allocations
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("Allocations");
+        ImGui::TableNextColumn();
+        ImGui::Text("%zu", storage.num_allocations);
+
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("Heap Allocations");
+        ImGui::TableNextColumn();
+        ImGui::Text("%zu", storage.num_heap_allocations);
+
+        ImGui::EndTable();
+
+        ImGui::Spacing();
+    }
+
+    // Culling section
+    if (ImGui::CollapsingHeader("Culling", ImGuiTreeNodeFlags_DefaultOpen)) {
+        ImGui::Spacing();
+
+        ImGui::Checkbox("Frustum Culling", &global::frustum_culling);
+        ImGui::Checkbox("GPU Culling", &global::gpu_culling);
+        ImGui::Checkbox("Occlusion Culling", &global::occlusion_culling);
+
+        if (global::occlusion_culling) {
+            ImGui::SliderInt("Occluders", &global::occluder_count, 1, MAX_OCCLUDER_COUNT);
+        }
+
+        ImGui::Spacing();
+
+        static const char *pass_names[] = {"Viewer", "Picking", "Indices"};
+        static_assert(ARRAY_SIZE(pass_names) == RENDER_PASS_COUNT, "Every render pass needs a name.");
+
+        ImGui::BeginTable("Culling Info", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg);
+
+        ImGui::TableSetupColumn("Pass", ImGuiTableColumnFlags_WidthFixed, 120.0f);
+        ImGui::TableSetupColumn("Drawn");
+        ImGui::TableSetupColumn("Culled");
+        ImGui::TableSetupColumn("Occluded");
+        ImGui::TableHeadersRow();
+
+        // Counts of the last time each pass ran, the indices pass only runs while computing
+        for (uint i = 0; i < RENDER_PASS_COUNT; ++i) {
+            const Culling_Stats &stats = global::culling_stats[i];
+
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", pass_names[i]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu", stats.drawn);
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu", stats.culled);
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu", stats.occluded);
+        }
+
+        ImGui::EndTable();
+
+        ImGui::Spacing();
+    }
+
     ImGui::End();
 }
 
@@ -2,6 +2,78 @@
 #define MODEL_HPP
 
 #include "../global.hpp"
+#include "../util/collada.hpp"
+#include "../util/geojson.hpp"
+#include "../util/parallel.hpp"
+
+// --------------------------------------------------------------------------------
+
+// GeoJSON features read before their meshes are built in parallel, which bounds the memory held
+#define GEOJSON_FEATURE_BATCH_SIZE 1024
+
+// Bump whenever the loaders or the cache layout change, older caches are rebuilt then
+#define SCENE_CACHE_VERSION 2
+#define SCENE_CACHE_DIR     "files/cache"
+
+// --------------------------------------------------------------------------------
+
+// A mesh built on a loader thread. The ordered merge on the context thread uploads it.
+struct Mesh_Build {
+    Mesh      mesh;
+    Mesh_Type type         = MESH_TYPE_FLAT;
+    bool      valid        = false; // Unsupported geometries are dropped
+    bool      triangulated = true;  // False if a part of a face was left out
+};
+
+// --------------------------------------------------------------------------------
+
+/*
+Scene cache layout, in the byte order of the machine that wrote it:
+    Scene_Cache_Header
+    Scene_Cache_Mesh  [mesh_count]
+    Vertex            [vertex_count] (every mesh's vertices, in mesh order)
+    uint              [index_count]  (every mesh's indices, in mesh order)
+Everything is 8 byte aligned, so the arrays are read straight from the mapped file.
+*/
+struct Scene_Cache_Header {
+    char     magic[4];
+    uint     version;
+
+    // Of the source file, the cache is only valid for that content
+    uint64_t source_hash;
+    uint64_t source_size;
+
+    uint64_t mesh_count;
+    uint64_t vertex_count;
+    uint64_t index_count;
+};
+
+struct Scene_Cache_Mesh {
+    uint64_t  first_vertex;
+    uint64_t  first_index;
+    uint      vertex_count;
+    uint      index_count;
+
+    uint      base_vert_count;
+    Mesh_Type type;
+    ubyte     has_normals; // The vertex layout 'Mesh::init' set up
+    ubyte     padding[2];
+
+    glm::vec4 color;
+    AABB      aabb;
+};
+
+#define SCENE_CACHE_MAGIC "CVSC"
+
+static_assert(sizeof(Scene_Cache_Header) % 8 == 0 && sizeof(Scene_Cache_Mesh) % 8 == 0 && sizeof(Vertex) % 8 == 0,
+              "Scene cache arrays have to stay 8 byte aligned.");
+
+// Where the cache of a source file is, and the content it has to match
+struct Scene_Cache_Key {
+    std::string cache_path;
+    uint64_t    source_hash;
+    uint64_t    source_size;
+};
 
 // --------------------------------------------------------------------------------
 
@@ -10,75 +82,55 @@ struct Model {
     std::vector<Mesh> meshes;
 
     ~Model() {
+        release_mesh_buffers();
+    }
+
+    // Frees the GL objects of every mesh, e.g. once the meshes are drawn from merged buffers
+    void release_mesh_buffers() {
         for (auto &mesh : meshes) {
             destroy(mesh.vertex_array);
             destroy(mesh.vertex_buffer);
             destroy(mesh.index_buffer);
+
+            mesh.vertex_array = {};
+            mesh.vertex_buffer = {};
+            mesh.index_buffer = {};
         }
     }
 
 // --------------------------------------------------------------------------------
 
-    void init_geojson(const char *filepath) {
-        FILE *file = fopen(filepath, "rb");
-        const auto &data = json::parse(file);
-        LOG_TRACE("Done parsing GEOJSON.");
-        fclose(file);
-
-        const auto &features = data["features"];
-
-        Mesh_Type mesh_type;
-
-        for (const auto &feature : features) {
-        //for (size_ f = 0; f < features.size(); ++f) {
-            //const auto &feature = features[f];
-            //const auto &feature = features[4];
-            //const auto &feature = features[48];
-            //const auto &feature = features[85];
-            //const auto &feature = features[71];
-            //const auto &feature = features[29];
-            //const auto &feature = features[56];
-            //const auto &feature = features[27];
-            //const auto &feature = features[82];
-            //const auto &feature = features[58];
-            //const auto &feature = features[23];
-
-            const auto &properties = feature["properties"];
-
-            float height = 0.0f;
-            if (properties.find("height") != properties.end()) {
-                const std::string &height_str = properties["height"];
-                height = std::stof(height_str);
-
-                mesh_type = MESH_TYPE_BUILDING;
-            } else {
-                mesh_type = MESH_TYPE_FLAT;
-            }
+    // Base vertices of the feature's rings, the ones collinear with their neighbours are dropped,
+    // then the rings left with fewer than 3. Without its outline a polygon is dropped whole.
+    static void add_geojson_rings(Mesh &mesh, Polygon_Rings &rings, const GeoJSON_Feature &feature) {
+        constexpr glm::vec3 max_vec3(FLT_MAX);
 
-            const auto &geometry = feature["geometry"];
-            const auto &geometry_type = geometry["type"];
-            const auto &geometry_coordinates = geometry["coordinates"];
+        mesh.vertices.reserve(feature.points.size());
 
-            constexpr glm::vec3 max_vec3(FLT_MAX);
+        rings.clear();
 
-            Mesh mesh = {};
-            mesh.vertices.reserve(geometry_coordinates.size());
+        for (size_t p = 0, r = 0; p < feature.polygon_ends.size(); ++p) {
+            size_t first_ring = rings.ring_ends.size();
 
-            Vertex bottom_vert, top_vert;
+            for (; r < feature.polygon_ends[p]; ++r) {
+                size_t ring_begin = r == 0 ? 0 : feature.ring_ends[r - 1];
+                size_t vert_begin = mesh.vertices.size();
 
-            glm::vec3 prev_point(FLT_MAX), cur_point, next_point;
+                // The last point closes the ring, it repeats the first one
+                const glm::vec3 *ring = feature.points.data() + ring_begin;
+                size_t point_count = feature.ring_ends[r] - ring_begin;
 
-            if (geometry_type == "Polygon") {
-                for (auto &coordinate : geometry_coordinates) {
-                    for (size_t i = 0, point_count = coordinate.size() - 1; i < point_count; ++i) {
-                        cur_point = to_vec3(coordinate[i]);
+                if (point_count >= 2) {
+                    --point_count;
 
-                        if (prev_point != max_vec3) {
-                            next_point = to_vec3(coordinate[(i + 1) % point_count]);
+                    glm::vec3 prev_point(FLT_MAX);
+
+                    for (size_t i = 0; i < point_count; ++i) {
+                        const glm::vec3 &cur_point = ring[i];
 
-                            while (i + 1 <= point_count && collinear(prev_point, cur_point, next_point)) {
+                        if (prev_point != max_vec3) {
+                            while (i + 1 <= point_count && collinear(prev_point, cur_point, ring[(i + 1) % point_count])) {
                                 ++i;
-                                next_point = to_vec3(coordinate[(i + 1) % point_count]);
                             }
                         }
 
@@ -86,512 +138,692 @@ struct Model {
                             break;
                         }
 
-                        bottom_vert = to_vertex(coordinate[i]);
-
-                        mesh.vertices.push_back(bottom_vert);
+                        mesh.vertices.push_back({ring[i], glm::vec3(0.0f)});
 
-                        prev_point = bottom_vert.position;
+                        prev_point = ring[i];
                     }
                 }
 
-                mesh.base_vert_count = mesh.vertices.size();
+                if (mesh.vertices.size() - vert_begin < 3) {
+                    mesh.vertices.resize(vert_begin);
 
-                if (mesh_type == MESH_TYPE_FLAT) {
-                    // Base face triangulation
-                    mesh.triangulate_face(0, mesh.base_vert_count);
-                } else if (mesh_type == MESH_TYPE_BUILDING) {
-                    
-                    for (uint i = 0; i < mesh.base_vert_count; ++i) {
-                        Vertex &cur = mesh.vertices[i];
+                    if (rings.ring_ends.size() == first_ring) {
+                        r = feature.polygon_ends[p];
+                        break;
+                    }
 
-                        top_vert.position.x = cur.position.x;
-                        top_vert.position.y = height;
-                        top_vert.position.z = cur.position.z;
+                    continue;
+                }
 
-                        top_vert.normal = {0.0f, 1.0f, 0.0f};
+                rings.ring_ends.push_back(static_cast<uint>(mesh.vertices.size()));
+            }
 
-                        mesh.vertices.push_back(top_vert);
-                    }
+            if (rings.ring_ends.size() > first_ring) {
+                rings.polygon_ends.push_back(static_cast<uint>(rings.ring_ends.size()));
+            }
+        }
 
-                    // Top face triangulation
-                    mesh.triangulate_face(mesh.base_vert_count, mesh.vertices.size());
+        mesh.base_vert_count = mesh.vertices.size();
+    }
 
-                    // Lateral faces
-                    uint idx_lower, idx_upper, next_idx_lower, next_idx_upper;
+    // Only touches 'dst', so features are built on any thread
+    static void build_geojson_mesh(Mesh_Build &dst, const GeoJSON_Feature &feature) {
+        Mesh_Type mesh_type = feature.has_height ? MESH_TYPE_BUILDING : MESH_TYPE_FLAT;
 
-                    for (uint i = 0; i < mesh.base_vert_count; ++i) {
-                        idx_lower = i;
-                        next_idx_lower = (i + 1) % mesh.base_vert_count;
+        Mesh &mesh = dst.mesh;
 
-                        idx_upper = idx_lower + mesh.base_vert_count;
-                        next_idx_upper = next_idx_lower + mesh.base_vert_count;
+        Polygon_Rings rings;
 
-                        mesh.indices.push_back(idx_upper);
-                        mesh.indices.push_back(next_idx_upper);
-                        mesh.indices.push_back(next_idx_lower);
+        if (feature.geometry == GEOJSON_GEOMETRY_POLYGON) {
+            add_geojson_rings(mesh, rings, feature);
 
-                        mesh.indices.push_back(idx_upper);
-                        mesh.indices.push_back(next_idx_lower);
-                        mesh.indices.push_back(idx_lower);
+            if (mesh_type == MESH_TYPE_FLAT) {
+                // Base face triangulation
+                dst.triangulated = mesh.triangulate_face(0, rings);
+            } else if (mesh_type == MESH_TYPE_BUILDING) {
+                Vertex top_vert;
 
-                        const glm::vec3 &h = glm::normalize(mesh.vertices[next_idx_lower].position - mesh.vertices[idx_lower].position);
-                        const glm::vec3 &v = glm::normalize(mesh.vertices[idx_upper].position - mesh.vertices[idx_lower].position);
+                for (uint i = 0; i < mesh.base_vert_count; ++i) {
+                    Vertex &cur = mesh.vertices[i];
 
-                        const glm::vec3 &face_normal = glm::normalize(glm::cross(h, v));
+                    top_vert.position.x = cur.position.x;
+                    top_vert.position.y = feature.height;
+                    top_vert.position.z = cur.position.z;
 
-                        mesh.vertices[idx_lower].normal += face_normal;
-                        mesh.vertices[idx_upper].normal += face_normal;
+                    top_vert.normal = {0.0f, 1.0f, 0.0f};
 
-                        mesh.vertices[next_idx_lower].normal += face_normal; 
-                        mesh.vertices[next_idx_upper].normal += face_normal;
-                    }
+                    mesh.vertices.push_back(top_vert);
+                }
+
+                // Top face triangulation
+                dst.triangulated = mesh.triangulate_face(mesh.base_vert_count, rings);
 
-                    for (auto &vert : mesh.vertices) {
-                        vert.normal = glm::normalize(vert.normal);
+                // Lateral faces, around every ring
+                uint idx_lower, idx_upper, next_idx_lower, next_idx_upper;
+
+                for (uint i = 0, r = 0, ring_begin = 0; i < mesh.base_vert_count; ++i) {
+                    if (i == rings.ring_ends[r]) {
+                        ring_begin = rings.ring_ends[r++];
                     }
-                }
-            } else if (geometry_type == "MultiPolygon") {
-                for (auto &polygon : geometry_coordinates) {
-                    for (auto &coordinate : polygon) {
-                        for (size_t i = 0, point_count = coordinate.size() - 1; i < point_count; ++i) {
-                            cur_point = to_vec3(coordinate[i]);
-
-                            if (prev_point != max_vec3) {
-                                while (i + 1 <= point_count &&
-                                       collinear(prev_point, cur_point, to_vec3(coordinate[(i + 1) % point_count]))) {
-                                    ++i;
-                                }
-                            }
 
-                            if (i == point_count) {
-                                break;
-                            }
+                    idx_lower = i;
+                    next_idx_lower = (i + 1 < rings.ring_ends[r]) ? i + 1 : ring_begin;
 
-                            bottom_vert = to_vertex(coordinate[i]);
+                    idx_upper = idx_lower + mesh.base_vert_count;
+                    next_idx_upper = next_idx_lower + mesh.base_vert_count;
 
-                            mesh.vertices.push_back(bottom_vert);
+                    mesh.indices.push_back(idx_upper);
+                    mesh.indices.push_back(next_idx_upper);
+                    mesh.indices.push_back(next_idx_lower);
 
-                            prev_point = bottom_vert.position;
-                        }
-                    }
-                }
+                    mesh.indices.push_back(idx_upper);
+                    mesh.indices.push_back(next_idx_lower);
+                    mesh.indices.push_back(idx_lower);
 
-                mesh.base_vert_count = mesh.vertices.size();
+                    const glm::vec3 &h = glm::normalize(mesh.vertices[next_idx_lower].position - mesh.vertices[idx_lower].position);
+                    const glm::vec3 &v = glm::normalize(mesh.vertices[idx_upper].position - mesh.vertices[idx_lower].position);
 
-                mesh.triangulate_face(0, mesh.base_vert_count);
-            } else {
-                continue;
-            }
+                    const glm::vec3 &face_normal = glm::normalize(glm::cross(h, v));
 
-            if (mesh_type == MESH_TYPE_BUILDING) {
-                mesh.color[0] = randf();
-                mesh.color[1] = randf();
-                mesh.color[2] = randf();
-                mesh.color[3] = 1.0f;
-            } else if (mesh_type == MESH_TYPE_FLAT) {
-                mesh.color = COLOR_GRAY;
-            }
+                    mesh.vertices[idx_lower].normal += face_normal;
+                    mesh.vertices[idx_upper].normal += face_normal;
 
-            if (!mesh.indices.empty()) {
-                mesh.init(mesh_type);
+                    mesh.vertices[next_idx_lower].normal += face_normal;
+                    mesh.vertices[next_idx_upper].normal += face_normal;
+                }
 
-                meshes.push_back(mesh);
+                for (auto &vert : mesh.vertices) {
+                    vert.normal = glm::normalize(vert.normal);
+                }
             }
+        } else if (feature.geometry == GEOJSON_GEOMETRY_MULTI_POLYGON) {
+            add_geojson_rings(mesh, rings, feature);
+
+            dst.triangulated = mesh.triangulate_face(0, rings);
+        } else {
+            return;
         }
-    }
 
-// --------------------------------------------------------------------------------
+        dst.type = mesh_type;
+        dst.valid = true;
+    }
 
-    void init_collada(const char *filepath) {
-        tinyxml2::XMLDocument doc;
-        doc.LoadFile(filepath);
-        if (doc.LoadFile(filepath) != tinyxml2::XML_SUCCESS) {
-            LOG_ERROR("Error loading COLLADA file: %s", filepath);
+    // In feature order, so the random building colors are the same whatever the thread count
+    void merge_geojson_mesh(Mesh_Build &build) {
+        if (!build.valid) {
             return;
         }
 
-        std::unordered_map<std::string, Geometry> geometries;
-        std::unordered_map<std::string, std::vector<Geometry>> nodes;
+        Mesh &mesh = build.mesh;
 
-        std::vector<glm::vec3> positions, normals;
+        if (build.type == MESH_TYPE_BUILDING) {
+            mesh.color[0] = randf();
+            mesh.color[1] = randf();
+            mesh.color[2] = randf();
+            mesh.color[3] = 1.0f;
+        } else if (build.type == MESH_TYPE_FLAT) {
+            mesh.color = COLOR_GRAY;
+        }
 
-        auto *geo_elem = doc.RootElement()->FirstChildElement("library_geometries")->FirstChildElement("geometry");
-        Geometry geo = {};
+        if (!mesh.indices.empty()) {
+            mesh.init(build.type);
 
-        while (geo_elem != nullptr) {
-            auto *mesh_elem = geo_elem->FirstChildElement("mesh");
+            meshes.push_back(std::move(mesh));
+        }
+    }
 
-            while (mesh_elem != nullptr) {
-                auto *mesh_triangles_elem = mesh_elem->FirstChildElement("triangles");
-                auto *mesh_input_elem = mesh_triangles_elem->FirstChildElement("input");
+    void init_geojson(const char *filepath, uint thread_count) {
+        size_t feature_count = 0;
+        size_t partial_count = 0;
 
-                uint num_attribs = 0;
-                Collada_Source_Data source_data = {};
+        std::vector<GeoJSON_Feature> features(GEOJSON_FEATURE_BATCH_SIZE);
+        std::vector<Mesh_Build>      builds(GEOJSON_FEATURE_BATCH_SIZE);
+        size_t                       batch_count = 0;
 
-                while (mesh_input_elem != nullptr) {
-                    ++num_attribs;
+        auto build_batch = [&]() {
+            parallel_for(batch_count, thread_count, [&](size_t i) {
+                builds[i] = {};
+                build_geojson_mesh(builds[i], features[i]);
+            });
 
-                    if (strncmp(mesh_input_elem->Attribute("semantic"), "VERTEX", 6) == 0) {
-                        auto *mesh_verts_elem = mesh_elem->FirstChildElement("vertices");
-                        auto *verts_input_elem = mesh_verts_elem->FirstChildElement("input");
+            for (size_t i = 0; i < batch_count; ++i) {
+                partial_count += !builds[i].triangulated;
 
-                        while (verts_input_elem != nullptr) {
-                            const char *source_name = verts_input_elem->Attribute("source");
-                            if (source_name != nullptr) {
-                                ++source_name;
-                            }
-                            uint source_name_len = strlen(source_name);
+                merge_geojson_mesh(builds[i]);
+            }
 
-                            auto *mesh_source_elem = mesh_elem->FirstChildElement("source");
+            batch_count = 0;
+        };
 
-                            while (mesh_source_elem != nullptr) {
-                                if (strncmp(mesh_source_elem->Attribute("id"), source_name, source_name_len) == 0) {
-                                    read_collada_source(source_data, mesh_source_elem);
+        // Streamed, a batch of features is built while the next one has not been read yet
+        bool parsed = read_geojson(filepath, [&](const GeoJSON_Feature &feature) {
+            features[batch_count++] = feature;
 
-                                    float *float_data = reinterpret_cast<float *>(source_data.data);
+            if (batch_count == GEOJSON_FEATURE_BATCH_SIZE) {
+                build_batch();
+            }
+        }, &feature_count);
 
-                                    for (uint i = 0; i < source_data.size / sizeof(float); i += 3) {
-                                        positions.emplace_back(float_data[i], float_data[i + 1], float_data[i + 2]);
-                                    }
+        build_batch();
 
-                                    break;
-                                }
+        if (!parsed) {
+            LOG_ERROR("Failed to read GeoJSON file '%s'.", filepath);
+            return;
+        }
 
-                                mesh_source_elem = mesh_source_elem->NextSiblingElement("source");
-                            }
+        if (partial_count > 0) {
+            LOG_WARNING("%zu GeoJSON features could only be triangulated in part.", partial_count);
+        }
 
-                            verts_input_elem = verts_input_elem->NextSiblingElement("input");
-                        }
-                    }
+        LOG_TRACE("Read %zu GeoJSON features into %zu meshes.", feature_count, meshes.size());
+    }
 
-                    if (strncmp(mesh_input_elem->Attribute("semantic"), "NORMAL", 6) == 0) {
-                        const char *source_name = mesh_input_elem->Attribute("source");
-                        if (source_name != nullptr) {
-                            ++source_name;
-                        }
-                        uint source_name_len = strlen(source_name);
+// --------------------------------------------------------------------------------
 
-                        auto *mesh_source = mesh_elem->FirstChildElement("source");
+    // Every mesh of a geometry goes into 'dst'. False if it has none, it is not added to the
+    // geometries then. Only parses the geometry's own text, so geometries are read on any thread.
+    static bool read_collada_geometry(Geometry &dst, const Collada_Geometry &geo, const Collada_Document &doc) {
+        // The triangle counts give the size of the vertex arrays up front
+        size_t vertex_count = 0;
 
-                        while (mesh_source != nullptr) {
-                            auto tmp = mesh_source->Attribute("id");
+        for (const auto &mesh : geo.meshes) {
+            for (const auto &triangles : mesh.triangles) {
+                vertex_count += static_cast<size_t>(triangles.count) * 3;
+            }
+        }
 
-                            if (strncmp(mesh_source->Attribute("id"), source_name, source_name_len) == 0) {
-                                read_collada_source(source_data, mesh_source);
+        dst.vertices.reserve(vertex_count);
+        dst.indices.reserve(vertex_count);
 
-                                float *float_data = reinterpret_cast<float *>(source_data.data);
+        std::vector<glm::vec3> positions, normals;
 
-                                for (uint i = 0; i < source_data.size / sizeof(float); i += 3) {
-                                    normals.emplace_back(float_data[i], float_data[i + 1], float_data[i + 2]);
-                                }
+        auto read_source = [&](std::vector<glm::vec3> &values, std::string_view id) {
+            const Collada_Source *source = doc.find_source(id);
+            if (source == nullptr) {
+                LOG_ERROR("Failed to get COLLADA source with id=%.*s", static_cast<int>(id.size()), id.data());
+                return;
+            }
 
-                                break;
-                            }
+            read_collada_source(values, *source);
+        };
 
-                            mesh_source = mesh_source->NextSiblingElement("source");
-                        }
+        for (const auto &mesh : geo.meshes) {
+            for (const auto &input : mesh.inputs) {
+                if (input.semantic == "VERTEX") {
+                    for (std::string_view source_id : mesh.vertex_sources) {
+                        read_source(positions, source_id);
                     }
-
-                    mesh_input_elem = mesh_input_elem->NextSiblingElement("input");
                 }
 
-                read_geometry(geo, mesh_triangles_elem, num_attribs, positions, normals);
-                const char *geo_id = geo_elem->Attribute("id");
-                geometries[geo_id] = geo;
+                if (input.semantic == "NORMAL") {
+                    read_source(normals, input.source);
+                }
+            }
 
-                positions.clear();
-                normals.clear();
+            // The position and normal indices are always read, whatever the inputs say
+            uint stride = MAX(static_cast<uint>(mesh.inputs.size()), 2u);
 
-                mesh_elem = mesh_elem->NextSiblingElement("mesh");
+            for (const auto &triangles : mesh.triangles) {
+                if (!read_collada_triangles(dst, triangles, stride, positions, normals)) {
+                    break;
+                }
             }
 
-            geo.vertices.clear();
-            geo.indices.clear();
+            positions.clear();
+            normals.clear();
+        }
 
-            geo_elem = geo_elem->NextSiblingElement("geometry");
+        return !geo.meshes.empty();
+    }
+
+    // Copies of the geometries instanced by a library node, moved by its matrix. Nodes without a
+    // matrix are skipped.
+    static void read_collada_transform(std::vector<Geometry> &dst, const Collada_Transform &transform,
+                                       const std::unordered_map<std::string_view, Geometry> &geometries) {
+        if (!transform.has_matrix) {
+            return;
         }
 
-        auto *lib_node_elem = doc.RootElement()->FirstChildElement("library_nodes")->FirstChildElement("node");
+        glm::mat4 matrix = {};
+        read_collada_mat4(matrix, transform.matrix);
 
-        while (lib_node_elem != nullptr) {
-            auto *lib_child_node_elem = lib_node_elem->FirstChildElement("node");
+        for (std::string_view url : transform.geometry_urls) {
+            auto iter = geometries.find(url);
+            if (iter == geometries.end()) {
+                LOG_ERROR("Failed to get COLLADA geometry with id=%.*s", static_cast<int>(url.size()), url.data());
+                continue;
+            }
 
-            while (lib_child_node_elem != nullptr) {
-                
-                // TRANSFORM 1 BEGIN
-                auto *matrix_elem = lib_child_node_elem->FirstChildElement("matrix");
-                glm::mat4 matrix = {};
+            Geometry geo = iter->second;
 
-                if (matrix_elem != nullptr) {
-                    read_mat4(matrix, matrix_elem);
+            for (auto &vert : geo.vertices) {
+                glm::vec4 transformed_pos = glm::vec4(vert.position, 1.0f) * matrix;
+                vert.position = glm::vec3(transformed_pos);
 
-                    auto *instance_geo_elem = lib_child_node_elem->FirstChildElement("instance_geometry");
+                //glm::vec4 transformed_normal = glm::vec4(vert.normal, 1.0f) * matrix;
+                //vert.normal = glm::normalize(glm::vec3(transformed_normal));
+            }
 
-                    while (instance_geo_elem != nullptr) {
-                        const char *url = instance_geo_elem->Attribute("url");
-                        if (url != nullptr) {
-                            ++url;
-                        }
+            dst.push_back(std::move(geo));
+        }
+    }
 
-                        auto iter = geometries.find(url);
-                        if (iter == geometries.end()) {
-                            LOG_ERROR("Failed to get COLLADA geometry with id=%s", url);
-                        } else {
-                            Geometry geo = iter->second;
+    // The meshes of a visual scene node, in the order they are added to the model. Only reads the
+    // node's own text, so nodes are read on any thread.
+    static void read_collada_visual_node(std::vector<Mesh> &dst, const Collada_Visual_Node &node,
+                                         const std::unordered_map<std::string_view, Geometry> &geometries,
+                                         const std::unordered_map<std::string_view, std::vector<Geometry>> &nodes) {
+        Mesh mesh = {};
+        mesh.color = COLOR_WHITE;
+        mesh.type = MESH_TYPE_MISC;
+
+        for (const auto &param : node.params) {
+            if (param.name == "entity:type") {
+                if (param.text == "tree") {
+                    mesh.color = COLOR_EMERALD;
+                    mesh.type = MESH_TYPE_TREE;
 
-                            for (auto &vert : geo.vertices) {
-                                glm::vec4 transformed_pos = glm::vec4(vert.position, 1.0f) * matrix;
-                                vert.position = glm::vec3(transformed_pos);
+                    break;
+                }
+            }
 
-                                //glm::vec4 transformed_normal = glm::vec4(vert.normal, 1.0f) * matrix;
-                                //vert.normal = glm::normalize(glm::vec3(transformed_normal));
-                            }
+            if (param.name == "terrain") {
+                if (param.text == "surface") {
+                    mesh.color = COLOR_BRIGHT_GRAY;
+                    mesh.type = MESH_TYPE_MISC;
 
-                            const char *lib_node_id = lib_node_elem->Attribute("id");
-                            nodes[lib_node_id].push_back(geo);
-                        }
+                    break;
+                } else if (param.text == "road") {
+                    mesh.color = COLOR_DARK_GRAY;
+                    mesh.type = MESH_TYPE_MISC;
 
-                        instance_geo_elem = instance_geo_elem->NextSiblingElement("instance_geometry");
-                    }
-                }
-                // TRANSFORM 1 END
-                
+                    break;
+                } else if (param.text == "sidewalk") {
+                    mesh.color = COLOR_GRAY;
+                    mesh.type = MESH_TYPE_MISC;
 
-                
-                // TRANSFORM 2 BEGIN
-                auto *lib_grandchild_node_elem = lib_child_node_elem->FirstChildElement("node");
+                    break;
+                } else if (param.text == "water") {
+                    mesh.color = COLOR_BLUE;
+                    mesh.type = MESH_TYPE_WATER;
 
-                while (lib_grandchild_node_elem != nullptr) {
-                    auto *matrix_elem = lib_grandchild_node_elem->FirstChildElement("matrix");
-                    glm::mat4 matrix = {};
+                    break;
+                }
+            }
 
-                    if (matrix_elem != nullptr) {
-                        read_mat4(matrix, matrix_elem);
+            if (param.name == "geopipe:identifier") {
+                mesh.color = COLOR_VISTA;
+                mesh.type = MESH_TYPE_BUILDING;
+            }
 
-                        auto *instance_geo_elem = lib_grandchild_node_elem->FirstChildElement("instance_geometry");
+            if (param.name == "amenity") {
+                mesh.color = COLOR_TURQUOISE;
+                mesh.type = MESH_TYPE_AMENITY;
 
-                        while (instance_geo_elem != nullptr) {
-                            const char *url = instance_geo_elem->Attribute("url");
-                            if (url != nullptr) {
-                                ++url;
-                            }
+                break;
+            }
 
-                            auto iter = geometries.find(url);
-                            if (iter == geometries.end()) {
-                                LOG_ERROR("Failed to get COLLADA geometry with id=%s", url);
-                            } else {
-                                Geometry geo = iter->second;
+            if (param.name == "name") {
+                mesh.color = COLOR_LAVENDER;
+                mesh.type = MESH_TYPE_LANDMARK;
 
-                                for (auto &vert : geo.vertices) {
-                                    glm::vec4 transformed_pos = glm::vec4(vert.position, 1.0f) * matrix;
-                                    vert.position = glm::vec3(transformed_pos);
+                break;
+            }
+        }
 
-                                    //glm::vec4 transformed_normal = glm::vec4(vert.normal, 1.0f) * matrix;
-                                    //vert.normal = glm::normalize(glm::vec3(transformed_normal));
-                                }
+        glm::vec3 translation = {};
+        read_collada_vec3(translation, node.translate);
 
-                                const char *lib_node_id = lib_node_elem->Attribute("id");
-                                nodes[lib_node_id].push_back(geo);
-                            }
+        for (std::string_view url : node.geometry_urls) {
+            auto iter = geometries.find(url);
+            if (iter == geometries.end()) {
+                LOG_ERROR("Failed to get COLLADA geometry with id=%.*s", static_cast<int>(url.size()), url.data());
+            } else {
+                // Copied, the geometry may be instanced by other nodes
+                const auto &verts = iter->second.vertices;
+                const auto &idxs = iter->second.indices;
 
-                            instance_geo_elem = instance_geo_elem->NextSiblingElement("instance_geometry");
-                        }
-                    }
+                uint base_idx = static_cast<uint>(mesh.vertices.size());
 
-                    lib_grandchild_node_elem = lib_grandchild_node_elem->NextSiblingElement("node");
+                for (const auto &vert : verts) {
+                    mesh.vertices.push_back({vert.position + translation, vert.normal});
                 }
-                // TRANSFORM 2 END
-                
 
-                lib_child_node_elem = lib_child_node_elem->NextSiblingElement("node");
+                for (uint idx : idxs) {
+                    mesh.indices.push_back(idx + base_idx);
+                }
             }
-
-            lib_node_elem = lib_node_elem->NextSiblingElement("node");
         }
 
-        auto *vis_node_elem = doc.RootElement()->FirstChildElement("library_visual_scenes")->FirstChildElement("visual_scene")->FirstChildElement("node");
+        dst.push_back(mesh);
+
+        mesh.vertices.clear();
+        mesh.indices.clear();
 
-        while (vis_node_elem != nullptr) {
-            Mesh mesh = {};
-            mesh.color = COLOR_WHITE;
-            mesh.type = MESH_TYPE_MISC;
+        
+        // TRANSFORM 3 BEGIN
+        glm::mat4 matrix = {};
 
-            auto *param_elem = vis_node_elem->FirstChildElement("extra")->FirstChildElement("technique")->FirstChildElement("param");
+        if (node.has_matrix) {
+            read_collada_mat4(matrix, node.matrix);
 
-            while (param_elem != nullptr) {
-                const char *name = param_elem->Attribute("name");
-                const char *text = param_elem->GetText();
+            for (std::string_view url : node.node_urls) {
+                auto node_iter = nodes.find(url);
+                if (node_iter == nodes.end()) {
+                    continue;
+                }
 
-                if (strcmp(name, "entity:type") == 0) {
-                    if (strcmp(text, "tree") == 0) {
-                        mesh.color = COLOR_EMERALD;
-                        mesh.type = MESH_TYPE_TREE;
+                for (Geometry geo : node_iter->second) {
+                    auto &verts = geo.vertices;
+                    auto &idxs = geo.indices;
 
-                        break;
+                    for (auto &vert : verts) {
+                        glm::vec4 transformed_pos = glm::vec4(vert.position, 1.0f) * matrix;
+                        vert.position = glm::vec3(transformed_pos);
+
+                        //glm::vec4 transformed_normal = glm::vec4(vert.normal, 1.0f) * matrix;
+                        //vert.normal = glm::normalize(glm::vec3(transformed_normal));
                     }
+
+                    mesh.vertices.insert(mesh.vertices.end(), verts.begin(), verts.end());
+                    mesh.indices.insert(mesh.indices.end(), idxs.begin(), idxs.end());
+
+                    dst.push_back(mesh);
+
+                    mesh.vertices.clear();
+                    mesh.indices.clear();
                 }
+            }
+        }
+        // TRANSFORM 3 END
+        
+    }
 
-                if (strcmp(name, "terrain") == 0) {
-                    if (strcmp(text, "surface") == 0) {
-                        mesh.color = COLOR_BRIGHT_GRAY;
-                        mesh.type = MESH_TYPE_MISC;
+    void init_collada(const char *filepath, uint thread_count) {
+        // Only finds where everything is, the numbers are parsed by the stages below
+        Collada_Document doc;
+        if (!read_collada(doc, filepath)) {
+            LOG_ERROR("Error loading COLLADA file: %s", filepath);
+            return;
+        }
 
-                        break;
-                    } else if (strcmp(text, "road") == 0) {
-                        mesh.color = COLOR_DARK_GRAY;
-                        mesh.type = MESH_TYPE_MISC;
+        // Keys are views into the document, which outlives both maps
+        std::unordered_map<std::string_view, Geometry> geometries;
+        std::unordered_map<std::string_view, std::vector<Geometry>> nodes;
 
-                        break;
-                    } else if (strcmp(text, "sidewalk") == 0) {
-                        mesh.color = COLOR_GRAY;
-                        mesh.type = MESH_TYPE_MISC;
+        // Geometries are independent, read in parallel then added in document order
+        {
+            std::vector<Geometry> geos(doc.geometries.size());
+            std::vector<ubyte>    has_mesh(doc.geometries.size());
 
-                        break;
-                    } else if (strcmp(text, "water") == 0) {
-                        mesh.color = COLOR_BLUE;
-                        mesh.type = MESH_TYPE_WATER;
+            parallel_for(doc.geometries.size(), thread_count, [&](size_t i) {
+                has_mesh[i] = read_collada_geometry(geos[i], doc.geometries[i], doc);
+            });
 
-                        break;
-                    }
-                }
+            geometries.reserve(doc.geometries.size());
 
-                if (strcmp(name, "geopipe:identifier") == 0) {
-                    mesh.color = COLOR_VISTA;
-                    mesh.type = MESH_TYPE_BUILDING;
+            for (size_t i = 0; i < doc.geometries.size(); ++i) {
+                if (has_mesh[i]) {
+                    geometries[doc.geometries[i].id] = std::move(geos[i]);
                 }
+            }
+        }
 
-                if (strcmp(name, "amenity") == 0) {
-                    mesh.color = COLOR_TURQUOISE;
-                    mesh.type = MESH_TYPE_AMENITY;
+        // TRANSFORM 1 and 2, the children of every library node and their own children
+        for (const auto &lib_node : doc.library_nodes) {
+            for (const auto &transform : lib_node.transforms) {
+                read_collada_transform(nodes[lib_node.id], transform, geometries);
+            }
+        }
 
-                    break;
-                }
+        // Visual scene nodes are independent as well, their meshes are merged in document order
+        {
+            std::vector<std::vector<Mesh>> node_meshes(doc.visual_nodes.size());
 
-                if (strcmp(name, "name") == 0) {
-                    mesh.color = COLOR_LAVENDER;
-                    mesh.type = MESH_TYPE_LANDMARK;
+            parallel_for(doc.visual_nodes.size(), thread_count, [&](size_t i) {
+                read_collada_visual_node(node_meshes[i], doc.visual_nodes[i], geometries, nodes);
+            });
 
-                    break;
+            for (auto &node : node_meshes) {
+                for (auto &mesh : node) {
+                    meshes.push_back(std::move(mesh));
                 }
-
-                param_elem = param_elem->NextSiblingElement("param");
             }
+        }
 
-            auto *translate_elem = vis_node_elem->FirstChildElement("translate");
+        destroy(doc);
 
-            glm::vec3 translation = {};
-            if (translate_elem != nullptr) {
-                read_vec3(translation, translate_elem);
+        parallel_for(meshes.size(), thread_count, [&](size_t i) {
+            for (auto &vert : meshes[i].vertices) {
+                std::swap(vert.position.y, vert.position.z);
+                std::swap(vert.normal.y, vert.normal.z);
             }
+        });
 
-            auto *instance_geo_elem = vis_node_elem->FirstChildElement("instance_geometry");
+        // NOTE(paalf): The positions of the meshes without an oriented box are never cleared, they
+        // carry over into the PCA of the next mesh with one. So a box covers every mesh since the
+        // previous box, which still lets each box be computed on its own.
+        std::vector<size_t> aabb_first(meshes.size());
 
-            while (instance_geo_elem != nullptr) {
-                const char *url = instance_geo_elem->Attribute("url");
-                if (url != nullptr) {
-                    ++url;
-                }
+        for (size_t i = 0, first = 0; i < meshes.size(); ++i) {
+            aabb_first[i] = first;
 
-                auto iter = geometries.find(url);
-                if (iter == geometries.end()) {
-                    LOG_ERROR("Failed to get COLLADA geometry with id=%s", url);
-                } else {
-                    auto &verts = iter->second.vertices;
-                    auto &idxs = iter->second.indices;
+            if (MESH_TYPE_TREE < meshes[i].type && meshes[i].type < MESH_TYPE_MISC) {
+                first = i + 1;
+            }
+        }
 
-                    for (auto &vert : verts) {
-                        vert.position += translation;
-                    }
+        parallel_for(meshes.size(), thread_count, [&](size_t i) {
+            Mesh &mesh = meshes[i];
 
-                    for (auto &idx : idxs) {
-                        idx += mesh.vertices.size();
-                    }
+            if (!(MESH_TYPE_TREE < mesh.type && mesh.type < MESH_TYPE_MISC)) {
+                return;
+            }
 
-                    mesh.vertices.insert(mesh.vertices.end(), verts.begin(), verts.end());
-                    mesh.indices.insert(mesh.indices.end(), idxs.begin(), idxs.end());
+            std::vector<glm::vec3> vert_positions;
+            std::vector<glm::vec3> trans_positions;
+
+            for (size_t j = aabb_first[i]; j <= i; ++j) {
+                for (const auto &vert : meshes[j].vertices) {
+                    vert_positions.push_back(vert.position);
                 }
+            }
 
-                instance_geo_elem = instance_geo_elem->NextSiblingElement("instance_geometry");
+            transform_points(trans_positions, vert_positions);
+
+            for (auto &pos : trans_positions) {
+                mesh.aabb.extend(pos);
             }
+        });
 
-            meshes.push_back(mesh);
+        // GL objects are only created on the context thread
+        for (auto &mesh : meshes) {
+            mesh.init(MESH_TYPE_BUILDING);
+        }
+    }
 
-            mesh.vertices.clear();
-            mesh.indices.clear();
+// --------------------------------------------------------------------------------
 
-            
-            // TRANSFORM 3 BEGIN
-            auto *matrix_elem = vis_node_elem->FirstChildElement("matrix");
-            glm::mat4 matrix = {};
+    // The whole source file is hashed, which still takes a fraction of the time parsing it does
+    static bool get_scene_cache_key(Scene_Cache_Key &dst, const char *filepath) {
+        Mapped_File source;
+        if (!map_file(source, filepath)) {
+            return false;
+        }
 
-            if (matrix_elem != nullptr) {
-                read_mat4(matrix, matrix_elem);
+        dst.source_hash = hash_bytes(source.data, source.size);
+        dst.source_size = source.size;
 
-                auto *instance_node_elem = vis_node_elem->FirstChildElement("node")->FirstChildElement("instance_node");
+        destroy(source);
 
-                while (instance_node_elem != nullptr) {
-                    const char *url = instance_node_elem->Attribute("url");
-                    if (url != nullptr) {
-                        ++url;
-                    }
+        const char *last_slash = strrchr(filepath, '/');
+        const char *file_name = last_slash != nullptr ? last_slash + 1 : filepath;
 
-                    auto geos = nodes[url];
+        dst.cache_path = std::string(SCENE_CACHE_DIR "/") + file_name + ".scene";
 
-                    for (auto &geo : geos) {
-                        auto &verts = geo.vertices;
-                        auto &idxs = geo.indices;
+        return true;
+    }
 
-                        for (auto &vert : verts) {
-                            glm::vec4 transformed_pos = glm::vec4(vert.position, 1.0f) * matrix;
-                            vert.position = glm::vec3(transformed_pos);
+    // False if there is no cache for this content of the source file, the meshes are untouched then
+    bool read_scene_cache(const Scene_Cache_Key &key) {
+        timespec time_begin, time_end;
+        timespec_get(&time_begin, TIME_UTC);
 
-                            //glm::vec4 transformed_normal = glm::vec4(vert.normal, 1.0f) * matrix;
-                            //vert.normal = glm::normalize(glm::vec3(transformed_normal));
-                        }
+        Mapped_File file;
+        if (!map_file(file, key.cache_path.c_str())) {
+            return false;
+        }
 
-                        mesh.vertices.insert(mesh.vertices.end(), verts.begin(), verts.end());
-                        mesh.indices.insert(mesh.indices.end(), idxs.begin(), idxs.end());
+        const Scene_Cache_Header *header = reinterpret_cast<const Scene_Cache_Header *>(file.data);
 
-                        meshes.push_back(mesh);
+        bool valid = file.size >= sizeof(Scene_Cache_Header) &&
+                     memcmp(header->magic, SCENE_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+                     header->version == SCENE_CACHE_VERSION &&
+                     header->source_hash == key.source_hash && header->source_size == key.source_size;
 
-                        mesh.vertices.clear();
-                        mesh.indices.clear();
-                    }
+        // Checked before anything is multiplied, a corrupt header cannot overflow the sizes
+        valid = valid && header->mesh_count <= file.size / sizeof(Scene_Cache_Mesh) &&
+                header->vertex_count <= file.size / sizeof(Vertex) && header->index_count <= file.size / sizeof(uint);
 
-                    instance_node_elem = instance_node_elem->NextSiblingElement("instance_node");
+        const Scene_Cache_Mesh *cache_meshes = nullptr;
+        const Vertex *vertices = nullptr;
+        const uint *indices = nullptr;
+
+        if (valid) {
+            size_t vertices_offset = sizeof(Scene_Cache_Header) + header->mesh_count * sizeof(Scene_Cache_Mesh);
+            size_t indices_offset = vertices_offset + header->vertex_count * sizeof(Vertex);
+
+            valid = indices_offset + header->index_count * sizeof(uint) == file.size;
+
+            cache_meshes = reinterpret_cast<const Scene_Cache_Mesh *>(file.data + sizeof(Scene_Cache_Header));
+            vertices = reinterpret_cast<const Vertex *>(file.data + vertices_offset);
+            indices = reinterpret_cast<const uint *>(file.data + indices_offset);
+        }
+
+        for (uint64_t i = 0; valid && i < header->mesh_count; ++i) {
+            const Scene_Cache_Mesh &cache_mesh = cache_meshes[i];
+
+            // Subtracted rather than added, a corrupt offset cannot wrap around
+            valid = cache_mesh.first_vertex <= header->vertex_count &&
+                    cache_mesh.vertex_count <= header->vertex_count - cache_mesh.first_vertex &&
+                    cache_mesh.first_index <= header->index_count &&
+                    cache_mesh.index_count <= header->index_count - cache_mesh.first_index &&
+                    cache_mesh.type <= MESH_TYPE_MISC;
+
+            // The BVH, the camera setups and the indices passes look vertices up by index on the
+            // CPU, so an index past its mesh is corruption just like a bad range
+            if (valid) {
+                const uint *mesh_indices = indices + cache_mesh.first_index;
+
+                uint max_index = 0;
+                for (uint64_t j = 0; j < cache_mesh.index_count; ++j) {
+                    max_index = MAX(max_index, mesh_indices[j]);
                 }
+
+                valid = cache_mesh.index_count == 0 || max_index < cache_mesh.vertex_count;
             }
-            // TRANSFORM 3 END
-            
+        }
 
-            vis_node_elem = vis_node_elem->NextSiblingElement("node");
+        if (!valid) {
+            LOG_WARNING("Scene cache '%s' is outdated or corrupt, it will be rebuilt.", key.cache_path.c_str());
+
+            destroy(file);
+            return false;
         }
 
-        std::vector<glm::vec3> vert_positions;
-        std::vector<glm::vec3> trans_positions;
+        meshes.resize(header->mesh_count);
 
-        for (auto &mesh : meshes) {
-            vert_positions.reserve(mesh.vertices.size());
-            for (auto &vert : mesh.vertices) {
-                std::swap(vert.position.y, vert.position.z);
-                std::swap(vert.normal.y, vert.normal.z);
+        for (uint64_t i = 0; i < header->mesh_count; ++i) {
+            const Scene_Cache_Mesh &cache_mesh = cache_meshes[i];
+            Mesh &mesh = meshes[i];
 
-                //mesh.aabb.extend(vert.position);
-                vert_positions.push_back(vert.position);
-            }
+            const Vertex *mesh_vertices = vertices + cache_mesh.first_vertex;
+            const uint *mesh_indices = indices + cache_mesh.first_index;
 
-            if (MESH_TYPE_TREE < mesh.type && mesh.type < MESH_TYPE_MISC) {
-                transform_points(trans_positions, vert_positions);
+            mesh.vertices.assign(mesh_vertices, mesh_vertices + cache_mesh.vertex_count);
+            mesh.indices.assign(mesh_indices, mesh_indices + cache_mesh.index_count);
 
-                for (auto &pos : trans_positions) {
-                    mesh.aabb.extend(pos);
-                }
+            mesh.base_vert_count = cache_mesh.base_vert_count;
+            mesh.type = cache_mesh.type;
+            mesh.color = cache_mesh.color;
+            mesh.aabb = cache_mesh.aabb;
 
-                trans_positions.clear();
-                vert_positions.clear();
-            }
+            mesh.init(cache_mesh.has_normals ? MESH_TYPE_BUILDING : MESH_TYPE_FLAT);
+        }
 
-            mesh.init(MESH_TYPE_BUILDING);
+        destroy(file);
+
+        timespec_get(&time_end, TIME_UTC);
+        double load_time = (time_end.tv_sec - time_begin.tv_sec) + (time_end.tv_nsec - time_begin.tv_nsec) * 1e-9;
+
+        LOG_TRACE("Read %zu meshes from scene cache '%s' in %.2f ms.", meshes.size(), key.cache_path.c_str(), load_time * 1e3);
+
+        return true;
+    }
+
+    void write_scene_cache(const Scene_Cache_Key &key) const {
+        Scene_Cache_Header header = {};
+        memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+        header.version = SCENE_CACHE_VERSION;
+        header.source_hash = key.source_hash;
+        header.source_size = key.source_size;
+        header.mesh_count = meshes.size();
+
+        std::vector<Scene_Cache_Mesh> cache_meshes(meshes.size());
+
+        for (size_t i = 0; i < meshes.size(); ++i) {
+            const Mesh &mesh = meshes[i];
+            Scene_Cache_Mesh &cache_mesh = cache_meshes[i];
+
+            cache_mesh.first_vertex = header.vertex_count;
+            cache_mesh.first_index = header.index_count;
+            cache_mesh.vertex_count = static_cast<uint>(mesh.vertices.size());
+            cache_mesh.index_count = static_cast<uint>(mesh.indices.size());
+
+            cache_mesh.base_vert_count = mesh.base_vert_count;
+            cache_mesh.type = mesh.type;
+            cache_mesh.has_normals = mesh.vertex_array.count > 1;
+
+            cache_mesh.color = mesh.color;
+            cache_mesh.aabb = mesh.aabb;
+
+            header.vertex_count += mesh.vertices.size();
+            header.index_count += mesh.indices.size();
+        }
+
+        // Written aside then moved in place, batch processes loading at the same time never see a
+        // partial cache
+        char tmp_path[256];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%u.tmp", key.cache_path.c_str(), get_process_id());
+
+        FILE *file = fopen(tmp_path, "wb");
+        if (file == nullptr && create_directory(SCENE_CACHE_DIR)) {
+            file = fopen(tmp_path, "wb");
+        }
+
+        if (file == nullptr) {
+            LOG_WARNING("Failed to create scene cache '%s'.", tmp_path);
+            return;
+        }
+
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                       fwrite(cache_meshes.data(), sizeof(Scene_Cache_Mesh), cache_meshes.size(), file) == cache_meshes.size();
+
+        for (size_t i = 0; written && i < meshes.size(); ++i) {
+            const auto &verts = meshes[i].vertices;
+            written = fwrite(verts.data(), sizeof(Vertex), verts.size(), file) == verts.size();
+        }
+
+        for (size_t i = 0; written && i < meshes.size(); ++i) {
+            const auto &idxs = meshes[i].indices;
+            written = fwrite(idxs.data(), sizeof(uint), idxs.size(), file) == idxs.size();
+        }
+
+        written = fclose(file) == 0 && written;
+
+        if (!written || !replace_file(tmp_path, key.cache_path.c_str())) {
+            LOG_WARNING("Failed to write scene cache '%s'.", key.cache_path.c_str());
+            remove(tmp_path);
         }
     }
 
@@ -604,21 +836,39 @@ struct Model {
             return;
         }
 
-        if (strcmp(last_dot, ".geojson") == 0) {
+        bool is_geojson = strcmp(last_dot, ".geojson") == 0;
+
+        if (!is_geojson && strcmp(last_dot, ".dae") != 0) {
+            LOG_ERROR("'%s' model format is not supported.", last_dot);
+            return;
+        }
+
+        if (is_geojson) {
             glm::vec2 tmp = to_meters(x, z);
             position.x = tmp.x;
             position.y = y;
             position.z = -tmp.y;
-
-            init_geojson(filepath);
-        } else if (strcmp(last_dot, ".dae") == 0) {
+        } else {
             position.x = x;
             position.y = y;
             position.z = z;
+        }
 
-            init_collada(filepath);
+        Scene_Cache_Key cache_key;
+        bool use_cache = global::scene_cache && get_scene_cache_key(cache_key, filepath);
+
+        if (use_cache && read_scene_cache(cache_key)) {
+            return;
+        }
+
+        if (is_geojson) {
+            init_geojson(filepath, get_thread_count(global::loader_thread_count));
         } else {
-            LOG_ERROR("'%s' model format is not supported.", last_dot);
+            init_collada(filepath, get_thread_count(global::loader_thread_count));
+        }
+
+        if (use_cache && !meshes.empty()) {
+            write_scene_cache(cache_key);
         }
     }
 };
@@ -1,10 +1,19 @@
 #ifndef RENDERER_HPP
 #define RENDERER_HPP
 
-#include "window.hpp"
-#include "menu.hpp"
+#ifdef HEADLESS_MODE
+#   include "headless.hpp"
+#else
+#   include "window.hpp"
+#   include "menu.hpp"
+#endif // HEADLESS_MODE
+
 #include "model.hpp"
 
+#include "../util/bvh.hpp"
+#include "../util/occlusion.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <time.h>
@@ -16,27 +25,186 @@ enum Render_Mode : ubyte {
     RENDER_MODE_COLLADA
 };
 
+enum Mesh_Visibility : ubyte {
+    MESH_VISIBILITY_CULLED,
+    MESH_VISIBILITY_VISIBLE,
+    MESH_VISIBILITY_OCCLUDER, // Drawn before the depth pyramid was built
+    MESH_VISIBILITY_OCCLUDED
+};
+
+// Attribute locations of the merged scene buffers, the shaders drawing them use the same ones
+enum Scene_Attrib : uint {
+    SCENE_ATTRIB_POSITION,
+    SCENE_ATTRIB_NORMAL,
+    SCENE_ATTRIB_COLOR,
+    SCENE_ATTRIB_CLASS_ID,
+    SCENE_ATTRIB_PICKING_ID,
+    SCENE_ATTRIB_MESH_IDX
+};
+
+// Mesh orders the passes draw in, concatenated in one buffer for the GPU culling
+enum Draw_List : ubyte {
+    DRAW_LIST_SCENE,   // Every mesh in mesh order, for the viewer
+    DRAW_LIST_PICKING, // 'building_indices'
+    DRAW_LIST_INDICES, // Buildings, trees then water, like 'record_visible_meshes'
+    DRAW_LIST_CLASSES, // 'class_indices' bucket by bucket, for the query reduction
+    DRAW_LIST_COUNT
+};
+
+// What changed since the last frame drawn when rendering on demand, see 'needs_redraw'
+enum _Dirty_Flags : uint {
+    DIRTY_FLAGS_CAMERA = BIT(0),
+    DIRTY_FLAGS_LIGHT  = BIT(1),
+    DIRTY_FLAGS_PICKED = BIT(2),
+    DIRTY_FLAGS_CONFIG = BIT(3),
+    DIRTY_FLAGS_WINDOW = BIT(4),
+    DIRTY_FLAGS_INPUT  = BIT(5), // Any event the menu may react to
+};
+
+typedef uint Dirty_Flags;
+
+// Everything a frame is drawn from that can change without the menu being used
+struct View_State {
+    glm::vec3    camera_position;
+    glm::vec3    camera_front;
+    float        camera_zoom;
+
+    glm::vec3    light_position;
+    glm::vec3    light_color;
+
+    int          picked_id;
+    int          picked_mesh_idx;
+
+    Config_Flags config_flags;
+    bool         show_menu;
+    bool         show_debug_menu;
+
+    int          width;
+    int          height;
+};
+
+// std140 layout of the 'Frame' uniform block, shared by every program drawing the scene
+struct Frame_Uniforms {
+    glm::mat4 model;
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 normal_matrix; // Inverse transpose of the model matrix, padded to a mat4
+    glm::vec4 view_position;
+    glm::vec4 light_position;
+    glm::vec4 light_color;
+};
+
+// Per mesh data of the merged scene buffers, fetched as an instanced attribute through the base
+// instance of the mesh's indirect command
+struct Mesh_Draw_Data {
+    glm::vec4 color;
+    uint      class_id;
+    uint      picking_id; // One past the mesh's position in 'building_indices', 0 if not a building
+    uint      mesh_idx;
+    uint      padding;
+};
+
 // --------------------------------------------------------------------------------
 
 namespace renderer {
-Render_Mode       mode;
+Render_Mode          mode;
+
+Shader               buildings_shader     = {};
+Shader               flat_shader          = {};
+Shader               picking_shader       = {};
+Shader               indices_shader       = {};
+Shader               indices_batch_shader = {};
+Shader               panorama_shader      = {};
+Shader               depth_pyramid_shader = {};
+//Shader             position_shader      = {};
+
+Model                buildings_model;
+Model                flat_model;
+
+std::vector<uint>    building_indices;
+std::vector<uint>    tree_indices;
+std::vector<uint>    water_indices;
+
+// Mesh indices per indices class, the sky bucket stays empty
+std::vector<uint>    class_indices[INDICES_CLASS_COUNT];
 
-Shader            buildings_shader = {};
-Shader            flat_shader      = {};
-Shader            picking_shader   = {};
-Shader            indices_shader   = {};
-//Shader          position_shader  = {};
+// Indices class per mesh, sky for the meshes the indices passes do not draw
+std::vector<ubyte>   mesh_classes;
 
-Model             buildings_model;
-Model             flat_model;
+glm::mat4            projection           = {};
+glm::mat4            view                 = {};
+glm::mat4            model                = {};
 
-std::vector<uint> building_indices;
-std::vector<uint> tree_indices;
-std::vector<uint> water_indices;
+// Matrices and light of the current frame or camera setup, see 'Frame_Uniforms'
+Uniform_Buffer       frame_buffer         = {};
 
-glm::mat4         projection       = {};
-glm::mat4         view             = {};
-glm::mat4         model            = {};
+// Last contents of 'frame_buffer', an unchanged frame is not uploaded again
+Frame_Uniforms       frame_uniforms       = {};
+bool                 frame_uniforms_valid = false;
+
+// Projection, then the view matrices of the camera setups of a batch, indexed by instance id
+Uniform_Buffer       views_buffer         = {};
+
+// Attribute-less draws (full-screen passes) still need a vertex array bound
+Vertex_Array<Vertex> empty_vertex_array   = {};
+
+// Spatial index over 'buildings_model', in model space like the mesh bounds
+Scene_BVH            scene_bvh            = {};
+
+// One frustum per view of the current batch, a mesh is drawn if any of them sees it
+Frustum              batch_frusta[MAX_BATCH_SIZE];
+uint                 batch_frustum_count  = 0;
+
+// Per mesh of 'buildings_model', a 'Mesh_Visibility' set by the last 'cull_meshes'
+std::vector<ubyte>   mesh_visibility;
+
+// Occlusion culling, the viewer draws its occluders offscreen since it renders to the window
+Depth_Pyramid        viewer_pyramid       = {};
+Depth_Pyramid        indices_pyramid      = {};
+Indices_Frame_Buffer occluder_buffer      = {};
+
+// Every mesh of 'buildings_model' in one vertex and one index buffer, each pass records the
+// visible meshes and draws them all with one indirect call
+Vertex_Array<Vertex> scene_vertex_array   = {};
+Vertex_Buffer        scene_vertex_buffer  = {};
+Index_Buffer         scene_index_buffer   = {};
+Vertex_Buffer        draw_data_buffer     = {};
+Indirect_Buffer      command_buffer       = {};
+
+// Falls back to one base vertex draw per command, with the draw data as constant attributes
+bool                 multi_draw           = false;
+
+std::vector<Draw_Elements_Command> mesh_commands;
+std::vector<Mesh_Draw_Data>        mesh_draw_data;
+std::vector<Draw_Elements_Command> pass_commands;
+
+// GPU culling, when supported: a compute pass tests the meshes of a draw list against the frusta of the pass and
+// writes their commands, with no instances for the culled ones, to 'culled_command_buffer'
+Shader               cull_shader          = {};
+bool                 gpu_culling          = false;
+
+Storage_Buffer       mesh_bounds_buffer   = {};
+Storage_Buffer       mesh_command_buffer  = {};
+Storage_Buffer       draw_list_buffer     = {};
+Indirect_Buffer      culled_command_buffer = {};
+
+// Drawn and culled meshes per render pass, 64-bit counters that only the GPU adds to
+Storage_Buffer       gpu_culling_buffer   = {};
+
+uint                 draw_list_offsets[DRAW_LIST_COUNT + 1];
+
+// Bucket offsets inside 'DRAW_LIST_CLASSES'
+uint                 class_list_offsets[INDICES_CLASS_COUNT + 1];
+
+// Passes culled on the GPU since the counters were last copied, and the counters the menu read
+uint                 gpu_culled_passes[RENDER_PASS_COUNT] = {};
+Culling_Stats        gpu_culling_read[RENDER_PASS_COUNT]  = {};
+
+// The menu reads a copy of the counters a frame or more late, once the fence after the copy
+// has signaled, so drawing it never waits for the passes just submitted
+Storage_Buffer       gpu_culling_copy     = {};
+GLsync               gpu_culling_fence    = nullptr;
+uint                 gpu_copied_passes[RENDER_PASS_COUNT] = {};
 
 // --------------------------------------------------------------------------------
 
@@ -48,16 +216,192 @@ void filter_mesh_indices() {
 
         if (MESH_TYPE_FLAT < mesh_type && mesh_type < MESH_TYPE_TREE) {
             water_indices.push_back(i);
+            class_indices[INDICES_CLASS_WATER].push_back(i);
         } else if (mesh_type < MESH_TYPE_BUILDING) {
             tree_indices.push_back(i);
+            class_indices[INDICES_CLASS_TREE].push_back(i);
         } else if (mesh_type < MESH_TYPE_MISC) {
             building_indices.push_back(i);
+
+            if (mesh_type == MESH_TYPE_BUILDING) {
+                class_indices[INDICES_CLASS_BUILDING].push_back(i);
+            } else if (mesh_type == MESH_TYPE_AMENITY) {
+                class_indices[INDICES_CLASS_AMENITY].push_back(i);
+            } else if (mesh_type == MESH_TYPE_LANDMARK) {
+                class_indices[INDICES_CLASS_LANDMARK].push_back(i);
+            }
+        }
+    }
+
+    mesh_classes.assign(buildings_model.meshes.size(), INDICES_CLASS_SKY);
+
+    for (uint i = INDICES_CLASS_SKY + 1; i < INDICES_CLASS_COUNT; ++i) {
+        for (auto idx : class_indices[i]) {
+            mesh_classes[idx] = static_cast<ubyte>(i);
         }
     }
 }
 
 // --------------------------------------------------------------------------------
 
+void init_scene_buffers() {
+    multi_draw = GLEW_VERSION_4_3 || (GLEW_ARB_draw_indirect && GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+
+    if (!multi_draw) {
+        LOG_WARNING("Multi draw indirect is not supported, meshes will be drawn one by one.");
+    } else if (!global::multi_draw) {
+        multi_draw = false;
+    }
+
+    const auto &meshes = buildings_model.meshes;
+    size_t mesh_count = meshes.size();
+
+    size_t vert_count = 0;
+    size_t idx_count = 0;
+
+    for (const auto &mesh : meshes) {
+        vert_count += mesh.vertices.size();
+        idx_count += mesh.indices.size();
+    }
+
+    std::vector<Vertex> vertices;
+    std::vector<uint> indices;
+    vertices.reserve(vert_count);
+    indices.reserve(idx_count);
+
+    mesh_commands.resize(mesh_count);
+    mesh_draw_data.resize(mesh_count);
+
+    for (size_t i = 0; i < mesh_count; ++i) {
+        const auto &mesh = meshes[i];
+
+        // The indices stay local to their mesh, the base vertex offsets them
+        mesh_commands[i].count = static_cast<uint>(mesh.indices.size());
+        mesh_commands[i].instance_count = 1;
+        mesh_commands[i].first_index = static_cast<uint>(indices.size());
+        mesh_commands[i].base_vertex = static_cast<int>(vertices.size());
+        mesh_commands[i].base_instance = static_cast<uint>(i);
+
+        mesh_draw_data[i].color = mesh.color;
+        mesh_draw_data[i].class_id = mesh_classes[i];
+        mesh_draw_data[i].picking_id = 0;
+        mesh_draw_data[i].mesh_idx = static_cast<uint>(i);
+
+        vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+        indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+    }
+
+    for (size_t i = 0; i < building_indices.size(); ++i) {
+        mesh_draw_data[building_indices[i]].picking_id = static_cast<uint>(i + 1);
+    }
+
+    scene_vertex_array = make_vertex_array<Vertex>();
+    scene_vertex_buffer = make_vertex_buffer();
+    scene_index_buffer = make_index_buffer();
+    draw_data_buffer = make_vertex_buffer();
+
+    scene_vertex_array.bind();
+
+    scene_vertex_buffer.init(vertices.data(), vertices.size() * sizeof(Vertex));
+    scene_index_buffer.init(indices.data(), indices.size() * sizeof(uint));
+
+    scene_vertex_array.push<float>(3, offsetof(Vertex, position));
+    scene_vertex_array.push<float>(3, offsetof(Vertex, normal));
+
+    draw_data_buffer.init(mesh_draw_data.data(), mesh_count * sizeof(Mesh_Draw_Data));
+
+    if (multi_draw) {
+        // NOTE(paalf): a batch draws every mesh once per view, and all those instances must
+        // read the element of the base instance, so the data only advances past the last view
+        scene_vertex_array.push_instanced<Mesh_Draw_Data, float>(4, offsetof(Mesh_Draw_Data, color), MAX_BATCH_SIZE);
+        scene_vertex_array.push_instanced<Mesh_Draw_Data, uint>(1, offsetof(Mesh_Draw_Data, class_id), MAX_BATCH_SIZE);
+        scene_vertex_array.push_instanced<Mesh_Draw_Data, uint>(1, offsetof(Mesh_Draw_Data, picking_id), MAX_BATCH_SIZE);
+        scene_vertex_array.push_instanced<Mesh_Draw_Data, uint>(1, offsetof(Mesh_Draw_Data, mesh_idx), MAX_BATCH_SIZE);
+    }
+
+    scene_vertex_array.unbind();
+
+    command_buffer = make_indirect_buffer();
+    pass_commands.reserve(mesh_count);
+
+    // Nothing draws from the per mesh buffers anymore
+    buildings_model.release_mesh_buffers();
+
+    LOG_TRACE("Merged %zu meshes into %.2f MB of scene buffers, drawn with %s.", mesh_count,
+              (vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint)) / (1024.0 * 1024.0),
+              multi_draw ? "multi draw indirect" : "one draw per mesh");
+}
+
+void init_gpu_culling() {
+    if (!multi_draw || !(GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object))) {
+        LOG_WARNING("Compute shaders or multi draw indirect are not available, meshes will be culled on the CPU.");
+        return;
+    }
+
+    cull_shader = make_compute_shader("res/shaders/cull_comp.glsl");
+
+    if (cull_shader.id == 0) {
+        LOG_ERROR("Failed to create the culling shader, meshes will be culled on the CPU.");
+        return;
+    }
+
+    const auto &meshes = buildings_model.meshes;
+    size_t mesh_count = meshes.size();
+
+    std::vector<glm::vec4> bounds(2 * mesh_count);
+    for (size_t i = 0; i < mesh_count; ++i) {
+        bounds[2 * i] = glm::vec4(meshes[i].bounds.min, 1.0f);
+        bounds[2 * i + 1] = glm::vec4(meshes[i].bounds.max, 1.0f);
+    }
+
+    std::vector<uint> draw_lists;
+    draw_lists.reserve(4 * mesh_count);
+
+    draw_list_offsets[DRAW_LIST_SCENE] = 0;
+    for (size_t i = 0; i < mesh_count; ++i) {
+        draw_lists.push_back(static_cast<uint>(i));
+    }
+
+    draw_list_offsets[DRAW_LIST_PICKING] = static_cast<uint>(draw_lists.size());
+    draw_lists.insert(draw_lists.end(), building_indices.begin(), building_indices.end());
+
+    draw_list_offsets[DRAW_LIST_INDICES] = static_cast<uint>(draw_lists.size());
+    draw_lists.insert(draw_lists.end(), building_indices.begin(), building_indices.end());
+    draw_lists.insert(draw_lists.end(), tree_indices.begin(), tree_indices.end());
+    draw_lists.insert(draw_lists.end(), water_indices.begin(), water_indices.end());
+
+    draw_list_offsets[DRAW_LIST_CLASSES] = static_cast<uint>(draw_lists.size());
+    for (uint i = 0; i < INDICES_CLASS_COUNT; ++i) {
+        class_list_offsets[i] = static_cast<uint>(draw_lists.size()) - draw_list_offsets[DRAW_LIST_CLASSES];
+        draw_lists.insert(draw_lists.end(), class_indices[i].begin(), class_indices[i].end());
+    }
+    class_list_offsets[INDICES_CLASS_COUNT] = static_cast<uint>(draw_lists.size()) - draw_list_offsets[DRAW_LIST_CLASSES];
+
+    draw_list_offsets[DRAW_LIST_COUNT] = static_cast<uint>(draw_lists.size());
+
+    mesh_bounds_buffer = make_storage_buffer();
+    mesh_bounds_buffer.init(bounds.data(), bounds.size() * sizeof(glm::vec4), GL_STATIC_DRAW);
+
+    mesh_command_buffer = make_storage_buffer();
+    mesh_command_buffer.init(mesh_commands.data(), mesh_count * sizeof(Draw_Elements_Command), GL_STATIC_DRAW);
+
+    draw_list_buffer = make_storage_buffer();
+    draw_list_buffer.init(draw_lists.data(), draw_lists.size() * sizeof(uint), GL_STATIC_DRAW);
+
+    // No list is longer than the scene one
+    culled_command_buffer = make_indirect_buffer();
+    culled_command_buffer.init(mesh_count);
+
+    uint counters[RENDER_PASS_COUNT * 4] = {};
+    gpu_culling_buffer = make_storage_buffer();
+    gpu_culling_buffer.init(counters, sizeof(counters));
+
+    gpu_culling_copy = make_storage_buffer();
+    gpu_culling_copy.init(counters, sizeof(counters), GL_STREAM_READ);
+
+    gpu_culling = true;
+}
+
 void init(Render_Mode render_mode) {
     mode = render_mode;
 
@@ -76,8 +420,31 @@ void init(Render_Mode render_mode) {
     picking_shader = make_shader("res/shaders/picking_vert.glsl",
                                  "res/shaders/picking_frag.glsl");
 
-    indices_shader = make_shader("res/shaders/picking_vert.glsl",
-                                 "res/shaders/picking_frag.glsl");
+    indices_shader = make_shader("res/shaders/indices_vert.glsl",
+                                 "res/shaders/indices_frag.glsl");
+
+    indices_batch_shader = make_shader("res/shaders/indices_batch_vert.glsl",
+                                       "res/shaders/indices_batch_geom.glsl",
+                                       "res/shaders/indices_frag.glsl");
+
+    // Bound once, every program has its blocks bound to these points when it is linked
+    frame_buffer = make_uniform_buffer();
+    frame_buffer.init(nullptr, sizeof(Frame_Uniforms));
+    frame_buffer.bind_base(UNIFORM_BLOCK_FRAME);
+    frame_uniforms_valid = false;
+
+    views_buffer = make_uniform_buffer();
+    views_buffer.init(nullptr, (MAX_BATCH_SIZE + 1) * sizeof(glm::mat4));
+    views_buffer.bind_base(UNIFORM_BLOCK_VIEWS);
+
+    panorama_shader = make_shader("res/shaders/panorama_vert.glsl",
+                                  "res/shaders/panorama_frag.glsl");
+
+    // Same full-screen triangle as the panorama resampling
+    depth_pyramid_shader = make_shader("res/shaders/panorama_vert.glsl",
+                                       "res/shaders/depth_pyramid_frag.glsl");
+
+    empty_vertex_array = make_vertex_array<Vertex>();
 
     if (render_mode == RENDER_MODE_GEOJSON) {
         // Model
@@ -103,6 +470,19 @@ void init(Render_Mode render_mode) {
 
     filter_mesh_indices();
 
+    scene_bvh = make_scene_bvh();
+    scene_bvh.build(buildings_model.meshes, true, std::thread::hardware_concurrency());
+
+    LOG_TRACE("Built the scene BVH in %.2f ms (%zu nodes, depth %u).",
+              scene_bvh.build_time * 1e3, scene_bvh.top.nodes.size(), scene_bvh.top.depth);
+
+    mesh_visibility.assign(buildings_model.meshes.size(), 1);
+
+    if (render_mode == RENDER_MODE_COLLADA) {
+        init_scene_buffers();
+        init_gpu_culling();
+    }
+
     // Light
     global::light_position = camera::position;
     camera::light_position_ptr = &global::light_position;
@@ -110,6 +490,34 @@ void init(Render_Mode render_mode) {
 
 void shutdown() {
     //destroy(position_shader);
+    if (gpu_culling) {
+        if (gpu_culling_fence != nullptr) {
+            GL_CALL(glDeleteSync(gpu_culling_fence));
+        }
+
+        destroy(gpu_culling_copy);
+        destroy(gpu_culling_buffer);
+        destroy(culled_command_buffer);
+        destroy(draw_list_buffer);
+        destroy(mesh_command_buffer);
+        destroy(mesh_bounds_buffer);
+        destroy(cull_shader);
+    }
+
+    destroy(command_buffer);
+    destroy(draw_data_buffer);
+    destroy(scene_index_buffer);
+    destroy(scene_vertex_buffer);
+    destroy(scene_vertex_array);
+    destroy(occluder_buffer);
+    destroy(indices_pyramid);
+    destroy(viewer_pyramid);
+    destroy(depth_pyramid_shader);
+    destroy(empty_vertex_array);
+    destroy(panorama_shader);
+    destroy(views_buffer);
+    destroy(frame_buffer);
+    destroy(indices_batch_shader);
     destroy(indices_shader);
     destroy(picking_shader);
     destroy(flat_shader);
@@ -118,40 +526,377 @@ void shutdown() {
 
 // --------------------------------------------------------------------------------
 
-void update_mvp() {
-    projection = glm::perspective(glm::radians(camera::zoom), window::aspect_ratio, 1.0f, 1000.0f);
+void update_mvp(float aspect_ratio = window::aspect_ratio) {
+    projection = glm::perspective(glm::radians(camera::zoom), aspect_ratio, NEAR_PLANE, FAR_PLANE);
     view = camera::get_view_matrix();
     model = glm::translate(glm::mat4(1.0f), -buildings_model.position);
 }
 
-void set_mvp_uniform(Shader &shader) {
-    shader.bind();
-    shader.set_uniform_mat4("uModel", model);
-    shader.set_uniform_mat4("uView", view);
-    shader.set_uniform_mat4("uProjection", projection);
-};
+// Uploads the current MVP, camera and light for every program at once
+void set_frame_uniforms() {
+    Frame_Uniforms uniforms = {};
+
+    uniforms.model = model;
+    uniforms.view = view;
+    uniforms.projection = projection;
+    uniforms.normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+    uniforms.view_position = glm::vec4(camera::position, 1.0f);
+    uniforms.light_position = glm::vec4(global::light_position, 1.0f);
+    uniforms.light_color = glm::vec4(global::light_color, 1.0f);
+
+    if (frame_uniforms_valid && memcmp(&uniforms, &frame_uniforms, sizeof(uniforms)) == 0) {
+        return;
+    }
+
+    frame_buffer.write(&uniforms, sizeof(uniforms));
+
+    frame_uniforms = uniforms;
+    frame_uniforms_valid = true;
+}
+
+// Projection and model are shared by every setup of a batch, only the view differs. The model
+// comes from the frame uniforms, uploaded along.
+void set_batch_uniforms(const glm::mat4 *views, uint view_count, const glm::mat4 &batch_projection = projection) {
+    ASSERT(view_count <= MAX_BATCH_SIZE);
+
+    set_frame_uniforms();
+
+    for (uint i = 0; i < view_count; ++i) {
+        batch_frusta[i].init(batch_projection * views[i] * model);
+    }
+    batch_frustum_count = view_count;
+
+    views_buffer.write(&batch_projection, sizeof(glm::mat4));
+    views_buffer.write(views, view_count * sizeof(glm::mat4), sizeof(glm::mat4));
+}
 
 // --------------------------------------------------------------------------------
 
-void update() {
-    update_mvp();
+// Frustum of the current MVP, built per pass since the indices passes jitter the projection
+Frustum get_frustum() {
+    Frustum ret;
+    ret.init(projection * view * model);
+
+    return ret;
+}
+
+// A mesh is kept if any of the frusta sees it
+void cull_meshes(const Frustum *frusta, uint frustum_count) {
+    if (!global::frustum_culling) {
+        memset(mesh_visibility.data(), MESH_VISIBILITY_VISIBLE, mesh_visibility.size());
+        return;
+    }
+
+    memset(mesh_visibility.data(), MESH_VISIBILITY_CULLED, mesh_visibility.size());
+
+    for (uint i = 0; i < frustum_count; ++i) {
+        scene_bvh.query_frustum(frusta[i], [](uint mesh_idx) {
+            mesh_visibility[mesh_idx] = MESH_VISIBILITY_VISIBLE;
+        });
+    }
+}
+
+void cull_meshes(const Frustum &frustum) {
+    cull_meshes(&frustum, 1);
+}
+
+// Counts the mesh as drawn, culled or occluded in 'stats', occluders were counted when drawn
+bool is_visible(uint mesh_idx, Culling_Stats &stats) {
+    switch (mesh_visibility[mesh_idx]) {
+    case MESH_VISIBILITY_VISIBLE:
+        ++stats.drawn;
+        return true;
+    case MESH_VISIBILITY_CULLED:
+        ++stats.culled;
+        return false;
+    case MESH_VISIBILITY_OCCLUDED:
+        ++stats.occluded;
+        return false;
+    default:
+        return false;
+    }
+}
+
+// Records a draw of the mesh for the next 'submit_draws', 'instance_count' times
+void push_draw(uint mesh_idx, uint instance_count = 1) {
+    Draw_Elements_Command command = mesh_commands[mesh_idx];
+    command.instance_count = instance_count;
+
+    pass_commands.push_back(command);
+}
+
+// Draws the recorded meshes in the order they were recorded, with the bound program
+void submit_draws() {
+    if (pass_commands.empty()) {
+        return;
+    }
+
+    scene_vertex_array.bind();
+
+    if (multi_draw) {
+        command_buffer.write(pass_commands.data(), pass_commands.size());
+
+        command_buffer.bind();
+        GL_CALL(glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, pass_commands.size(), 0));
+        command_buffer.unbind();
+    } else {
+        for (const auto &command : pass_commands) {
+            const auto &data = mesh_draw_data[command.base_instance];
+
+            GL_CALL(glVertexAttrib4fv(SCENE_ATTRIB_COLOR, &data.color[0]));
+            GL_CALL(glVertexAttribI1ui(SCENE_ATTRIB_CLASS_ID, data.class_id));
+            GL_CALL(glVertexAttribI1ui(SCENE_ATTRIB_PICKING_ID, data.picking_id));
+            GL_CALL(glVertexAttribI1ui(SCENE_ATTRIB_MESH_IDX, data.mesh_idx));
+
+            GL_CALL(glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                                                      reinterpret_cast<const void *>(command.first_index * sizeof(uint)),
+                                                      command.instance_count, command.base_vertex));
+        }
+    }
+
+    scene_vertex_array.unbind();
+
+    pass_commands.clear();
+}
+
+// Records the meshes of every indices class that survived culling, buildings first, then trees
+// and water, each in the order of its bucket
+void record_visible_meshes(Culling_Stats &stats, uint instance_count = 1) {
+    for (auto idx : building_indices) {
+        if (is_visible(idx, stats)) {
+            push_draw(idx, instance_count);
+        }
+    }
+
+    for (auto idx : tree_indices) {
+        if (is_visible(idx, stats)) {
+            push_draw(idx, instance_count);
+        }
+    }
+
+    for (auto idx : water_indices) {
+        if (is_visible(idx, stats)) {
+            push_draw(idx, instance_count);
+        }
+    }
+}
+
+void record_class_meshes(uint class_id, Culling_Stats &stats) {
+    for (auto idx : class_indices[class_id]) {
+        if (is_visible(idx, stats)) {
+            push_draw(idx);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+// The occlusion culling tests the depth pyramid on the CPU, so it needs the frustum culling there
+inline bool use_gpu_culling(bool occlusion_culled) {
+    return gpu_culling && global::gpu_culling && !(occlusion_culled && global::occlusion_culling);
+}
+
+// Tests the meshes of 'list' against the frusta on the GPU and leaves their commands, in list
+// order, in 'culled_command_buffer'. Each visible mesh is drawn 'instance_count' times.
+void cull_draw_list(Draw_List list, const Frustum *frusta, uint frustum_count, Render_Pass pass, uint instance_count = 1) {
+    ASSERT(frustum_count <= MAX_BATCH_SIZE);
+
+    glm::vec4 planes[MAX_BATCH_SIZE * 6];
+
+    for (uint i = 0; i < frustum_count; ++i) {
+        for (uint j = 0; j < 6; ++j) {
+            planes[6 * i + j] = glm::vec4(frusta[i].plane_x[j], frusta[i].plane_y[j], frusta[i].plane_z[j], frusta[i].plane_w[j]);
+        }
+    }
+
+    uint list_size = draw_list_offsets[list + 1] - draw_list_offsets[list];
+
+    mesh_bounds_buffer.bind_base(0);
+    mesh_command_buffer.bind_base(1);
+    draw_list_buffer.bind_base(2);
+    culled_command_buffer.bind_base(3);
+    gpu_culling_buffer.bind_base(4);
+
+    cull_shader.bind();
+    cull_shader.set_uniform_vec4v(UNIFORM_PLANES, planes, 6 * frustum_count);
+    cull_shader.set_uniform_1ui(UNIFORM_VIEW_COUNT, frustum_count);
+    cull_shader.set_uniform_1i(UNIFORM_CULLING, global::frustum_culling);
+    cull_shader.set_uniform_1ui(UNIFORM_LIST_OFFSET, draw_list_offsets[list]);
+    cull_shader.set_uniform_1ui(UNIFORM_LIST_SIZE, list_size);
+    cull_shader.set_uniform_1ui(UNIFORM_INSTANCE_COUNT, instance_count);
+    cull_shader.set_uniform_1ui(UNIFORM_STATS_OFFSET, 4 * pass);
+
+    GL_CALL(glDispatchCompute((list_size + 63) / 64, 1, 1));
+    GL_CALL(glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT));
+
+    ++gpu_culled_passes[pass];
+}
+
+void cull_draw_list(Draw_List list, const Frustum &frustum, Render_Pass pass) {
+    cull_draw_list(list, &frustum, 1, pass);
+}
+
+// Draws 'count' of the commands the last 'cull_draw_list' left, from 'first' on, with the bound program
+void submit_culled_draws(uint first, uint count) {
+    if (count == 0) {
+        return;
+    }
+
+    scene_vertex_array.bind();
+    culled_command_buffer.bind();
+
+    GL_CALL(glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                        reinterpret_cast<const void *>(first * sizeof(Draw_Elements_Command)), count, 0));
+
+    culled_command_buffer.unbind();
+    scene_vertex_array.unbind();
+}
+
+void submit_culled_draws(Draw_List list) {
+    submit_culled_draws(0, draw_list_offsets[list + 1] - draw_list_offsets[list]);
+}
+
+void unpack_gpu_culling_counters(Culling_Stats *totals, const uint *counters) {
+    for (uint i = 0; i < RENDER_PASS_COUNT; ++i) {
+        totals[i].drawn = counters[4 * i] | (static_cast<size_t>(counters[4 * i + 1]) << 32);
+        totals[i].culled = counters[4 * i + 2] | (static_cast<size_t>(counters[4 * i + 3]) << 32);
+        totals[i].occluded = 0;
+    }
+}
+
+// Meshes drawn and culled by every GPU culled pass so far, waits for the GPU to get there
+void get_gpu_culling_totals(Culling_Stats *totals) {
+    uint counters[RENDER_PASS_COUNT * 4] = {};
+
+    if (gpu_culling) {
+        gpu_culling_buffer.read(counters, sizeof(counters));
+    }
+
+    unpack_gpu_culling_counters(totals, counters);
+}
+
+// The GPU culled passes only count on the GPU, so their stats are the mean of the passes between
+// two copies of the counters. A copy is read once the GPU is done with it, and only then is the
+// next one queued, the stats lag a frame or more behind but nothing waits.
+void update_gpu_culling_stats() {
+    if (!gpu_culling) {
+        return;
+    }
+
+    if (gpu_culling_fence != nullptr) {
+        uint status;
+        GL_CALL(status = glClientWaitSync(gpu_culling_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0));
+
+        if (status == GL_TIMEOUT_EXPIRED) {
+            return;
+        }
+
+        if (status == GL_WAIT_FAILED) {
+            LOG_ERROR("Failed to wait for the copy of the GPU culling counters.");
+        }
+
+        GL_CALL(glDeleteSync(gpu_culling_fence));
+        gpu_culling_fence = nullptr;
+
+        uint counters[RENDER_PASS_COUNT * 4];
+        gpu_culling_copy.read(counters, sizeof(counters));
+
+        Culling_Stats totals[RENDER_PASS_COUNT];
+        unpack_gpu_culling_counters(totals, counters);
+
+        for (uint i = 0; i < RENDER_PASS_COUNT; ++i) {
+            if (gpu_copied_passes[i] > 0) {
+                global::culling_stats[i].drawn = (totals[i].drawn - gpu_culling_read[i].drawn) / gpu_copied_passes[i];
+                global::culling_stats[i].culled = (totals[i].culled - gpu_culling_read[i].culled) / gpu_copied_passes[i];
+                global::culling_stats[i].occluded = 0;
+            }
+
+            gpu_culling_read[i] = totals[i];
+            gpu_copied_passes[i] = 0;
+        }
+    }
+
+    uint pass_count = 0;
+    for (auto count : gpu_culled_passes) {
+        pass_count += count;
+    }
 
-    // Buildings shader update
-    set_mvp_uniform(buildings_shader);
-    buildings_shader.set_uniform_vec3("uViewPosition", camera::position);
-    buildings_shader.set_uniform_vec3("uLightPosition", global::light_position);
-    buildings_shader.set_uniform_vec3("uLightColor", global::light_color);
+    if (pass_count == 0) {
+        return;
+    }
+
+    gpu_culling_buffer.copy_to(gpu_culling_copy, RENDER_PASS_COUNT * 4 * sizeof(uint));
+    GL_CALL(gpu_culling_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
 
-    if (mode == RENDER_MODE_GEOJSON) {
-        // Flat shader update
-        set_mvp_uniform(flat_shader);
+    for (uint i = 0; i < RENDER_PASS_COUNT; ++i) {
+        gpu_copied_passes[i] = gpu_culled_passes[i];
+        gpu_culled_passes[i] = 0;
     }
+}
+
+// Two phase Hi-Z occlusion culling of the meshes 'cull_meshes' kept, with the current MVP. The
+// 'global::occluder_count' biggest ones on screen that 'can_occlude' accepts are drawn into
+// 'target' first with the bound program, then every other mesh is tested against the depth
+// pyramid of what they left in it. Returns the number of occluders, which stay marked as such.
+template<typename Can_Occlude>
+uint occlusion_cull_meshes(Depth_Pyramid &pyramid, const Indices_Frame_Buffer &target, Can_Occlude &&can_occlude) {
+    const glm::mat4 mvp = projection * view * model;
+
+    Linear_Allocator &storage = global::transient_storage;
+    Arena_Scope scope = storage.begin_scope();
+
+    uint mesh_count = static_cast<uint>(mesh_visibility.size());
+
+    uint *candidates = storage.alloc_array<uint>(mesh_count);
+    float *areas = storage.alloc_array<float>(mesh_count);
+    uint candidate_count = 0;
+
+    for (uint i = 0; i < mesh_count; ++i) {
+        if (mesh_visibility[i] == MESH_VISIBILITY_VISIBLE && can_occlude(i)) {
+            areas[i] = get_screen_area(buildings_model.meshes[i].bounds, mvp, NEAR_PLANE);
+            candidates[candidate_count++] = i;
+        }
+    }
+
+    uint occluder_count = MIN(static_cast<uint>(MAX(global::occluder_count, 0)), candidate_count);
+
+    std::partial_sort(candidates, candidates + occluder_count, candidates + candidate_count, [&](uint a, uint b) {
+        return areas[a] > areas[b] || (areas[a] == areas[b] && a < b);
+    });
+
+    // Drawn in mesh order, like the passes themselves
+    std::sort(candidates, candidates + occluder_count);
+
+    for (uint i = 0; i < occluder_count; ++i) {
+        mesh_visibility[candidates[i]] = MESH_VISIBILITY_OCCLUDER;
+        push_draw(candidates[i]);
+    }
+
+    submit_draws();
+
+    storage.end_scope(scope);
+
+    if (pyramid.width != target.width || pyramid.height != target.height) {
+        pyramid.resize(target.width, target.height);
+    }
+
+    pyramid.build(target.distance_texture, 0, depth_pyramid_shader, empty_vertex_array);
+
+    for (uint i = 0; i < mesh_count; ++i) {
+        if (mesh_visibility[i] == MESH_VISIBILITY_VISIBLE &&
+            pyramid.is_occluded(buildings_model.meshes[i].bounds, mvp, NEAR_PLANE)) {
+            mesh_visibility[i] = MESH_VISIBILITY_OCCLUDED;
+        }
+    }
+
+    return occluder_count;
+}
 
-    // Picking shader update
-    set_mvp_uniform(picking_shader);
+// --------------------------------------------------------------------------------
 
-    // Indices shader update
-    //set_mvp_uniform(indices_shader);
+void update() {
+    update_mvp();
+    set_frame_uniforms();
 }
 
 // --------------------------------------------------------------------------------
@@ -173,8 +918,8 @@ void render_picking_geojson() {
     size_t mesh_count = buildings_model.meshes.size() + flat_model.meshes.size();
 
     for (size_t i = 0; i < buildings_model.meshes.size(); ++i) {
-        picking_shader.set_uniform_1ui("uObjectIndex", i + 2);
-        picking_shader.set_uniform_1ui("uObjectCount", mesh_count);
+        picking_shader.set_uniform_1ui(UNIFORM_OBJECT_INDEX, i + 2);
+        picking_shader.set_uniform_1ui(UNIFORM_OBJECT_COUNT, mesh_count);
 
         buildings_model.meshes[i].vertex_array.bind();
         GL_CALL(glDrawElements(GL_TRIANGLES, buildings_model.meshes[i].indices.size(), GL_UNSIGNED_INT, nullptr));
@@ -183,8 +928,8 @@ void render_picking_geojson() {
 
     // TODO(paalf): remove this
     for (size_t i = 0; i < flat_model.meshes.size(); ++i) {
-        picking_shader.set_uniform_1ui("uObjectIndex", 1);
-        picking_shader.set_uniform_1ui("uObjectCount", mesh_count);
+        picking_shader.set_uniform_1ui(UNIFORM_OBJECT_INDEX, 1);
+        picking_shader.set_uniform_1ui(UNIFORM_OBJECT_COUNT, mesh_count);
 
         flat_model.meshes[i].vertex_array.bind();
         GL_CALL(glDrawElements(GL_TRIANGLES, flat_model.meshes[i].indices.size(), GL_UNSIGNED_INT, nullptr));
@@ -218,10 +963,10 @@ void render_geojson() {
 
         if (mesh.type == MESH_TYPE_FLAT) {
             flat_shader.bind();
-            flat_shader.set_uniform_vec4("uColor", mesh_color);
+            flat_shader.set_uniform_vec4(UNIFORM_COLOR, mesh_color);
         } else {
             buildings_shader.bind();
-            buildings_shader.set_uniform_vec4("uColor", mesh_color);
+            buildings_shader.set_uniform_vec4(UNIFORM_COLOR, mesh_color);
         }
 
         mesh.vertex_array.bind();
@@ -245,7 +990,7 @@ void render_geojson() {
         }
 
         flat_shader.bind();
-        flat_shader.set_uniform_vec4("uColor", mesh_color);
+        flat_shader.set_uniform_vec4(UNIFORM_COLOR, mesh_color);
 
         mesh.vertex_array.bind();
         GL_CALL(glDrawElements(GL_TRIANGLES, mesh.indices.size(), GL_UNSIGNED_INT, nullptr));
@@ -253,40 +998,32 @@ void render_geojson() {
     }
 }
 
-void render_picking_collada() {
+void render_picking_collada(const Frustum &frustum) {
     global::picking_buffer.bind();
 
     clear(COLOR_BLACK);
 
-    picking_shader.bind();
+    Culling_Stats &stats = global::culling_stats[RENDER_PASS_PICKING];
 
-    size_t idx_count = building_indices.size();
-    uint idx;
+    if (use_gpu_culling(false)) {
+        cull_draw_list(DRAW_LIST_PICKING, frustum, RENDER_PASS_PICKING);
 
-    glm::vec3 mesh_color;
-    int actual_r, actual_g, actual_b;
-
-    for (size_t i = 0; i < idx_count; ++i) {
-        idx = building_indices[i];
-        const auto &building_mesh = buildings_model.meshes[idx];
+        picking_shader.bind();
+        submit_culled_draws(DRAW_LIST_PICKING);
+    } else {
+        picking_shader.bind();
 
-        actual_r = (i + 1) % 256;
-        actual_g = ((i + 1) / 256) % 256;
-        actual_b = ((i + 1) / (256 * 256)) % 256;
+        cull_meshes(frustum);
 
-        mesh_color.r = actual_r / 255.0f;
-        mesh_color.g = actual_g / 255.0f;
-        mesh_color.b = actual_b / 255.0f;
+        stats = {};
 
-        if (i + 1 == global::picked_id) {
-            global::picked_mesh_idx = idx;
+        for (auto idx : building_indices) {
+            if (is_visible(idx, stats)) {
+                push_draw(idx);
+            }
         }
 
-        picking_shader.set_uniform_vec3("uObjectColor", mesh_color);
-
-        building_mesh.vertex_array.bind();
-        GL_CALL(glDrawElements(GL_TRIANGLES, building_mesh.indices.size(), GL_UNSIGNED_INT, nullptr));
-        building_mesh.vertex_array.unbind();
+        submit_draws();
     }
 
     global::picking_buffer.unbind();
@@ -295,51 +1032,131 @@ void render_picking_collada() {
 void render_indices_collada() {
     global::indices_buffer.bind();
 
-    clear(COLOR_BLACK);
+    // Anything not covered by a mesh is sky at the far plane
+    global::indices_buffer.clear(INDICES_CLASS_SKY, FAR_PLANE);
+
+    Culling_Stats &stats = global::culling_stats[RENDER_PASS_INDICES];
+    stats = {};
+
+    if (use_gpu_culling(true)) {
+        cull_draw_list(DRAW_LIST_INDICES, get_frustum(), RENDER_PASS_INDICES);
+
+        indices_shader.bind();
+        submit_culled_draws(DRAW_LIST_INDICES);
+
+        global::indices_buffer.unbind();
+        return;
+    }
 
     indices_shader.bind();
 
-    for (auto idx : building_indices) {
-        const auto &building_mesh = buildings_model.meshes[idx];
+    cull_meshes(get_frustum());
+
+    if (global::occlusion_culling) {
+        stats.drawn += occlusion_cull_meshes(indices_pyramid, global::indices_buffer, [](uint idx) {
+            return mesh_classes[idx] != INDICES_CLASS_SKY;
+        });
+
+        indices_shader.bind();
+    }
+
+    // The class ids come with the draw data, so the whole scene is a single draw
+    record_visible_meshes(stats);
+    submit_draws();
+
+    global::indices_buffer.unbind();
+}
+
+// Depth pre-pass of the whole scene, then every class bucket again with an equal depth test
+// inside a samples-passed query, so 'queries[c]' ends up counting the pixels of class c.
+// 'queries[INDICES_CLASS_SKY]' is unused, the sky is whatever is left.
+void render_indices_queries_collada(const uint *queries) {
+    global::indices_buffer.bind();
+
+    global::indices_buffer.clear(INDICES_CLASS_SKY, FAR_PLANE);
+
+    // Only the pre-pass is counted, the query pass draws the same meshes
+    Culling_Stats &stats = global::culling_stats[RENDER_PASS_INDICES];
+    stats = {};
 
-        if (building_mesh.type == MESH_TYPE_BUILDING) {
-            indices_shader.set_uniform_vec3("uObjectColor", COLOR_RED);
+    Culling_Stats query_stats = {};
+
+    bool culled_on_gpu = use_gpu_culling(false);
+
+    if (culled_on_gpu) {
+        cull_draw_list(DRAW_LIST_CLASSES, get_frustum(), RENDER_PASS_INDICES);
+    } else {
+        cull_meshes(get_frustum());
+    }
+
+    indices_shader.bind();
+
+    GL_CALL(glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
+
+    if (culled_on_gpu) {
+        submit_culled_draws(DRAW_LIST_CLASSES);
+    } else {
+        for (uint i = INDICES_CLASS_SKY + 1; i < INDICES_CLASS_COUNT; ++i) {
+            record_class_meshes(i, stats);
         }
 
-        if (building_mesh.type == MESH_TYPE_AMENITY) {
-            indices_shader.set_uniform_vec3("uObjectColor", COLOR_YELLOW);
+        submit_draws();
+    }
+
+    // Same program and vertices as the pre-pass, so the depths match exactly. The class ids are
+    // still written so the frame buffer can be inspected or verified.
+    GL_CALL(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
+    GL_CALL(glDepthFunc(GL_EQUAL));
+    GL_CALL(glDepthMask(GL_FALSE));
+
+    for (uint i = INDICES_CLASS_SKY + 1; i < INDICES_CLASS_COUNT; ++i) {
+        if (!culled_on_gpu) {
+            record_class_meshes(i, query_stats);
         }
 
-        if (building_mesh.type == MESH_TYPE_LANDMARK) {
-            indices_shader.set_uniform_vec3("uObjectColor", COLOR_FUCHSIA);
+        GL_CALL(glBeginQuery(GL_SAMPLES_PASSED, queries[i]));
+
+        if (culled_on_gpu) {
+            submit_culled_draws(class_list_offsets[i], class_list_offsets[i + 1] - class_list_offsets[i]);
+        } else {
+            submit_draws();
         }
 
-        building_mesh.vertex_array.bind();
-        GL_CALL(glDrawElements(GL_TRIANGLES, building_mesh.indices.size(), GL_UNSIGNED_INT, nullptr));
-        building_mesh.vertex_array.unbind();
+        GL_CALL(glEndQuery(GL_SAMPLES_PASSED));
     }
 
-    for (auto idx : tree_indices) {
-        const auto &tree_mesh = buildings_model.meshes[idx];
+    GL_CALL(glDepthMask(GL_TRUE));
+    GL_CALL(glDepthFunc(GL_LESS));
 
-        indices_shader.set_uniform_vec3("uObjectColor", COLOR_GREEN);
+    global::indices_buffer.unbind();
+}
 
-        tree_mesh.vertex_array.bind();
-        GL_CALL(glDrawElements(GL_TRIANGLES, tree_mesh.indices.size(), GL_UNSIGNED_INT, nullptr));
-        tree_mesh.vertex_array.unbind();
-    }
+// Same as 'render_indices_collada', but every mesh is drawn once per view, each instance
+// landing in its own layer of the indices frame buffer
+void render_indices_batch_collada(uint view_count, const Indices_Frame_Buffer &target) {
+    target.bind();
 
-    for (auto idx : water_indices) {
-        const auto &water_mesh = buildings_model.meshes[idx];
+    target.clear(INDICES_CLASS_SKY, FAR_PLANE);
 
-        indices_shader.set_uniform_vec3("uObjectColor", COLOR_BLUE);
+    Culling_Stats &stats = global::culling_stats[RENDER_PASS_INDICES];
+    stats = {};
 
-        water_mesh.vertex_array.bind();
-        GL_CALL(glDrawElements(GL_TRIANGLES, water_mesh.indices.size(), GL_UNSIGNED_INT, nullptr));
-        water_mesh.vertex_array.unbind();
+    if (use_gpu_culling(false)) {
+        cull_draw_list(DRAW_LIST_INDICES, batch_frusta, batch_frustum_count, RENDER_PASS_INDICES, view_count);
+
+        indices_batch_shader.bind();
+
+        submit_culled_draws(DRAW_LIST_INDICES);
+    } else {
+        indices_batch_shader.bind();
+
+        cull_meshes(batch_frusta, batch_frustum_count);
+
+        record_visible_meshes(stats, view_count);
+        submit_draws();
     }
 
-    global::indices_buffer.unbind();
+    target.unbind();
 }
 
 /*
@@ -363,27 +1180,64 @@ void render_position_collada() {
 */
 
 void render_collada() {
-    buildings_shader.bind();
+    if (use_gpu_culling(true)) {
+        cull_draw_list(DRAW_LIST_SCENE, get_frustum(), RENDER_PASS_VIEWER);
 
-    clear(COLOR_SLATE);
+        buildings_shader.bind();
+        buildings_shader.set_uniform_1i(UNIFORM_PICKED_MESH, global::picked_mesh_idx);
+        buildings_shader.set_uniform_vec4(UNIFORM_PICKED_COLOR, COLOR_RED);
 
-    size_t mesh_count = buildings_model.meshes.size();
-    size_t idx_count = building_indices.size();
+        clear(COLOR_SLATE);
 
-    for (size_t i = 0; i < mesh_count; ++i) {
-        const auto &mesh = buildings_model.meshes[i];
+        submit_culled_draws(DRAW_LIST_SCENE);
+        return;
+    }
 
-        glm::vec4 mesh_color = mesh.color;
-        if (global::picked_mesh_idx == i) {
-            mesh_color = COLOR_RED;
+    cull_meshes(get_frustum());
+
+    Culling_Stats &stats = global::culling_stats[RENDER_PASS_VIEWER];
+    stats = {};
+
+    if (global::occlusion_culling) {
+        if (occluder_buffer.id == 0) {
+            occluder_buffer = make_indices_frame_buffer();
+            occluder_buffer.init(window::width, window::height);
+        } else if (occluder_buffer.width != window::width || occluder_buffer.height != window::height) {
+            occluder_buffer.resize(window::width, window::height);
         }
 
-        buildings_shader.set_uniform_vec4("uColor", mesh_color);
+        occluder_buffer.bind();
+        occluder_buffer.clear(INDICES_CLASS_SKY, FAR_PLANE);
 
-        mesh.vertex_array.bind();
-        GL_CALL(glDrawElements(GL_TRIANGLES, mesh.indices.size(), GL_UNSIGNED_INT, nullptr));
-        mesh.vertex_array.unbind();
+        indices_shader.bind();
+
+        occlusion_cull_meshes(viewer_pyramid, occluder_buffer, [](uint) { return true; });
+
+        occluder_buffer.unbind();
+
+        // The occluders only made it into the depth pyramid so far
+        for (auto &visibility : mesh_visibility) {
+            if (visibility == MESH_VISIBILITY_OCCLUDER) {
+                visibility = MESH_VISIBILITY_VISIBLE;
+            }
+        }
+    }
+
+    buildings_shader.bind();
+    buildings_shader.set_uniform_1i(UNIFORM_PICKED_MESH, global::picked_mesh_idx);
+    buildings_shader.set_uniform_vec4(UNIFORM_PICKED_COLOR, COLOR_RED);
+
+    clear(COLOR_SLATE);
+
+    uint mesh_count = static_cast<uint>(buildings_model.meshes.size());
+
+    for (uint i = 0; i < mesh_count; ++i) {
+        if (is_visible(i, stats)) {
+            push_draw(i);
+        }
     }
+
+    submit_draws();
 }
 
 // --------------------------------------------------------------------------------
@@ -399,11 +1253,61 @@ void render() {
 void render_picking() {
     switch (mode) {
     case RENDER_MODE_GEOJSON: render_picking_geojson(); break;
-    case RENDER_MODE_COLLADA: render_picking_collada(); break;
+    case RENDER_MODE_COLLADA: render_picking_collada(get_frustum()); break;
     default:                  LOG_ERROR("Unknown render mode.");
     }
 }
 
+// Picks whatever is under a click, (x_pos, y_pos) being in framebuffer pixels from the bottom left.
+// Only that pixel of the picking buffer is rendered, scissored, and for the collada scene the meshes
+// are culled against the frustum of the pixel alone, so a click costs a handful of draws.
+void pick(int x_pos, int y_pos) {
+    const Frame_Buffer &picking_buffer = global::picking_buffer;
+
+    if (x_pos < 0 || y_pos < 0 || x_pos >= picking_buffer.width || y_pos >= picking_buffer.height) {
+        return;
+    }
+
+    GL_CALL(glEnable(GL_SCISSOR_TEST));
+    GL_CALL(glScissor(x_pos, y_pos, 1, 1));
+
+    switch (mode) {
+    case RENDER_MODE_GEOJSON: {
+        render_picking_geojson();
+    } break;
+    case RENDER_MODE_COLLADA: {
+        glm::vec2  center   = glm::vec2(x_pos + 0.5f, y_pos + 0.5f);
+        glm::ivec4 viewport = glm::ivec4(0, 0, picking_buffer.width, picking_buffer.height);
+
+        Frustum frustum;
+        frustum.init(glm::pickMatrix(center, glm::vec2(1.0f), viewport) * projection * view * model);
+
+        render_picking_collada(frustum);
+    } break;
+    default: LOG_ERROR("Unknown render mode.");
+    }
+
+    GL_CALL(glDisable(GL_SCISSOR_TEST));
+
+    int picked_id = picking_buffer.read_pixel(x_pos, y_pos);
+
+    // Picking the selection again, or nothing, clears it
+    if (global::picked_id == picked_id || picked_id == 0) {
+        global::picked_id = -1;
+        global::picked_mesh_idx = -1;
+        return;
+    }
+
+    global::picked_id = picked_id;
+
+    // The picking id of each building is one past its position in 'building_indices'
+    if (mode == RENDER_MODE_COLLADA && static_cast<size_t>(picked_id) <= building_indices.size()) {
+        global::picked_mesh_idx = building_indices[picked_id - 1];
+    } else {
+        global::picked_mesh_idx = -1;
+    }
+}
+
 void render_indices() {
     switch (mode) {
     //case RENDER_MODE_GEOJSON: render_indices_geojson(); break;
@@ -412,6 +1316,165 @@ void render_indices() {
     }
 }
 
+void render_indices_queries(const uint *queries) {
+    switch (mode) {
+    case RENDER_MODE_COLLADA: render_indices_queries_collada(queries); break;
+    default:                  LOG_ERROR("Unknown render mode.");
+    }
+}
+
+void render_indices_batch(uint view_count, const Indices_Frame_Buffer &target = global::indices_buffer) {
+    switch (mode) {
+    case RENDER_MODE_COLLADA: render_indices_batch_collada(view_count, target); break;
+    default:                  LOG_ERROR("Unknown render mode.");
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+// Renders the cube faces of a panorama, one per layer of 'panorama', in a single batch
+void render_panorama(const Indices_Frame_Buffer &panorama, const glm::mat4 *face_views, uint face_count) {
+    glm::mat4 face_projection = glm::perspective(glm::radians(90.0f), 1.0f, NEAR_PLANE, FAR_PLANE);
+
+    set_batch_uniforms(face_views, face_count, face_projection);
+
+    GL_CALL(glViewport(0, 0, panorama.width, panorama.height));
+    render_indices_batch(face_count, panorama);
+    GL_CALL(glViewport(0, 0, global::indices_buffer.width, global::indices_buffer.height));
+}
+
+// Fills layer 0 of the indices frame buffer with what the current camera would have rendered,
+// looked up in the panorama captured at its position
+void resample_panorama(const Indices_Frame_Buffer &panorama, const glm::mat3 *face_rotations) {
+    float tan_half_fov_y = tanf(glm::radians(camera::zoom) * 0.5f);
+    float aspect_ratio = static_cast<float>(global::indices_buffer.width) / global::indices_buffer.height;
+
+    global::indices_buffer.bind();
+
+    // Every pixel is written, and the triangle's winding must not matter
+    bool culling = glIsEnabled(GL_CULL_FACE);
+    GL_CALL(glDisable(GL_CULL_FACE));
+    GL_CALL(glDisable(GL_DEPTH_TEST));
+
+    panorama_shader.bind();
+    panorama_shader.set_uniform_1i(UNIFORM_PANORAMA_CLASSES, 0);
+    panorama_shader.set_uniform_1i(UNIFORM_PANORAMA_DISTANCES, 1);
+    panorama_shader.set_uniform_mat3v(UNIFORM_FACE_ROTATIONS, face_rotations, 6);
+    panorama_shader.set_uniform_vec3(UNIFORM_FRONT, camera::front);
+    panorama_shader.set_uniform_vec3(UNIFORM_RIGHT, camera::right);
+    panorama_shader.set_uniform_vec3(UNIFORM_UP, camera::up);
+    panorama_shader.set_uniform_vec2(UNIFORM_TAN_HALF_FOV, glm::vec2(aspect_ratio * tan_half_fov_y, tan_half_fov_y));
+    panorama_shader.set_uniform_vec2(UNIFORM_VIEWPORT_SIZE, glm::vec2(global::indices_buffer.width, global::indices_buffer.height));
+    panorama_shader.set_uniform_1f(UNIFORM_FAR, FAR_PLANE);
+
+    GL_CALL(glActiveTexture(GL_TEXTURE0));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, panorama.class_texture));
+    GL_CALL(glActiveTexture(GL_TEXTURE1));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, panorama.distance_texture));
+
+    empty_vertex_array.bind();
+    GL_CALL(glDrawArrays(GL_TRIANGLES, 0, 3));
+    empty_vertex_array.unbind();
+
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+    GL_CALL(glActiveTexture(GL_TEXTURE0));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+
+    GL_CALL(glEnable(GL_DEPTH_TEST));
+    if (culling) {
+        GL_CALL(glEnable(GL_CULL_FACE));
+    }
+
+    global::indices_buffer.unbind();
+}
+
+// --------------------------------------------------------------------------------
+
+#ifndef HEADLESS_MODE
+// Frames still drawn once nothing changes anymore, the menu takes one more to settle after an input
+#define REDRAW_FRAMES 2
+
+View_State           last_view_state      = {};
+uint                 redraw_frames        = 0;
+
+View_State get_view_state() {
+    View_State ret = {};
+
+    ret.camera_position = camera::position;
+    ret.camera_front = camera::front;
+    ret.camera_zoom = camera::zoom;
+
+    ret.light_position = global::light_position;
+    ret.light_color = global::light_color;
+
+    ret.picked_id = global::picked_id;
+    ret.picked_mesh_idx = global::picked_mesh_idx;
+
+    ret.config_flags = global::config_flags;
+    ret.show_menu = global::show_menu;
+    ret.show_debug_menu = global::show_debug_menu;
+
+    ret.width = window::width;
+    ret.height = window::height;
+
+    return ret;
+}
+
+// Compares the current state against the one of the last call
+Dirty_Flags get_dirty_flags() {
+    View_State cur = get_view_state();
+    const View_State &last = last_view_state;
+
+    Dirty_Flags ret = 0;
+
+    if (cur.camera_position != last.camera_position || cur.camera_front != last.camera_front ||
+        cur.camera_zoom != last.camera_zoom) {
+        SET_FLAG(ret, DIRTY_FLAGS_CAMERA);
+    }
+
+    if (cur.light_position != last.light_position || cur.light_color != last.light_color) {
+        SET_FLAG(ret, DIRTY_FLAGS_LIGHT);
+    }
+
+    if (cur.picked_id != last.picked_id || cur.picked_mesh_idx != last.picked_mesh_idx) {
+        SET_FLAG(ret, DIRTY_FLAGS_PICKED);
+    }
+
+    if (cur.config_flags != last.config_flags || cur.show_menu != last.show_menu ||
+        cur.show_debug_menu != last.show_debug_menu) {
+        SET_FLAG(ret, DIRTY_FLAGS_CONFIG);
+    }
+
+    if (cur.width != last.width || cur.height != last.height) {
+        SET_FLAG(ret, DIRTY_FLAGS_WINDOW);
+    }
+
+    if (window::input_received) {
+        SET_FLAG(ret, DIRTY_FLAGS_INPUT);
+        window::input_received = false;
+    }
+
+    last_view_state = cur;
+
+    return ret;
+}
+
+// Whether the next frame would differ from the one on screen, the main loop waits for events
+// instead of drawing it when it would not
+bool needs_redraw() {
+    if (get_dirty_flags() != 0) {
+        redraw_frames = REDRAW_FRAMES;
+    }
+
+    if (redraw_frames == 0) {
+        return false;
+    }
+
+    --redraw_frames;
+
+    return true;
+}
+
 // --------------------------------------------------------------------------------
 
 void render_menu() {
@@ -422,11 +1485,14 @@ void render_menu() {
 }
 
 void render_debug_menu() {
+    update_gpu_culling_stats();
+
     menu::setup_debug();
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
+#endif // HEADLESS_MODE
 } // namespace renderer
 
 // --------------------------------------------------------------------------------
@@ -42,9 +42,16 @@ float       center_y;
 float       delta_time    = 0.0f;
 float       last_frame    = 0.0f;
 
+bool        vsync         = true;
+
+// Set by every event the menu may react to, cleared by the renderer once it has seen it
+bool        input_received = false;
+
 // --------------------------------------------------------------------------------
 
 void framebuffer_size_callback(GLFWwindow *window, int win_width, int win_height) {
+    input_received = true;
+
     width = win_width;
     height = win_height;
     aspect_ratio = static_cast<float>(width) / height;
@@ -55,7 +62,13 @@ void framebuffer_size_callback(GLFWwindow *window, int win_width, int win_height
     glfwSetCursorPos(window, center_x, center_y);
 
     global::picking_buffer.resize(win_width, win_height);
-    global::indices_buffer.resize(win_width, win_height);
+
+    // An offscreen indices target keeps its own resolution, and a running computation keeps the
+    // one it began with, the next one resizes the target itself
+    if (global::indices_resolution == INDICES_RESOLUTION_WINDOW && !global::indices_progress.running) {
+        global::indices_buffer.resize(win_width, win_height);
+    }
+
     global::position_buffer.resize(win_width, win_height, true);
 
     glViewport(0, 0, width, height);
@@ -79,10 +92,15 @@ void mouse_callback(GLFWwindow *window, double x_pos_in, double y_pos_in) {
         glfwSetCursorPos(window, center_x, center_y);
     } else {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+
+        // Only hovering the menu, moving the camera is caught by the renderer's dirty tracking
+        input_received = true;
     }
 }
 
 void mouse_button_callback(GLFWwindow *window, int button, int action, int mods) {
+    input_received = true;
+
     if (!global::show_menu) {
         if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
             double x_pos_in;
@@ -95,13 +113,10 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 
             if (!HAS_FLAG(global::config_flags, CONFIG_FLAGS_CONTROL_CAMERA) &&
                 !HAS_FLAG(global::config_flags, CONFIG_FLAGS_SHOW_POPUP)) {
-                int tmp = global::picking_buffer.read_pixel(x_pos, height - y_pos - 1);
-                if (global::picked_id == tmp || tmp == 0) {
-                    global::picked_id = -1;
-                    global::picked_mesh_idx = -1;
-                } else {
-                    global::picked_id = tmp;
-                }
+                // Resolved by the renderer next frame, it only renders the picking pass for a click
+                global::pick_pending = true;
+                global::pick_x       = x_pos;
+                global::pick_y       = height - y_pos - 1;
             }
         }
 
@@ -113,11 +128,21 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 }
 
 void scroll_callback(GLFWwindow *window, double x_offset, double y_offset) {
+    input_received = true;
+
     if (!global::show_menu && HAS_FLAG(global::config_flags, CONFIG_FLAGS_CONTROL_CAMERA)) {
         camera::process_mouse_scroll(static_cast<float>(y_offset));
     }
 }
 
+void key_callback(GLFWwindow *, int, int, int, int) {
+    input_received = true;
+}
+
+void window_refresh_callback(GLFWwindow *) {
+    input_received = true;
+}
+
 // --------------------------------------------------------------------------------
 
 void process_input() {
@@ -162,6 +187,11 @@ void shutdown() {
     glfwTerminate();
 }
 
+void set_vsync(bool enable) {
+    glfwSwapInterval(enable);
+    vsync = enable;
+}
+
 void init(const char *title, int win_width, int win_height, const char *icon_path, bool enable_vsync = true) {
     if (glfwInit() == GLFW_FALSE) {
         LOG_ERROR("Failed to initialize GLFW.");
@@ -176,6 +206,10 @@ void init(const char *title, int win_width, int win_height, const char *icon_pat
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, true);
 #endif
 
+#ifdef DEBUG_MODE
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true);
+#endif // DEBUG_MODE
+
     handle = glfwCreateWindow(win_width, win_height, title, nullptr, nullptr);
     if (handle == nullptr) {
         const char *description = nullptr;
@@ -198,10 +232,12 @@ void init(const char *title, int win_width, int win_height, const char *icon_pat
     glfwSetCursorPosCallback(handle, mouse_callback);
     glfwSetMouseButtonCallback(handle, mouse_button_callback);
     glfwSetScrollCallback(handle, scroll_callback);
+    glfwSetKeyCallback(handle, key_callback);
+    glfwSetWindowRefreshCallback(handle, window_refresh_callback);
 
     glfwSetInputMode(handle, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-    glfwSwapInterval(enable_vsync);
+    set_vsync(enable_vsync);
 
     GLFWimage icons[1];
     icons[0].pixels = stbi_load(icon_path, &icons[0].width, &icons[0].height, 0, 4);
@@ -222,6 +258,14 @@ void update() {
     glfwPollEvents();
 }
 
+// Blocks until an event comes in or the timeout runs out. The camera timer restarts after it, the
+// time spent waiting is no movement step.
+void wait_events(double timeout) {
+    glfwWaitEventsTimeout(timeout);
+
+    last_frame = static_cast<float>(glfwGetTime());
+}
+
 bool closed() {
     return glfwWindowShouldClose(handle);
 }
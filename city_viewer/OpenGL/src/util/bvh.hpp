@@ -0,0 +1,624 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include "geometry.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include <limits.h>
+
+// --------------------------------------------------------------------------------
+
+#define BVH_BIN_COUNT          16
+#define BVH_MAX_DEPTH          64
+
+// Past this depth the builder falls back to median splits, which bounds the total depth
+#define BVH_MEDIAN_SPLIT_DEPTH 32
+
+// Subtrees with fewer primitives than this are never handed to another thread
+#define BVH_PARALLEL_MIN_PRIMS 4096
+
+#define BVH_MESH_LEAF_SIZE     4
+#define BVH_TRIANGLE_LEAF_SIZE 8
+
+// --------------------------------------------------------------------------------
+
+float get_half_area(const AABB &box) {
+    glm::vec3 size = box.max - box.min;
+
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+bool aabbs_overlap(const AABB &a, const AABB &b) {
+    return (a.min.x <= b.max.x && a.max.x >= b.min.x &&
+            a.min.y <= b.max.y && a.max.y >= b.min.y &&
+            a.min.z <= b.max.z && a.max.z >= b.min.z);
+}
+
+bool sphere_overlaps_aabb(glm::vec3 center, float radius, const AABB &box) {
+    glm::vec3 closest = glm::clamp(center, box.min, box.max);
+    glm::vec3 delta = center - closest;
+
+    return glm::dot(delta, delta) <= radius * radius;
+}
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    glm::vec3 inv_direction;
+    bool      negative[3];
+};
+
+Ray make_ray(glm::vec3 origin, glm::vec3 direction) {
+    Ray ret;
+    ret.origin = origin;
+    ret.direction = direction;
+    ret.inv_direction = 1.0f / direction;
+
+    for (int i = 0; i < 3; ++i) {
+        ret.negative[i] = direction[i] < 0.0f;
+    }
+
+    return ret;
+}
+
+// Slab test, 't_near' is clamped to 0 when the origin is inside the box
+bool intersect_ray_aabb(const Ray &ray, const AABB &box, float max_t, float &t_near) {
+    glm::vec3 t0 = (box.min - ray.origin) * ray.inv_direction;
+    glm::vec3 t1 = (box.max - ray.origin) * ray.inv_direction;
+
+    glm::vec3 t_min = glm::min(t0, t1);
+    glm::vec3 t_max = glm::max(t0, t1);
+
+    float enter = MAX(MAX(t_min.x, t_min.y), MAX(t_min.z, 0.0f));
+    float exit = MIN(MIN(t_max.x, t_max.y), MIN(t_max.z, max_t));
+
+    t_near = enter;
+
+    return enter <= exit;
+}
+
+// Moller-Trumbore, culls nothing since the city meshes are not consistently wound
+bool intersect_ray_triangle(const Ray &ray, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, float max_t, float &t) {
+    glm::vec3 edge1 = v1 - v0;
+    glm::vec3 edge2 = v2 - v0;
+
+    glm::vec3 p = glm::cross(ray.direction, edge2);
+    float det = glm::dot(edge1, p);
+
+    if (fabsf(det) < 1e-8f) {
+        return false;
+    }
+
+    float inv_det = 1.0f / det;
+
+    glm::vec3 s = ray.origin - v0;
+    float u = glm::dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f) {
+        return false;
+    }
+
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(ray.direction, q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) {
+        return false;
+    }
+
+    t = glm::dot(edge2, q) * inv_det;
+
+    return t >= 0.0f && t < max_t;
+}
+
+// --------------------------------------------------------------------------------
+
+// 32 bytes, two nodes per cache line. Nodes are stored depth first, so the first child of an
+// interior node is always the node right after it.
+struct BVH_Node {
+    AABB     bounds;
+
+    // Leaves: first primitive in 'prim_indices', interior nodes: index of the second child
+    uint     offset;
+
+    uint16_t prim_count; // 0 for interior nodes
+    uint16_t axis;       // Split axis, used to visit the nearest child first along a ray
+};
+
+struct _BVH_Build_Input {
+    const AABB      *boxes;
+    const glm::vec3 *centroids;
+    uint            *prims;
+    uint             max_leaf_size;
+};
+
+struct _BVH_Bin {
+    AABB bounds;
+    uint count;
+};
+
+void _append_subtree(std::vector<BVH_Node> &dst, const std::vector<BVH_Node> &src) {
+    uint base = static_cast<uint>(dst.size());
+
+    for (BVH_Node node : src) {
+        if (node.prim_count == 0) {
+            node.offset += base;
+        }
+
+        dst.push_back(node);
+    }
+}
+
+// Binned SAH over the centroids of [begin, end). Up to 'thread_budget' threads build subtrees
+// in parallel, into their own node arrays that are appended in depth first order afterwards,
+// so the result does not depend on the thread count.
+void _build_bvh_node(std::vector<BVH_Node> &dst, const _BVH_Build_Input &input,
+                     uint begin, uint end, uint depth, uint thread_budget) {
+    uint count = end - begin;
+
+    AABB bounds, centroid_bounds;
+    for (uint i = begin; i < end; ++i) {
+        const AABB &box = input.boxes[input.prims[i]];
+
+        bounds.extend(box.min);
+        bounds.extend(box.max);
+        centroid_bounds.extend(input.centroids[input.prims[i]]);
+    }
+
+    uint node_idx = static_cast<uint>(dst.size());
+    dst.push_back({bounds, begin, static_cast<uint16_t>(count), 0});
+
+    if (count == 1) {
+        return;
+    }
+
+    glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+
+    uint axis = 0;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    // All centroids coincide, nothing to split on
+    if (extent[axis] <= 0.0f) {
+        if (count <= input.max_leaf_size) {
+            return;
+        }
+
+        axis = 0;
+    }
+
+    uint mid = begin + count / 2;
+    bool median_split = true;
+
+    if (depth < BVH_MEDIAN_SPLIT_DEPTH && extent[axis] > 0.0f) {
+        float best_cost = FLT_MAX;
+        uint best_axis = axis;
+        uint best_bin = 0;
+
+        for (uint a = 0; a < 3; ++a) {
+            if (extent[a] <= 0.0f) {
+                continue;
+            }
+
+            _BVH_Bin bins[BVH_BIN_COUNT] = {};
+            float scale = BVH_BIN_COUNT / extent[a];
+
+            for (uint i = begin; i < end; ++i) {
+                uint prim = input.prims[i];
+                uint bin = static_cast<uint>((input.centroids[prim][a] - centroid_bounds.min[a]) * scale);
+                bin = MIN(bin, BVH_BIN_COUNT - 1);
+
+                bins[bin].bounds.extend(input.boxes[prim].min);
+                bins[bin].bounds.extend(input.boxes[prim].max);
+                ++bins[bin].count;
+            }
+
+            // Sweep from the right to get the area and count of every right hand side
+            float right_areas[BVH_BIN_COUNT];
+            uint right_counts[BVH_BIN_COUNT];
+
+            AABB right;
+            uint right_count = 0;
+            for (int i = BVH_BIN_COUNT - 1; i > 0; --i) {
+                if (bins[i].count > 0) {
+                    right.extend(bins[i].bounds.min);
+                    right.extend(bins[i].bounds.max);
+                }
+
+                right_count += bins[i].count;
+                right_areas[i] = right_count > 0 ? get_half_area(right) : 0.0f;
+                right_counts[i] = right_count;
+            }
+
+            AABB left;
+            uint left_count = 0;
+            for (uint i = 0; i < BVH_BIN_COUNT - 1; ++i) {
+                if (bins[i].count > 0) {
+                    left.extend(bins[i].bounds.min);
+                    left.extend(bins[i].bounds.max);
+                }
+
+                left_count += bins[i].count;
+                if (left_count == 0 || right_counts[i + 1] == 0) {
+                    continue;
+                }
+
+                float cost = get_half_area(left) * left_count + right_areas[i + 1] * right_counts[i + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_bin = i;
+                }
+            }
+        }
+
+        // Cost of a leaf against one traversal step plus the children, relative to this node's area
+        float leaf_cost = static_cast<float>(count);
+        float split_cost = 1.0f + best_cost / MAX(get_half_area(bounds), FLT_MIN);
+
+        if (count <= input.max_leaf_size && leaf_cost <= split_cost) {
+            return;
+        }
+
+        if (best_cost < FLT_MAX) {
+            axis = best_axis;
+
+            float scale = BVH_BIN_COUNT / extent[axis];
+            float min = centroid_bounds.min[axis];
+
+            uint *split = std::partition(input.prims + begin, input.prims + end, [&](uint prim) {
+                uint bin = static_cast<uint>((input.centroids[prim][axis] - min) * scale);
+                return MIN(bin, BVH_BIN_COUNT - 1) <= best_bin;
+            });
+
+            mid = static_cast<uint>(split - input.prims);
+            median_split = false;
+        }
+    } else if (count <= input.max_leaf_size) {
+        return;
+    }
+
+    // Median split, either forced by depth or because no bin boundary separates the centroids
+    if (median_split) {
+        std::nth_element(input.prims + begin, input.prims + mid, input.prims + end, [&](uint a, uint b) {
+            return input.centroids[a][axis] < input.centroids[b][axis];
+        });
+    }
+
+    dst[node_idx].prim_count = 0;
+    dst[node_idx].axis = static_cast<uint16_t>(axis);
+
+    if (thread_budget > 1 && count >= BVH_PARALLEL_MIN_PRIMS) {
+        std::vector<BVH_Node> left_nodes, right_nodes;
+
+        uint left_budget = thread_budget / 2;
+        uint right_budget = thread_budget - left_budget;
+
+        std::thread left_thread([&]() {
+            _build_bvh_node(left_nodes, input, begin, mid, depth + 1, left_budget);
+        });
+        _build_bvh_node(right_nodes, input, mid, end, depth + 1, right_budget);
+        left_thread.join();
+
+        // Offsets in the subtrees are relative to their own arrays
+        _append_subtree(dst, left_nodes);
+
+        dst[node_idx].offset = static_cast<uint>(dst.size());
+        _append_subtree(dst, right_nodes);
+    } else {
+        _build_bvh_node(dst, input, begin, mid, depth + 1, 1);
+
+        dst[node_idx].offset = static_cast<uint>(dst.size());
+        _build_bvh_node(dst, input, mid, end, depth + 1, 1);
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+// Flattened bounding volume hierarchy over a set of boxes. Queries report primitive ids, i.e.
+// indices into the boxes it was built from, whose leaf overlaps the query, the caller tests
+// the primitives themselves.
+struct BVH {
+    std::vector<BVH_Node> nodes;
+    std::vector<uint>     prim_indices;
+    uint                  depth;
+
+    void build(const AABB *boxes, const uint *prims, size_t prim_count, uint max_leaf_size, uint thread_count = 1) {
+        ASSERT(max_leaf_size > 0 && max_leaf_size <= UINT16_MAX);
+
+        nodes.clear();
+        prim_indices.assign(prims, prims + prim_count);
+        depth = 0;
+
+        if (prim_count == 0) {
+            return;
+        }
+
+        uint max_prim = *std::max_element(prims, prims + prim_count);
+
+        std::vector<glm::vec3> centroids(max_prim + 1);
+        for (size_t i = 0; i < prim_count; ++i) {
+            centroids[prims[i]] = (boxes[prims[i]].min + boxes[prims[i]].max) * 0.5f;
+        }
+
+        _BVH_Build_Input input = {boxes, centroids.data(), prim_indices.data(), max_leaf_size};
+
+        nodes.reserve(2 * prim_count / max_leaf_size + 1);
+        _build_bvh_node(nodes, input, 0, static_cast<uint>(prim_count), 0, MAX(thread_count, 1u));
+
+        depth = get_depth();
+        ASSERT(depth < BVH_MAX_DEPTH);
+    }
+
+    uint get_depth(uint node_idx = 0) const {
+        if (nodes.empty()) {
+            return 0;
+        }
+
+        const BVH_Node &node = nodes[node_idx];
+        if (node.prim_count > 0) {
+            return 1;
+        }
+
+        return 1 + MAX(get_depth(node_idx + 1), get_depth(node.offset));
+    }
+
+    size_t get_memory_usage() const {
+        return nodes.capacity() * sizeof(BVH_Node) + prim_indices.capacity() * sizeof(uint);
+    }
+
+// --------------------------------------------------------------------------------
+
+    // 'overlaps' tests a node's bounds, 'visit' is called with the primitives of every overlapping leaf
+    template<typename Overlaps, typename Visit>
+    void traverse(Overlaps &&overlaps, Visit &&visit) const {
+        if (nodes.empty()) {
+            return;
+        }
+
+        uint stack[BVH_MAX_DEPTH];
+        uint stack_size = 0;
+        uint node_idx = 0;
+
+        while (true) {
+            const BVH_Node &node = nodes[node_idx];
+
+            if (overlaps(node.bounds)) {
+                if (node.prim_count == 0) {
+                    stack[stack_size++] = node.offset;
+                    node_idx = node_idx + 1;
+                    continue;
+                }
+
+                for (uint i = 0; i < node.prim_count; ++i) {
+                    visit(prim_indices[node.offset + i]);
+                }
+            }
+
+            if (stack_size == 0) {
+                break;
+            }
+
+            node_idx = stack[--stack_size];
+        }
+    }
+
+    // Front to back along the ray. 'intersect' is called as intersect(prim, max_t) and shrinks
+    // 'max_t' on a hit, which prunes every node further away than the closest hit so far.
+    template<typename Intersect>
+    void traverse_ray(const Ray &ray, float &max_t, Intersect &&intersect) const {
+        if (nodes.empty()) {
+            return;
+        }
+
+        uint stack[BVH_MAX_DEPTH];
+        uint stack_size = 0;
+        uint node_idx = 0;
+
+        float t_near;
+
+        while (true) {
+            const BVH_Node &node = nodes[node_idx];
+
+            if (intersect_ray_aabb(ray, node.bounds, max_t, t_near)) {
+                if (node.prim_count == 0) {
+                    if (ray.negative[node.axis]) {
+                        stack[stack_size++] = node_idx + 1;
+                        node_idx = node.offset;
+                    } else {
+                        stack[stack_size++] = node.offset;
+                        node_idx = node_idx + 1;
+                    }
+
+                    continue;
+                }
+
+                for (uint i = 0; i < node.prim_count; ++i) {
+                    intersect(prim_indices[node.offset + i], max_t);
+                }
+            }
+
+            if (stack_size == 0) {
+                break;
+            }
+
+            node_idx = stack[--stack_size];
+        }
+    }
+};
+
+// --------------------------------------------------------------------------------
+
+struct Ray_Hit {
+    float t;
+    uint  mesh_idx;
+    uint  triangle_idx; // UINT_MAX when only the mesh bounds were tested
+};
+
+// Two level hierarchy over a model: a top tree over the model space bounds of the meshes and,
+// optionally, one bottom tree per mesh over its triangles. Every query works at the mesh level
+// and reports a mesh at most once, rays use the triangles when the bottom trees exist.
+struct Scene_BVH {
+    const std::vector<Mesh> *meshes;
+
+    BVH                      top;
+    std::vector<BVH>         bottom;
+
+    double                   build_time;
+
+    void build(const std::vector<Mesh> &src, bool with_triangles, uint thread_count = 1) {
+        timespec time_begin, time_end;
+        timespec_get(&time_begin, TIME_UTC);
+
+        meshes = &src;
+        thread_count = MAX(thread_count, 1u);
+
+        std::vector<AABB> boxes(src.size());
+        std::vector<uint> prims;
+
+        for (size_t i = 0; i < src.size(); ++i) {
+            boxes[i] = src[i].bounds;
+
+            // Meshes without vertices have inverted bounds
+            if (!src[i].vertices.empty()) {
+                prims.push_back(static_cast<uint>(i));
+            }
+        }
+
+        top.build(boxes.data(), prims.data(), prims.size(), BVH_MESH_LEAF_SIZE, thread_count);
+
+        bottom.clear();
+
+        if (with_triangles) {
+            bottom.resize(src.size());
+
+            // Bottom trees are small, so whole meshes are spread over the threads instead
+            auto build_bottom = [&](uint first) {
+                std::vector<AABB> triangle_boxes;
+                std::vector<uint> triangle_prims;
+
+                for (size_t i = first; i < src.size(); i += thread_count) {
+                    const Mesh &mesh = src[i];
+                    size_t triangle_count = mesh.indices.size() / 3;
+
+                    triangle_boxes.assign(triangle_count, AABB{});
+                    triangle_prims.resize(triangle_count);
+
+                    for (size_t j = 0; j < triangle_count; ++j) {
+                        for (size_t k = 0; k < 3; ++k) {
+                            triangle_boxes[j].extend(mesh.vertices[mesh.indices[3 * j + k]].position);
+                        }
+
+                        triangle_prims[j] = static_cast<uint>(j);
+                    }
+
+                    bottom[i].build(triangle_boxes.data(), triangle_prims.data(), triangle_count, BVH_TRIANGLE_LEAF_SIZE);
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for (uint i = 1; i < thread_count; ++i) {
+                threads.emplace_back(build_bottom, i);
+            }
+
+            build_bottom(0);
+
+            for (auto &thread : threads) {
+                thread.join();
+            }
+        }
+
+        timespec_get(&time_end, TIME_UTC);
+        build_time = (time_end.tv_sec - time_begin.tv_sec) + (time_end.tv_nsec - time_begin.tv_nsec) * 1e-9;
+    }
+
+    size_t get_memory_usage() const {
+        size_t ret = top.get_memory_usage();
+
+        for (const auto &tree : bottom) {
+            ret += tree.get_memory_usage();
+        }
+
+        return ret;
+    }
+
+// --------------------------------------------------------------------------------
+
+    // Closest hit within 'max_t', 'direction' does not need to be normalized
+    bool ray(glm::vec3 origin, glm::vec3 direction, float max_t, Ray_Hit &hit) const {
+        const Ray ray = make_ray(origin, direction);
+
+        hit = {max_t, UINT_MAX, UINT_MAX};
+
+        top.traverse_ray(ray, max_t, [&](uint mesh_idx, float &mesh_max_t) {
+            const Mesh &mesh = (*meshes)[mesh_idx];
+            float t;
+
+            if (bottom.empty()) {
+                if (intersect_ray_aabb(ray, mesh.bounds, mesh_max_t, t) && t < mesh_max_t) {
+                    mesh_max_t = t;
+                    hit = {t, mesh_idx, UINT_MAX};
+                }
+
+                return;
+            }
+
+            bottom[mesh_idx].traverse_ray(ray, mesh_max_t, [&](uint triangle_idx, float &triangle_max_t) {
+                const uint *idx = &mesh.indices[3 * triangle_idx];
+
+                if (intersect_ray_triangle(ray, mesh.vertices[idx[0]].position, mesh.vertices[idx[1]].position,
+                                           mesh.vertices[idx[2]].position, triangle_max_t, t)) {
+                    triangle_max_t = t;
+                    hit = {t, mesh_idx, triangle_idx};
+                }
+            });
+        });
+
+        return hit.mesh_idx != UINT_MAX;
+    }
+
+    template<typename Visit>
+    void query_frustum(const Frustum &frustum, Visit &&visit) const {
+        top.traverse(
+            [&](const AABB &box) { return frustum.intersects(box); },
+            [&](uint mesh_idx) {
+                if (frustum.intersects((*meshes)[mesh_idx].bounds)) {
+                    visit(mesh_idx);
+                }
+            }
+        );
+    }
+
+    template<typename Visit>
+    void query_sphere(glm::vec3 center, float radius, Visit &&visit) const {
+        top.traverse(
+            [&](const AABB &box) { return sphere_overlaps_aabb(center, radius, box); },
+            [&](uint mesh_idx) {
+                if (sphere_overlaps_aabb(center, radius, (*meshes)[mesh_idx].bounds)) {
+                    visit(mesh_idx);
+                }
+            }
+        );
+    }
+
+    template<typename Visit>
+    void query_aabb(const AABB &query, Visit &&visit) const {
+        top.traverse(
+            [&](const AABB &box) { return aabbs_overlap(query, box); },
+            [&](uint mesh_idx) {
+                if (aabbs_overlap(query, (*meshes)[mesh_idx].bounds)) {
+                    visit(mesh_idx);
+                }
+            }
+        );
+    }
+};
+
+Scene_BVH make_scene_bvh() {
+    Scene_BVH ret = {};
+
+    return ret;
+}
+
+// --------------------------------------------------------------------------------
+
+#endif // BVH_HPP
\ No newline at end of file
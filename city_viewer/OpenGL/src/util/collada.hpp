@@ -0,0 +1,667 @@
+#ifndef COLLADA_HPP
+#define COLLADA_HPP
+
+#include "geometry.hpp"
+
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// --------------------------------------------------------------------------------
+
+// Text and attribute values are views into the mapped file, so they are only valid while the
+// document is. Entities are not decoded, none of the values read here ever have them.
+struct Collada_Input {
+    std::string_view semantic;
+    std::string_view source;   // Without the leading '#'
+};
+
+struct Collada_Source {
+    std::string_view values;   // Text of the first 'float_array'
+    uint             count = 0;
+};
+
+struct Collada_Triangles {
+    std::string_view indices;  // Text of the first 'p'
+    uint             count = 0;
+};
+
+struct Collada_Mesh {
+    std::vector<std::string_view>  vertex_sources; // Inputs of the first 'vertices', without the '#'
+    std::vector<Collada_Input>     inputs;         // Of the first 'triangles', they share the layout
+    std::vector<Collada_Triangles> triangles;
+};
+
+struct Collada_Geometry {
+    std::string_view          id;
+    std::vector<Collada_Mesh> meshes;
+};
+
+// A node read for its first 'matrix' and the geometries it instances
+struct Collada_Transform {
+    bool                          has_matrix = false;
+    std::string_view              matrix;
+    std::vector<std::string_view> geometry_urls; // Without the '#'
+};
+
+// Children of a library node, each followed by its own children, in document order
+struct Collada_Library_Node {
+    std::string_view               id;
+    std::vector<Collada_Transform> transforms;
+};
+
+struct Collada_Param {
+    std::string_view name;
+    std::string_view text;
+};
+
+struct Collada_Visual_Node {
+    std::vector<Collada_Param>    params;        // Of the first 'technique' of the first 'extra'
+    std::string_view              translate;     // Empty if the node has none
+    std::vector<std::string_view> geometry_urls; // Without the '#'
+    bool                          has_matrix = false;
+    std::string_view              matrix;
+    std::vector<std::string_view> node_urls;     // Instanced by the first child node, without the '#'
+};
+
+// Everything the model is built from, only the first library of each kind is read like before
+struct Collada_Document {
+    Mapped_File                                file;
+
+    std::vector<Collada_Geometry>              geometries;
+    std::vector<Collada_Source>                sources;
+    std::unordered_map<std::string_view, uint> source_indices; // By id, ids are unique in a document
+    std::vector<Collada_Library_Node>          library_nodes;
+    std::vector<Collada_Visual_Node>           visual_nodes;
+
+    const Collada_Source *find_source(std::string_view id) const {
+        auto iter = source_indices.find(id);
+        return (iter == source_indices.end()) ? nullptr : &sources[iter->second];
+    }
+};
+
+void destroy(Collada_Document &doc) {
+    destroy(doc.file);
+
+    doc = {};
+}
+
+// --------------------------------------------------------------------------------
+
+inline bool is_xml_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Reads the next number of a whitespace separated list and steps past it. False at the end of the
+// list or at something that is not a number. 'std::from_chars' neither allocates nor looks at the
+// locale, and rounds floats the same as 'strtof'. Where it is stricter than 'strtof', the values
+// come out as 'strtof' gives them: a leading '+' is taken, and floats out of range are 0 or inf.
+template <typename T>
+inline bool scan_number(T &dst, const char *&cur, const char *end) {
+    while (cur < end && is_xml_space(*cur)) {
+        ++cur;
+    }
+
+    const char *first = cur;
+    if (first < end && *first == '+') {
+        ++first;
+
+        if (first < end && *first == '-') {
+            return false;
+        }
+    }
+
+    auto result = std::from_chars(first, end, dst);
+
+    // Rare enough to be handed to 'strtof' itself, the token is copied out since the text is not
+    // null terminated
+    if constexpr (std::is_same_v<T, float>) {
+        if (result.ec == std::errc::result_out_of_range) {
+            std::string token(cur, result.ptr);
+            dst       = strtof(token.c_str(), nullptr);
+            result.ec = std::errc();
+        }
+    }
+
+    if (result.ec != std::errc()) {
+        return false;
+    }
+
+    cur = result.ptr;
+    return true;
+}
+
+// Appends a source's values as vec3s, the array sized once up front and parsed straight into it
+bool read_collada_source(std::vector<glm::vec3> &dst, const Collada_Source &source) {
+    const char *cur = source.values.data();
+    const char *end = cur + source.values.size();
+
+    size_t first = dst.size();
+    dst.resize(first + source.count / 3);
+
+    for (size_t i = first; i < dst.size(); ++i) {
+        glm::vec3 &val = dst[i];
+
+        if (!scan_number(val.x, cur, end) || !scan_number(val.y, cur, end) || !scan_number(val.z, cur, end)) {
+            LOG_ERROR("Failed to convert 'float_array' element no. %zu to float from COLLADA source.",
+                      (i - first) * 3);
+            dst.resize(first);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// In the order the values are written, so the matrix is transposed. Vectors are multiplied from the
+// left with it.
+void read_collada_mat4(glm::mat4 &dst, std::string_view text) {
+    const char *cur = text.data();
+    const char *end = cur + text.size();
+
+    for (uint i = 0; i < 16; ++i) {
+        if (!scan_number(dst[i / 4][i % 4], cur, end)) {
+            break;
+        }
+    }
+}
+
+void read_collada_vec3(glm::vec3 &dst, std::string_view text) {
+    const char *cur = text.data();
+    const char *end = cur + text.size();
+
+    for (uint i = 0; i < 3; ++i) {
+        if (!scan_number(dst[i], cur, end)) {
+            break;
+        }
+    }
+}
+
+// A vertex for every group of 'stride' indices in 'p'. Only the first two are used, the position
+// and normal ones. 'dst' is expected to be reserved for the 'count' triangles already.
+bool read_collada_triangles(Geometry &dst, const Collada_Triangles &triangles, uint stride,
+                            const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &normals) {
+    const char *cur = triangles.indices.data();
+    const char *end = cur + triangles.indices.size();
+
+    uint position_idx, normal_idx, _ignored;
+
+    while (scan_number(position_idx, cur, end)) {
+        if (!scan_number(normal_idx, cur, end)) {
+            LOG_ERROR("Failed to read the normal index of COLLADA vertex no. %zu.", dst.vertices.size());
+            return false;
+        }
+
+        for (uint i = 2; i < stride; ++i) {
+            scan_number(_ignored, cur, end);
+        }
+
+        if (position_idx >= positions.size() || normal_idx >= normals.size()) {
+            LOG_ERROR("COLLADA vertex no. %zu indexes past its sources.", dst.vertices.size());
+            return false;
+        }
+
+        dst.vertices.push_back({positions[position_idx], normals[normal_idx]});
+        dst.indices.push_back(static_cast<uint>(dst.vertices.size() - 1));
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+// Pull parser over the mapped file, no DOM is built. A single pass finds where the numbers of every
+// source, index list and node are, and keeps views of that text, so the numbers themselves can be
+// parsed later on any thread.
+struct Collada_Reader {
+    enum Scope : ubyte {
+        SCOPE_SKIPPED,
+        SCOPE_ROOT,
+        SCOPE_LIBRARY_GEOMETRIES,
+        SCOPE_GEOMETRY,
+        SCOPE_MESH,
+        SCOPE_SOURCE,
+        SCOPE_VERTICES,
+        SCOPE_TRIANGLES,
+        SCOPE_LIBRARY_NODES,
+        SCOPE_LIBRARY_NODE,
+        SCOPE_LIBRARY_CHILD_NODE, // Either a child or a grandchild of a library node
+        SCOPE_LIBRARY_VISUAL_SCENES,
+        SCOPE_VISUAL_SCENE,
+        SCOPE_VISUAL_NODE,
+        SCOPE_VISUAL_CHILD_NODE,  // The first child of a visual node
+        SCOPE_EXTRA,
+        SCOPE_TECHNIQUE
+    };
+
+    // Kinds of children of which only the first is read
+    enum First : ubyte {
+        FIRST_CHILD      = 1 << 0,
+        FIRST_CHILD_NODE = 1 << 1 // Of a visual node, which also reads its first 'extra'
+    };
+
+    struct Container {
+        std::string_view name;
+        Scope            scope;
+        ubyte            firsts;    // Kinds of children already seen
+        uint             depth;     // Of library nodes, 1 for their children and 2 for grandchildren
+        uint             transform; // Of library child nodes, index into the node's transforms
+    };
+
+    struct Attribute {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    Collada_Document      &doc;
+
+    const char            *cur;
+    const char            *end;
+
+    std::vector<Container> containers;
+    std::vector<Attribute> attributes;
+    bool                   is_empty = false; // The current start tag closes itself
+
+    bool                   has_root                  = false;
+    bool                   has_library_geometries    = false;
+    bool                   has_library_nodes         = false;
+    bool                   has_library_visual_scenes = false;
+    bool                   has_visual_scene          = false;
+
+    Collada_Reader(Collada_Document &doc, const char *begin, const char *end) : doc(doc), cur(begin), end(end) {}
+
+// --------------------------------------------------------------------------------
+
+    std::string_view get_attribute(const char *name) const {
+        for (const auto &attribute : attributes) {
+            if (attribute.name == name) {
+                return attribute.value;
+            }
+        }
+
+        return {};
+    }
+
+    // Without the '#' of a local reference
+    std::string_view get_reference(const char *name) const {
+        std::string_view ref = get_attribute(name);
+        if (!ref.empty() && ref[0] == '#') {
+            ref.remove_prefix(1);
+        }
+
+        return ref;
+    }
+
+    uint get_uint_attribute(const char *name) const {
+        std::string_view value = get_attribute(name);
+
+        uint ret = 0;
+        std::from_chars(value.data(), value.data() + value.size(), ret);
+
+        return ret;
+    }
+
+    // Up to the next tag, like the first text node of the element
+    std::string_view get_text() const {
+        if (is_empty) {
+            return {};
+        }
+
+        const char *text_end = static_cast<const char *>(memchr(cur, '<', end - cur));
+        if (text_end == nullptr) {
+            text_end = end;
+        }
+
+        return {cur, static_cast<size_t>(text_end - cur)};
+    }
+
+    // True for the first child of a kind only
+    bool take_first(First kind = FIRST_CHILD) {
+        if (containers.back().firsts & kind) {
+            return false;
+        }
+
+        containers.back().firsts |= kind;
+        return true;
+    }
+
+// --------------------------------------------------------------------------------
+
+    // Records what is read from an element as it opens, since all of it is either attributes or
+    // the text right after the start tag
+    Scope open_element(std::string_view name) {
+        if (containers.empty()) {
+            if (has_root) {
+                return SCOPE_SKIPPED;
+            }
+
+            has_root = true;
+            return SCOPE_ROOT;
+        }
+
+        Container &parent = containers.back();
+
+        switch (parent.scope) {
+        case SCOPE_ROOT: {
+            if (name == "library_geometries" && !has_library_geometries) {
+                has_library_geometries = true;
+                return SCOPE_LIBRARY_GEOMETRIES;
+            } else if (name == "library_nodes" && !has_library_nodes) {
+                has_library_nodes = true;
+                return SCOPE_LIBRARY_NODES;
+            } else if (name == "library_visual_scenes" && !has_library_visual_scenes) {
+                has_library_visual_scenes = true;
+                return SCOPE_LIBRARY_VISUAL_SCENES;
+            }
+        } break;
+        case SCOPE_LIBRARY_GEOMETRIES: {
+            if (name == "geometry") {
+                doc.geometries.push_back({get_attribute("id"), {}});
+                return SCOPE_GEOMETRY;
+            }
+        } break;
+        case SCOPE_GEOMETRY: {
+            if (name == "mesh") {
+                doc.geometries.back().meshes.emplace_back();
+                return SCOPE_MESH;
+            }
+        } break;
+        case SCOPE_MESH: {
+            Collada_Mesh &mesh = doc.geometries.back().meshes.back();
+
+            if (name == "source") {
+                doc.source_indices.emplace(get_attribute("id"), static_cast<uint>(doc.sources.size()));
+                doc.sources.emplace_back();
+                return SCOPE_SOURCE;
+            } else if (name == "vertices" && take_first()) {
+                return SCOPE_VERTICES;
+            } else if (name == "triangles") {
+                mesh.triangles.push_back({{}, get_uint_attribute("count")});
+                return SCOPE_TRIANGLES;
+            }
+        } break;
+        case SCOPE_SOURCE: {
+            if (name == "float_array" && take_first()) {
+                doc.sources.back().values = get_text();
+                doc.sources.back().count = get_uint_attribute("count");
+            }
+        } break;
+        case SCOPE_VERTICES: {
+            if (name == "input") {
+                doc.geometries.back().meshes.back().vertex_sources.push_back(get_reference("source"));
+            }
+        } break;
+        case SCOPE_TRIANGLES: {
+            Collada_Mesh &mesh = doc.geometries.back().meshes.back();
+
+            if (name == "input" && mesh.triangles.size() == 1) {
+                mesh.inputs.push_back({get_attribute("semantic"), get_reference("source")});
+            } else if (name == "p" && take_first()) {
+                mesh.triangles.back().indices = get_text();
+            }
+        } break;
+        case SCOPE_LIBRARY_NODES: {
+            if (name == "node") {
+                doc.library_nodes.push_back({get_attribute("id"), {}});
+                return SCOPE_LIBRARY_NODE;
+            }
+        } break;
+        case SCOPE_LIBRARY_NODE:
+        case SCOPE_LIBRARY_CHILD_NODE: {
+            Collada_Library_Node &node = doc.library_nodes.back();
+
+            if (name == "node" && parent.depth < 2) {
+                node.transforms.emplace_back();
+                return SCOPE_LIBRARY_CHILD_NODE;
+            } else if (parent.scope == SCOPE_LIBRARY_CHILD_NODE) {
+                Collada_Transform &transform = node.transforms[parent.transform];
+
+                if (name == "matrix" && !transform.has_matrix) {
+                    transform.has_matrix = true;
+                    transform.matrix = get_text();
+                } else if (name == "instance_geometry") {
+                    transform.geometry_urls.push_back(get_reference("url"));
+                }
+            }
+        } break;
+        case SCOPE_LIBRARY_VISUAL_SCENES: {
+            if (name == "visual_scene" && !has_visual_scene) {
+                has_visual_scene = true;
+                return SCOPE_VISUAL_SCENE;
+            }
+        } break;
+        case SCOPE_VISUAL_SCENE: {
+            if (name == "node") {
+                doc.visual_nodes.emplace_back();
+                return SCOPE_VISUAL_NODE;
+            }
+        } break;
+        case SCOPE_VISUAL_NODE: {
+            Collada_Visual_Node &node = doc.visual_nodes.back();
+
+            if (name == "extra" && take_first()) {
+                return SCOPE_EXTRA;
+            } else if (name == "translate" && node.translate.empty()) {
+                node.translate = get_text();
+            } else if (name == "instance_geometry") {
+                node.geometry_urls.push_back(get_reference("url"));
+            } else if (name == "matrix" && !node.has_matrix) {
+                node.has_matrix = true;
+                node.matrix = get_text();
+            } else if (name == "node" && take_first(FIRST_CHILD_NODE)) {
+                return SCOPE_VISUAL_CHILD_NODE;
+            }
+        } break;
+        case SCOPE_VISUAL_CHILD_NODE: {
+            if (name == "instance_node") {
+                doc.visual_nodes.back().node_urls.push_back(get_reference("url"));
+            }
+        } break;
+        case SCOPE_EXTRA: {
+            if (name == "technique" && take_first()) {
+                return SCOPE_TECHNIQUE;
+            }
+        } break;
+        case SCOPE_TECHNIQUE: {
+            if (name == "param") {
+                doc.visual_nodes.back().params.push_back({get_attribute("name"), get_text()});
+            }
+        } break;
+        default: break;
+        }
+
+        return SCOPE_SKIPPED;
+    }
+
+// --------------------------------------------------------------------------------
+
+    // Steps past the next occurrence of 'token', false if there is none
+    bool skip_past(const char *token) {
+        size_t len = strlen(token);
+
+        for (;;) {
+            const char *found = static_cast<const char *>(memchr(cur, token[0], end - cur));
+            if (found == nullptr || static_cast<size_t>(end - found) < len) {
+                return false;
+            }
+
+            cur = found + 1;
+
+            if (memcmp(found, token, len) == 0) {
+                cur = found + len;
+                return true;
+            }
+        }
+    }
+
+    std::string_view read_name() {
+        const char *begin = cur;
+        while (cur < end && !is_xml_space(*cur) && *cur != '/' && *cur != '>' && *cur != '=') {
+            ++cur;
+        }
+
+        return {begin, static_cast<size_t>(cur - begin)};
+    }
+
+    void skip_space() {
+        while (cur < end && is_xml_space(*cur)) {
+            ++cur;
+        }
+    }
+
+    // Past the name of a start tag, reads the attributes and steps past the tag
+    bool read_attributes() {
+        attributes.clear();
+
+        for (;;) {
+            skip_space();
+
+            if (cur == end) {
+                return false;
+            } else if (*cur == '>') {
+                ++cur;
+                is_empty = false;
+                return true;
+            } else if (*cur == '/') {
+                if (end - cur < 2 || cur[1] != '>') {
+                    return false;
+                }
+
+                cur += 2;
+                is_empty = true;
+                return true;
+            }
+
+            Attribute attribute;
+            attribute.name = read_name();
+            skip_space();
+
+            if (attribute.name.empty() || cur == end || *cur != '=') {
+                return false;
+            }
+
+            ++cur;
+            skip_space();
+
+            if (cur == end || (*cur != '"' && *cur != '\'')) {
+                return false;
+            }
+
+            const char *value_end = static_cast<const char *>(memchr(cur + 1, *cur, end - cur - 1));
+            if (value_end == nullptr) {
+                return false;
+            }
+
+            attribute.value = {cur + 1, static_cast<size_t>(value_end - cur - 1)};
+            attributes.push_back(attribute);
+
+            cur = value_end + 1;
+        }
+    }
+
+    size_t get_offset() const {
+        return cur - reinterpret_cast<const char *>(doc.file.data);
+    }
+
+    bool read() {
+        for (;;) {
+            cur = static_cast<const char *>(memchr(cur, '<', end - cur));
+            if (cur == nullptr) {
+                cur = end;
+                break;
+            }
+
+            ++cur;
+
+            if (cur == end) {
+                break;
+            } else if (*cur == '?') {
+                if (!skip_past("?>")) {
+                    break;
+                }
+            } else if (*cur == '!') {
+                const char *terminator = ">";
+                if (end - cur >= 3 && memcmp(cur, "!--", 3) == 0) {
+                    terminator = "-->";
+                } else if (end - cur >= 8 && memcmp(cur, "![CDATA[", 8) == 0) {
+                    terminator = "]]>";
+                }
+
+                if (!skip_past(terminator)) {
+                    break;
+                }
+            } else if (*cur == '/') {
+                ++cur;
+                std::string_view name = read_name();
+
+                if (containers.empty() || containers.back().name != name) {
+                    LOG_ERROR("Failed to parse COLLADA at byte %zu: unexpected end tag '%.*s'.",
+                              get_offset(), static_cast<int>(name.size()), name.data());
+                    return false;
+                }
+
+                containers.pop_back();
+
+                if (!skip_past(">")) {
+                    break;
+                }
+            } else {
+                std::string_view name = read_name();
+
+                if (name.empty() || !read_attributes()) {
+                    LOG_ERROR("Failed to parse COLLADA at byte %zu: malformed start tag.", get_offset());
+                    return false;
+                }
+
+                Scope scope = open_element(name);
+
+                if (!is_empty) {
+                    Container container = {name, scope, 0, 0, 0};
+
+                    if (scope == SCOPE_LIBRARY_CHILD_NODE) {
+                        container.depth = containers.back().depth + 1;
+                        container.transform = static_cast<uint>(doc.library_nodes.back().transforms.size() - 1);
+                    }
+
+                    containers.push_back(container);
+                }
+            }
+        }
+
+        if (!containers.empty() || !has_root) {
+            LOG_ERROR("Failed to parse COLLADA: the document ends before its root element does.");
+            return false;
+        }
+
+        return true;
+    }
+};
+
+// --------------------------------------------------------------------------------
+
+// Maps the file at 'file_path' and finds what the model is read from in it. The document keeps the
+// mapping, release it with 'destroy'.
+bool read_collada(Collada_Document &dst, const char *file_path) {
+    dst = {};
+
+    // Already logged, or left to the caller for a missing file
+    if (!map_file(dst.file, file_path)) {
+        return false;
+    }
+
+    const char *data = reinterpret_cast<const char *>(dst.file.data);
+
+    Collada_Reader reader(dst, data, data + dst.file.size);
+
+    if (!reader.read()) {
+        destroy(dst);
+        return false;
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------
+
+#endif // COLLADA_HPP
\ No newline at end of file
@@ -6,14 +6,23 @@
 #ifdef _WIN32
 #   define WIN32_LEAN_AND_MEAN
 #   include <windows.h>
+#   include <process.h>
 #   include <locale>
 #   include <codecvt>
 #else
+#   include <sys/mman.h>
 #   include <sys/stat.h>
 #   include <sys/types.h>
+#   include <dirent.h>
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <alloca.h>
 #endif // _WIN32
 
+#include <stdint.h>
 #include <string.h>
+#include <string>
 #include <vector>
 
 // --------------------------------------------------------------------------------
@@ -132,15 +141,10 @@ char *get_current_great_grandparent_directory() {
 
 std::vector<std::string> get_subdirectories(const char *dir_path) {
     ASSERT(dir_path != nullptr);
-    size_t dir_len = strlen(dir_path);
 
     std::vector<std::string> ret;
 
 #ifdef _WIN32
-    //wchar_t *search_path = static_cast<wchar_t *>(malloc(dir_len + 4 + 1));
-    //ASSERT(search_path != nullptr);
-    //sprintf(search_path, "%s/*.*", dir_path);
-
     std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
     std::wstring search_path = converter.from_bytes(dir_path) + L"\\*.*";
     WIN32_FIND_DATAW find_data;
@@ -159,7 +163,7 @@ std::vector<std::string> get_subdirectories(const char *dir_path) {
         FindClose(hFind);
     }
 #else
-    DIR *dir = opendir(directory.c_str());
+    DIR *dir = opendir(dir_path);
     if (dir != nullptr) {
         struct dirent *entry;
         while ((entry = readdir(dir)) != nullptr) {
@@ -218,4 +222,172 @@ bool create_directory(const char *dir_path) {
 
 // --------------------------------------------------------------------------------
 
+// Read-only view of a whole file, paged in as it is touched
+struct Mapped_File {
+    const ubyte *data    = nullptr;
+    size_t       size    = 0;
+
+#ifdef _WIN32
+    HANDLE       file    = INVALID_HANDLE_VALUE;
+    HANDLE       mapping = nullptr;
+#else
+    int          fd      = -1;
+#endif // _WIN32
+};
+
+// False without logging when there is no file at 'file_path', not every caller treats that as an error
+bool map_file(Mapped_File &dst, const char *file_path) {
+    ASSERT(file_path != nullptr);
+
+    dst = {};
+
+#ifdef _WIN32
+    dst.file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (dst.file == INVALID_HANDLE_VALUE) {
+        if (GetLastError() != ERROR_FILE_NOT_FOUND && GetLastError() != ERROR_PATH_NOT_FOUND) {
+            LOG_ERROR("Failed to open file at path '%s'.", file_path);
+        }
+
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(dst.file, &size);
+    dst.size = static_cast<size_t>(size.QuadPart);
+
+    // Empty files cannot be mapped
+    if (dst.size == 0) {
+        return true;
+    }
+
+    dst.mapping = CreateFileMappingA(dst.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (dst.mapping != nullptr) {
+        dst.data = static_cast<const ubyte *>(MapViewOfFile(dst.mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    dst.fd = open(file_path, O_RDONLY);
+    if (dst.fd == -1) {
+        if (errno != ENOENT) {
+            LOG_ERROR("Failed to open file at path '%s'.", file_path);
+        }
+
+        return false;
+    }
+
+    struct stat st;
+    fstat(dst.fd, &st);
+    dst.size = static_cast<size_t>(st.st_size);
+
+    // Empty files cannot be mapped
+    if (dst.size == 0) {
+        return true;
+    }
+
+    void *data = mmap(nullptr, dst.size, PROT_READ, MAP_PRIVATE, dst.fd, 0);
+    if (data != MAP_FAILED) {
+        dst.data = static_cast<const ubyte *>(data);
+    }
+#endif // _WIN32
+
+    if (dst.data == nullptr) {
+        LOG_ERROR("Failed to map file at path '%s'.", file_path);
+        return false;
+    }
+
+    return true;
+}
+
+void destroy(Mapped_File &file) {
+#ifdef _WIN32
+    if (file.data != nullptr) {
+        UnmapViewOfFile(file.data);
+    }
+
+    if (file.mapping != nullptr) {
+        CloseHandle(file.mapping);
+    }
+
+    if (file.file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file.file);
+    }
+#else
+    if (file.data != nullptr) {
+        munmap(const_cast<ubyte *>(file.data), file.size);
+    }
+
+    if (file.fd != -1) {
+        close(file.fd);
+    }
+#endif // _WIN32
+
+    file = {};
+}
+
+// --------------------------------------------------------------------------------
+
+// 64 bit hash of the bytes, 8 at a time with the MurmurHash3 mixing steps. Meant for telling file
+// contents apart, not for security.
+uint64_t hash_bytes(const void *data, size_t size) {
+    const ubyte *bytes = static_cast<const ubyte *>(data);
+
+    auto mix_word = [](uint64_t word) {
+        word *= 0x87C37B91114253D5ull;
+        word = (word << 31) | (word >> 33);
+        return word * 0x4CF5AD432745937Full;
+    };
+
+    uint64_t ret = 0x9E3779B97F4A7C15ull ^ size;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+
+        ret ^= mix_word(word);
+        ret = (ret << 27) | (ret >> 37);
+        ret = ret * 5 + 0x52DCE729;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + i, size - i);
+    ret ^= mix_word(tail);
+
+    ret ^= ret >> 33;
+    ret *= 0xFF51AFD7ED558CCDull;
+    ret ^= ret >> 33;
+    ret *= 0xC4CEB9FE1A85EC53ull;
+    ret ^= ret >> 33;
+
+    return ret;
+}
+
+// --------------------------------------------------------------------------------
+
+uint get_process_id() {
+#ifdef _WIN32
+    return static_cast<uint>(_getpid());
+#else
+    return static_cast<uint>(getpid());
+#endif // _WIN32
+}
+
+// Moves 'src_path' over 'dst_path' in one step, so readers of 'dst_path' never see it half written
+bool replace_file(const char *src_path, const char *dst_path) {
+    ASSERT(src_path != nullptr && dst_path != nullptr);
+
+#ifdef _WIN32
+    bool ret = MoveFileExA(src_path, dst_path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool ret = rename(src_path, dst_path) == 0;
+#endif // _WIN32
+
+    if (!ret) {
+        LOG_ERROR("Failed to move file '%s' to '%s'.", src_path, dst_path);
+    }
+
+    return ret;
+}
+
+// --------------------------------------------------------------------------------
+
 #endif // FILE_HPP
\ No newline at end of file
@@ -0,0 +1,291 @@
+#ifndef GEOJSON_HPP
+#define GEOJSON_HPP
+
+#include "geometry.hpp"
+
+#include <fstream>
+
+// --------------------------------------------------------------------------------
+
+// Bytes buffered from the file at a time, the only part of it ever held in memory
+#define GEOJSON_READ_BUFFER_SIZE MEGABYTES(1)
+
+// --------------------------------------------------------------------------------
+
+enum GeoJSON_Geometry : ubyte {
+    GEOJSON_GEOMETRY_UNKNOWN,
+    GEOJSON_GEOMETRY_POLYGON,
+    GEOJSON_GEOMETRY_MULTI_POLYGON
+};
+
+// What the models are built from in a feature. The rings of every polygon are concatenated in
+// document order, their points already projected to meters like 'to_meters'. The first ring of a
+// polygon is its outline, the others its holes.
+struct GeoJSON_Feature {
+    GeoJSON_Geometry       geometry   = GEOJSON_GEOMETRY_UNKNOWN;
+
+    bool                   has_height = false;
+    float                  height     = 0.0f;
+
+    std::vector<glm::vec3> points;
+    std::vector<uint>      ring_ends;    // One past the last point of each ring
+    std::vector<uint>      polygon_ends; // One past the last ring of each polygon
+
+    void clear() {
+        geometry = GEOJSON_GEOMETRY_UNKNOWN;
+        has_height = false;
+        height = 0.0f;
+
+        // Keeps the capacity, the next feature reuses it
+        points.clear();
+        ring_ends.clear();
+        polygon_ends.clear();
+    }
+};
+
+// --------------------------------------------------------------------------------
+
+// nlohmann SAX handler over a FeatureCollection. No DOM is built: every feature is handed to 'proc'
+// once its object closes, so memory is bounded by the biggest feature whatever the file's size.
+template <typename Proc>
+struct GeoJSON_Reader {
+    enum Scope : ubyte {
+        SCOPE_SKIPPED,
+        SCOPE_ROOT,
+        SCOPE_FEATURES,
+        SCOPE_FEATURE,
+        SCOPE_PROPERTIES,
+        SCOPE_GEOMETRY,
+        SCOPE_COORDINATES // Any array nested in the coordinates
+    };
+
+    struct Container {
+        Scope scope;
+        bool  has_numbers; // A position
+        bool  has_points;  // A ring
+        bool  has_rings;   // A polygon
+    };
+
+    Proc                   proc;
+
+    GeoJSON_Feature        feature;
+    size_t                 feature_count = 0;
+
+    std::vector<Container> containers;
+
+    // Last key of the innermost object, only kept where it matters
+    std::string            last_key;
+
+    double                 coordinates[2];
+    uint                   coordinate_count = 0;
+
+    explicit GeoJSON_Reader(Proc proc) : proc(proc) {}
+
+// --------------------------------------------------------------------------------
+
+    Scope get_child_scope(bool is_array) const {
+        if (containers.empty()) {
+            return is_array ? SCOPE_SKIPPED : SCOPE_ROOT;
+        }
+
+        switch (containers.back().scope) {
+        case SCOPE_ROOT:        return (is_array && last_key == "features") ? SCOPE_FEATURES : SCOPE_SKIPPED;
+        case SCOPE_FEATURES:    return is_array ? SCOPE_SKIPPED : SCOPE_FEATURE;
+        case SCOPE_GEOMETRY:    return (is_array && last_key == "coordinates") ? SCOPE_COORDINATES : SCOPE_SKIPPED;
+        case SCOPE_COORDINATES: return is_array ? SCOPE_COORDINATES : SCOPE_SKIPPED;
+        case SCOPE_FEATURE: {
+            if (!is_array && last_key == "properties") {
+                return SCOPE_PROPERTIES;
+            } else if (!is_array && last_key == "geometry") {
+                return SCOPE_GEOMETRY;
+            }
+
+            return SCOPE_SKIPPED;
+        }
+        default:                return SCOPE_SKIPPED;
+        }
+    }
+
+    void push_container(bool is_array) {
+        Scope scope = get_child_scope(is_array);
+
+        if (scope == SCOPE_FEATURE) {
+            feature.clear();
+        } else if (scope == SCOPE_COORDINATES) {
+            coordinate_count = 0;
+        }
+
+        containers.push_back({scope, false, false, false});
+    }
+
+    void add_number(double val) {
+        if (containers.back().scope != SCOPE_COORDINATES) {
+            return;
+        }
+
+        containers.back().has_numbers = true;
+
+        // Only longitude and latitude, the altitude is dropped
+        if (coordinate_count < ARRAY_SIZE(coordinates)) {
+            coordinates[coordinate_count++] = val;
+        }
+    }
+
+    bool in_value_of(Scope scope, const char *name) const {
+        return containers.back().scope == scope && last_key == name;
+    }
+
+// --------------------------------------------------------------------------------
+
+    bool null() {
+        return true;
+    }
+
+    bool boolean(bool) {
+        return true;
+    }
+
+    bool number_integer(json::number_integer_t val) {
+        if (in_value_of(SCOPE_PROPERTIES, "height")) {
+            feature.has_height = true;
+            feature.height = static_cast<float>(val);
+        }
+
+        add_number(static_cast<double>(val));
+        return true;
+    }
+
+    bool number_unsigned(json::number_unsigned_t val) {
+        return number_integer(static_cast<json::number_integer_t>(val));
+    }
+
+    bool number_float(json::number_float_t val, const json::string_t &) {
+        if (in_value_of(SCOPE_PROPERTIES, "height")) {
+            feature.has_height = true;
+            feature.height = static_cast<float>(val);
+        }
+
+        add_number(val);
+        return true;
+    }
+
+    bool string(json::string_t &val) {
+        if (in_value_of(SCOPE_PROPERTIES, "height")) {
+            feature.has_height = true;
+            feature.height = strtof(val.c_str(), nullptr);
+        } else if (in_value_of(SCOPE_GEOMETRY, "type")) {
+            if (val == "Polygon") {
+                feature.geometry = GEOJSON_GEOMETRY_POLYGON;
+            } else if (val == "MultiPolygon") {
+                feature.geometry = GEOJSON_GEOMETRY_MULTI_POLYGON;
+            }
+        }
+
+        return true;
+    }
+
+    bool binary(json::binary_t &) {
+        return true;
+    }
+
+    bool start_object(size_t) {
+        push_container(false);
+        return true;
+    }
+
+    bool key(json::string_t &val) {
+        switch (containers.back().scope) {
+        case SCOPE_ROOT:
+        case SCOPE_FEATURE:
+        case SCOPE_PROPERTIES:
+        case SCOPE_GEOMETRY: {
+            last_key = val;
+        } break;
+        default: break;
+        }
+
+        return true;
+    }
+
+    bool end_object() {
+        if (containers.back().scope == SCOPE_FEATURE) {
+            proc(static_cast<const GeoJSON_Feature &>(feature));
+            ++feature_count;
+        }
+
+        containers.pop_back();
+        return true;
+    }
+
+    bool start_array(size_t) {
+        push_container(true);
+        return true;
+    }
+
+    bool end_array() {
+        Container container = containers.back();
+        containers.pop_back();
+
+        if (container.scope != SCOPE_COORDINATES) {
+            return true;
+        }
+
+        if (container.has_numbers) {
+            if (coordinate_count == ARRAY_SIZE(coordinates)) {
+                const glm::vec2 &meter_coords = to_meters(coordinates[0], coordinates[1]);
+                feature.points.emplace_back(meter_coords.x, 0.0f, -meter_coords.y);
+            }
+
+            if (containers.back().scope == SCOPE_COORDINATES) {
+                containers.back().has_points = true;
+            }
+        } else if (container.has_points) {
+            feature.ring_ends.push_back(static_cast<uint>(feature.points.size()));
+
+            if (containers.back().scope == SCOPE_COORDINATES) {
+                containers.back().has_rings = true;
+            }
+        } else if (container.has_rings) {
+            feature.polygon_ends.push_back(static_cast<uint>(feature.ring_ends.size()));
+        }
+
+        return true;
+    }
+
+    bool parse_error(size_t position, const std::string &, const nlohmann::detail::exception &ex) {
+        LOG_ERROR("Failed to parse GeoJSON at byte %zu: %s", position, ex.what());
+        return false;
+    }
+};
+
+// --------------------------------------------------------------------------------
+
+// Streams the features of the FeatureCollection at 'file_path' to 'proc', which takes a
+// 'const GeoJSON_Feature &' valid for the call only
+template <typename Proc>
+bool read_geojson(const char *file_path, Proc &&proc, size_t *feature_count = nullptr) {
+    std::vector<char> read_buffer(GEOJSON_READ_BUFFER_SIZE);
+
+    std::ifstream file;
+    file.rdbuf()->pubsetbuf(read_buffer.data(), read_buffer.size());
+    file.open(file_path, std::ios::binary);
+
+    if (!file.is_open()) {
+        LOG_ERROR("Failed to open file at path '%s'.", file_path);
+        return false;
+    }
+
+    GeoJSON_Reader<Proc &> reader(proc);
+
+    bool ret = json::sax_parse(file, &reader);
+
+    if (feature_count != nullptr) {
+        *feature_count = reader.feature_count;
+    }
+
+    return ret;
+}
+
+// --------------------------------------------------------------------------------
+
+#endif // GEOJSON_HPP
\ No newline at end of file
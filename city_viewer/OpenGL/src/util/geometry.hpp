@@ -2,14 +2,19 @@
 #define GEOMETRY_HPP
 
 #include "opengl.hpp"
+#include "triangulate.hpp"
 
 #include <Eigen/Dense>
 
 #include <nlohmann/json.hpp>
-#include <tinyxml2/tinyxml2.h>
 
 #include <vector>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#   include <xmmintrin.h>
+#   define FRUSTUM_SSE
+#endif // defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+
 typedef nlohmann::json json;
 
 // --------------------------------------------------------------------------------
@@ -97,25 +102,24 @@ bool segments_intersect(glm::vec3 p0, glm::vec3 q0, glm::vec3 p1, glm::vec3 q1)
 
 // --------------------------------------------------------------------------------
 
-std::vector<float> linspace(float min, float max, uint count) {
-    std::vector<float> ret;
-
+float *linspace(Linear_Allocator &allocator, float min, float max, uint count) {
     if (count == 0) {
-        return ret;
+        return nullptr;
     }
 
+    float *ret = allocator.alloc_array<float>(count);
+
     if (count == 1) {
-        ret.push_back(min);
+        ret[0] = min;
         return ret;
     }
 
     float delta = (max - min) / (count - 1);
 
-    ret.reserve(count);
     for (uint i = 0; i < count - 1; ++i) {
-        ret.push_back(min + delta * i);
+        ret[i] = min + delta * i;
     }
-    ret.push_back(max);
+    ret[count - 1] = max;
 
     return ret;
 }
@@ -188,80 +192,6 @@ void transform_points(std::vector<glm::vec3> &dst, const std::vector<glm::vec3>
 
 // --------------------------------------------------------------------------------
 
-struct Collada_Source_Data {
-    uint  type;
-    uint  size;
-    uint  stride;
-    void *data;
-};
-
-void read_collada_source(Collada_Source_Data &dst, tinyxml2::XMLElement *source_elem) {
-    const char *source_id = source_elem->Attribute("id");
-
-    auto *arr = source_elem->FirstChildElement("float_array");
-    if (arr == nullptr) {
-        LOG_ERROR("Failed to get 'float_array' element from COLLADA source element with id=%s.",
-                  source_id);
-        return;
-    }
-
-    uint num_vals;
-    arr->QueryUnsignedAttribute("count", &num_vals);
-    dst.size = num_vals;
-
-    uint stride;
-    auto *accessor_elem = source_elem->FirstChildElement("technique_common")->FirstChildElement("accessor");
-    if (accessor_elem == nullptr) {
-        LOG_ERROR("Failed to get 'stride' attribute from COLLADA source element with id=%s.",
-                  source_id);
-        dst.stride = 1;
-    } else {
-        accessor_elem->QueryUnsignedAttribute("stride", &stride);
-        dst.stride = stride;
-    }
-
-    dst.type = GL_FLOAT;
-    dst.size *= sizeof(float);
-    dst.data = static_cast<float *>(malloc(num_vals * sizeof(float)));
-    ASSERT(dst.data != nullptr);
-
-    const char *txt = arr->GetText();
-    char *end;
-    for (uint i = 0; i < num_vals; ++i) {
-        float val = strtof(txt, &end);
-
-        if (end == txt) {
-            LOG_ERROR("Failed to convert 'float_array' element no. %u to float from COLLADA source element with id=%s.",
-                      i, source_id);
-            dst.data = nullptr;
-            break;
-        }
-
-        reinterpret_cast<float*>(dst.data)[i] = val;
-        txt = end;
-    }
-}
-
-// --------------------------------------------------------------------------------
-
-void read_mat4(glm::mat4 &dst, tinyxml2::XMLElement *mat_elem) {
-    const char *txt = mat_elem->GetText();
-    sscanf(
-        txt, "%f %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f",
-        &dst[0][0], &dst[0][1], &dst[0][2], &dst[0][3],
-        &dst[1][0], &dst[1][1], &dst[1][2], &dst[1][3],
-        &dst[2][0], &dst[2][1], &dst[2][2], &dst[2][3],
-        &dst[3][0], &dst[3][1], &dst[3][2], &dst[3][3]
-    );
-}
-
-void read_vec3(glm::vec3 &dst, tinyxml2::XMLElement *vec_elem) {
-    const char *txt = vec_elem->GetText();
-    sscanf(txt, "%f %f %f", &dst[0], &dst[1], &dst[2]);
-}
-
-// --------------------------------------------------------------------------------
-
 struct Vertex {
     glm::vec3 position;
     glm::vec3 normal;
@@ -277,24 +207,6 @@ glm::vec2 to_meters(double lng, double lat) {
     return ret;
 }
 
-glm::vec3 to_vec3(const json &point) {
-    double lng = point[0];
-    double lat = point[1];
-
-    const auto &meter_coords = to_meters(lng, lat);
-
-    return {meter_coords.x, 0.0f, -meter_coords.y};
-};
-
-Vertex to_vertex(const json &point) {
-    double lng = point[0];
-    double lat = point[1];
-
-    const auto &meter_coords = to_meters(lng, lat);
-
-    return {glm::vec3(meter_coords.x, 0.0f, -meter_coords.y), glm::vec3(0.0f)};
-};
-
 // --------------------------------------------------------------------------------
 
 struct Geometry {
@@ -302,56 +214,6 @@ struct Geometry {
     std::vector<uint>   indices;
 };
 
-const char *read_uint(uint &dst, const char *cur) {
-    dst = 0;
-    while (*cur >= '0' && *cur <= '9') {
-        dst = dst * 10 + (*cur - '0');
-        ++cur;
-    }
-
-    return cur;
-}
-
-const char *skip_non_digits(const char *cur) {
-    while (*cur != '\0' && (*cur < '0' || *cur > '9')) {
-        ++cur;
-    }
-
-    return cur;
-}
-
-void read_geometry(Geometry &dst, tinyxml2::XMLElement *triangles_elem, uint num_attribs,
-                   const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &normals) {
-    while (triangles_elem != nullptr) {
-        const char *txt = triangles_elem->FirstChildElement("p")->GetText();
-        const char *cur = txt;
-
-        Vertex vert;
-        uint position_idx, normal_idx, _ignored;
-
-        while (*cur != '\0') {
-            cur = read_uint(position_idx, cur);
-            cur = skip_non_digits(cur);
-
-            cur = read_uint(normal_idx, cur);
-            cur = skip_non_digits(cur);
-
-            for (uint i = 0; i < num_attribs - 2; ++i) {
-                cur = read_uint(_ignored, cur);
-                cur = skip_non_digits(cur);
-            }
-
-            vert.position = positions[position_idx];
-            vert.normal = normals[normal_idx];
-
-            dst.vertices.push_back(vert);
-            dst.indices.push_back(dst.vertices.size() - 1);
-        }
-
-        triangles_elem = triangles_elem->NextSiblingElement("triangles");
-    }
-}
-
 // --------------------------------------------------------------------------------
 
 struct AABB {
@@ -392,6 +254,78 @@ struct AABB {
     }
 };
 
+// Clip space planes of a view-projection matrix, stored plane component by plane component so
+// that four planes are tested against a box at once. The last two of the eight slots are
+// padding planes that every point is inside of.
+struct Frustum {
+    alignas(16) float plane_x[8];
+    alignas(16) float plane_y[8];
+    alignas(16) float plane_z[8];
+    alignas(16) float plane_w[8];
+
+    // Gribb-Hartmann extraction, the planes do not need to be normalized for a sign test
+    void init(const glm::mat4 &clip) {
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 2; ++j) {
+                float sign = j == 0 ? 1.0f : -1.0f;
+                int plane_idx = 2 * i + j;
+
+                plane_x[plane_idx] = clip[0][3] + sign * clip[0][i];
+                plane_y[plane_idx] = clip[1][3] + sign * clip[1][i];
+                plane_z[plane_idx] = clip[2][3] + sign * clip[2][i];
+                plane_w[plane_idx] = clip[3][3] + sign * clip[3][i];
+            }
+        }
+
+        for (int i = 6; i < 8; ++i) {
+            plane_x[i] = plane_y[i] = plane_z[i] = 0.0f;
+            plane_w[i] = 1.0f;
+        }
+    }
+
+    // Conservative: false only when the box is entirely outside one of the planes. For each
+    // plane the box corner furthest along its normal is tested, which is just the larger of
+    // the min and max products per axis.
+    bool intersects(const AABB &box) const {
+#ifdef FRUSTUM_SSE
+        const __m128 min_x = _mm_set1_ps(box.min.x), max_x = _mm_set1_ps(box.max.x);
+        const __m128 min_y = _mm_set1_ps(box.min.y), max_y = _mm_set1_ps(box.max.y);
+        const __m128 min_z = _mm_set1_ps(box.min.z), max_z = _mm_set1_ps(box.max.z);
+
+        for (int i = 0; i < 8; i += 4) {
+            const __m128 nx = _mm_load_ps(plane_x + i);
+            const __m128 ny = _mm_load_ps(plane_y + i);
+            const __m128 nz = _mm_load_ps(plane_z + i);
+            const __m128 nw = _mm_load_ps(plane_w + i);
+
+            __m128 dist = _mm_max_ps(_mm_mul_ps(nx, min_x), _mm_mul_ps(nx, max_x));
+            dist = _mm_add_ps(dist, _mm_max_ps(_mm_mul_ps(ny, min_y), _mm_mul_ps(ny, max_y)));
+            dist = _mm_add_ps(dist, _mm_max_ps(_mm_mul_ps(nz, min_z), _mm_mul_ps(nz, max_z)));
+            dist = _mm_add_ps(dist, nw);
+
+            if (_mm_movemask_ps(_mm_cmplt_ps(dist, _mm_setzero_ps())) != 0) {
+                return false;
+            }
+        }
+
+        return true;
+#else
+        for (int i = 0; i < 6; ++i) {
+            float dist = MAX(plane_x[i] * box.min.x, plane_x[i] * box.max.x)
+                       + MAX(plane_y[i] * box.min.y, plane_y[i] * box.max.y)
+                       + MAX(plane_z[i] * box.min.z, plane_z[i] * box.max.z)
+                       + plane_w[i];
+
+            if (dist < 0.0f) {
+                return false;
+            }
+        }
+
+        return true;
+#endif // FRUSTUM_SSE
+    }
+};
+
 std::vector<glm::vec3> get_aabb_centroids(const AABB &aabb, int granularity) {
     std::vector<glm::vec3> ret;
 
@@ -425,8 +359,13 @@ struct Mesh {
     std::vector<uint>     indices;
 
     uint                  base_vert_count  = 4;
+
+    // Oriented along the building's principal axes, used to place camera setups
     AABB                  aabb;
 
+    // Axis-aligned bounds of all the vertices, in model space, used for culling
+    AABB                  bounds;
+
     glm::vec4             color            = {};
 
     Vertex_Array<Vertex>  vertex_array     = {};
@@ -438,6 +377,11 @@ struct Mesh {
     void init(Mesh_Type mesh_type) {
         type = (type > 0) ? type : mesh_type;
 
+        bounds = {};
+        for (const auto &vert : vertices) {
+            bounds.extend(vert.position);
+        }
+
         vertex_array = make_vertex_array<Vertex>();
         vertex_buffer = make_vertex_buffer();
         index_buffer = make_index_buffer();
@@ -458,83 +402,58 @@ struct Mesh {
 
 // --------------------------------------------------------------------------------
 
-    // IMPORTANT(paalf): only works if the mesh only has the base vertices
-    void triangulate_face(uint min, uint max) {
-        auto segment_intersects_base_polygon = [&](uint src, uint dst) {
-            uint cur_idx, next_idx;
-
-            for (size_t i = 0, vert_count = vertices.size(); i < vert_count; ++i) {
-                cur_idx = i;
-                next_idx = (i + 1) % vert_count;
-
-                if (segments_intersect(vertices[src].position, vertices[dst].position,
-                                       vertices[cur_idx].position, vertices[next_idx].position)) {
-                    return true;
-                }
-            }
-
-            return false;
-        };
-
-        uint open_count = max - min;
-        std::vector<uint> open_indices;
-        open_indices.reserve(open_count);
+    // Triangulates the polygons of 'rings' in the xz plane, their vertices starting at 'first', into
+    // triangles facing up. False if a part of a polygon could not be triangulated.
+    bool triangulate_face(uint first, const Polygon_Rings &rings) {
+        Triangulator triangulator;
 
-        for (uint i = min; i < max; ++i) {
-            open_indices.push_back(i);
-        }
+        std::vector<glm::vec2> points;
+        std::vector<uint>      ring_ends;
 
-        int count = -1;
-        while (count != open_count && open_count >= 3) {
-            count = open_count;
-            for (uint i = 0; i < open_count; ++i) {
-                uint mid = (i + 1) % open_count;
+        bool ret = true;
 
-                uint idx0 = open_indices[i];
-                uint idx1 = open_indices[mid];
-                uint idx2 = open_indices[(i + 2) % open_count];
-
-                const glm::vec3 &v0 = vertices[idx0].position;
-                const glm::vec3 &v1 = vertices[idx1].position;
-                const glm::vec3 &v2 = vertices[idx2].position;
-
-                const glm::vec3 &d0 = v1 - v0;
-                const glm::vec3 &d1 = v2 - v0;
-
-                if ((d0.z * d1.x - d0.x * d1.z) < 0.0f) {
-                    continue;
-                }
+        for (size_t p = 0, ring_begin = 0; p < rings.polygon_ends.size(); ring_begin = rings.polygon_ends[p++]) {
+            size_t ring_end = rings.polygon_ends[p];
+            if (ring_begin == ring_end) {
+                continue;
+            }
 
-                if (segment_intersects_base_polygon(idx0, idx2) || segment_intersects_base_polygon(idx1, idx2)) {
-                    continue;
-                }
+            uint point_begin = ring_begin == 0 ? 0 : rings.ring_ends[ring_begin - 1];
+            uint point_end = rings.ring_ends[ring_end - 1];
 
-                indices.push_back(idx0);
-                indices.push_back(idx1);
-                indices.push_back(idx2);
+            // East and north, counter-clockwise is then facing up
+            points.clear();
+            for (uint i = point_begin; i < point_end; ++i) {
+                const glm::vec3 &pos = vertices[first + i].position;
+                points.emplace_back(pos.x, -pos.z);
+            }
 
-                open_count--;
-                for (uint j = mid; j < open_count; ++j) {
-                    open_indices[j] = open_indices[j + 1];
-                }
+            ring_ends.clear();
+            for (size_t r = ring_begin; r < ring_end; ++r) {
+                ring_ends.push_back(rings.ring_ends[r] - point_begin);
             }
+
+            ret &= triangulator.triangulate(indices, points.data(), ring_ends.data(), ring_ends.size(), first + point_begin);
         }
+
+        return ret;
     }
 
 // --------------------------------------------------------------------------------
 
-    std::vector<Vertex> subdivide(uint hres, uint vres) const {
-        std::vector<Vertex> ret;
-        ret.reserve(hres * vres * base_vert_count + 1);
+    // The vertices are allocated from 'allocator', 'count' receives how many there are
+    Vertex *subdivide(Linear_Allocator &allocator, uint hres, uint vres, size_t &count) const {
+        Vertex *ret = allocator.alloc_array<Vertex>(hres * vres * base_vert_count);
+        count = 0;
 
-        std::vector<float> hcoefs = linspace(0.0f, 1.0f, hres);
-        std::vector<float> vcoefs = vres == hres ? hcoefs : linspace(0.0f, 1.0f, vres);
+        float *hcoefs = linspace(allocator, 0.0f, 1.0f, hres);
+        float *vcoefs = vres == hres ? hcoefs : linspace(allocator, 0.0f, 1.0f, vres);
 
         size_t next_idx;
         glm::vec3 p_lower, p, p_upper, q_lower, q, q_upper;
         glm::vec3 h, v, face_normal;
 
-        for (size_t j = 0; j < vcoefs.size(); ++j) {
+        for (size_t j = 0; j < vres; ++j) {
             for (size_t i = 0; i < base_vert_count; ++i) {
                 p_lower = vertices[i].position, p_upper = vertices[i + base_vert_count].position;
 
@@ -548,8 +467,8 @@ struct Mesh {
                 h = glm::normalize(q_lower - p_lower), v = glm::normalize(p_upper - p_lower);
                 face_normal = glm::normalize(glm::cross(h, v));
 
-                for (size_t k = 0; k < hcoefs.size(); ++k) {
-                    ret.push_back({glm::mix(p, q, hcoefs[k]), face_normal});
+                for (size_t k = 0; k < hres; ++k) {
+                    ret[count++] = {glm::mix(p, q, hcoefs[k]), face_normal};
                 }
             }
         }
@@ -557,17 +476,18 @@ struct Mesh {
         return ret;
     }
 
-    std::vector<Vertex> subdivide_aabb(int granularity[4]) const {
+    // The vertices are allocated from 'allocator', 'count' receives how many there are
+    Vertex *subdivide_aabb(Linear_Allocator &allocator, int granularity[4], size_t &count) const {
         uint hres = granularity[0];
         uint vres = granularity[1];
         uint dres = granularity[2];
 
-        std::vector<Vertex> ret;
-        ret.reserve(hres * vres * dres * 4);
+        Vertex *ret = allocator.alloc_array<Vertex>(hres * vres * dres * 4);
+        count = 0;
 
-        std::vector<float> hcoefs = linspace(0.0f, 1.0f, hres);
-        std::vector<float> vcoefs = vres == hres ? hcoefs : linspace(0.0f, 1.0f, vres);
-        std::vector<float> dcoefs = dres == hres ? hcoefs : linspace(0.0f, 1.0f, dres);
+        float *hcoefs = linspace(allocator, 0.0f, 1.0f, hres);
+        float *vcoefs = vres == hres ? hcoefs : linspace(allocator, 0.0f, 1.0f, vres);
+        float *dcoefs = dres == hres ? hcoefs : linspace(allocator, 0.0f, 1.0f, dres);
 
         glm::vec3 corners[8] = {
             // Bottom
@@ -596,7 +516,7 @@ struct Mesh {
 
         glm::vec3 h, v, face_normal;
 
-        for (size_t j = 0; j < vcoefs.size(); ++j) {
+        for (size_t j = 0; j < vres; ++j) {
             for (size_t i = 0; i < 4; ++i) {
                 p_lower_front = corners[i];
                 p_upper_front = corners[i + 4];
@@ -633,12 +553,12 @@ struct Mesh {
                 v = p_upper_front - p_lower_front;
                 face_normal = glm::normalize(glm::cross(v, h));
 
-                for (size_t d = 0; d < dcoefs.size(); ++d) {
+                for (size_t d = 0; d < dres; ++d) {
                     p = glm::mix(p_front, p_back, dcoefs[d]);
                     q = glm::mix(q_front, q_back, dcoefs[d]);
 
-                    for (size_t k = 0; k < hcoefs.size(); ++k) {
-                        ret.push_back({glm::mix(p, q, hcoefs[k]), face_normal});
+                    for (size_t k = 0; k < hres; ++k) {
+                        ret[count++] = {glm::mix(p, q, hcoefs[k]), face_normal};
                     }
                 }
             }
@@ -0,0 +1,183 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include "core.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+// --------------------------------------------------------------------------------
+
+#define KILOBYTES(x) (static_cast<size_t>(x) * 1024)
+#define MEGABYTES(x) (KILOBYTES(x) * 1024)
+
+// --------------------------------------------------------------------------------
+
+// Header in front of every allocation that did not fit in the arena, kept as a stack
+struct _Overflow_Block {
+    _Overflow_Block *prev;
+    size_t           size;
+};
+
+// Saved state of a 'Linear_Allocator', everything allocated after it is released at once
+struct Arena_Scope {
+    size_t offset;
+    size_t overflow_count;
+};
+
+// Bump allocator for short lived scratch memory. Allocations are released in bulk by ending
+// the scope they were made in, never one by one. When an allocation does not fit, it falls
+// back to the heap and the arena grows to its peak usage the next time it is fully reset, so
+// a loop that repeats the same allocations only ever hits the heap on its first iteration.
+struct Linear_Allocator {
+    ubyte           *data;
+    size_t           capacity;
+    size_t           offset;
+
+    _Overflow_Block *overflow;
+    size_t           overflow_count;
+    size_t           overflow_size;
+
+    // Counters, reset with 'reset_counters'
+    size_t           peak_usage;
+    size_t           num_allocations;
+    size_t           num_heap_allocations;
+
+    void init(size_t initial_capacity) {
+        data = static_cast<ubyte *>(malloc(initial_capacity));
+        ASSERT(data != nullptr);
+
+        capacity = initial_capacity;
+        offset = 0;
+
+        overflow = nullptr;
+        overflow_count = 0;
+        overflow_size = 0;
+
+        peak_usage = 0;
+        num_allocations = 0;
+        num_heap_allocations = 1;
+    }
+
+    void *alloc(size_t size, size_t alignment = 16) {
+        ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+        ++num_allocations;
+
+        size_t aligned_offset = (offset + alignment - 1) & ~(alignment - 1);
+
+        if (aligned_offset + size <= capacity) {
+            offset = aligned_offset + size;
+            peak_usage = MAX(peak_usage, offset + overflow_size);
+
+            return data + aligned_offset;
+        }
+
+        // NOTE(paalf): malloc alignment covers everything this is used for, i.e. up to 16 bytes
+        size_t header_size = (sizeof(_Overflow_Block) + 15) & ~static_cast<size_t>(15);
+
+        _Overflow_Block *block = static_cast<_Overflow_Block *>(malloc(header_size + size));
+        ASSERT(block != nullptr);
+
+        block->prev = overflow;
+        block->size = size;
+
+        overflow = block;
+        ++overflow_count;
+        overflow_size += size;
+
+        ++num_heap_allocations;
+        peak_usage = MAX(peak_usage, offset + overflow_size);
+
+        return reinterpret_cast<ubyte *>(block) + header_size;
+    }
+
+    template<typename T>
+    T *alloc_array(size_t count) {
+        return static_cast<T *>(alloc(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16));
+    }
+
+    Arena_Scope begin_scope() const {
+        return {offset, overflow_count};
+    }
+
+    void end_scope(Arena_Scope scope) {
+        ASSERT(scope.offset <= offset && scope.overflow_count <= overflow_count);
+
+        while (overflow_count > scope.overflow_count) {
+            _Overflow_Block *prev = overflow->prev;
+
+            overflow_size -= overflow->size;
+            free(overflow);
+
+            overflow = prev;
+            --overflow_count;
+        }
+
+        offset = scope.offset;
+
+        // Nothing is alive anymore, so this is the one point where the arena can move
+        if (offset == 0 && peak_usage > capacity) {
+            size_t new_capacity = MAX(peak_usage, 2 * capacity);
+
+            free(data);
+            data = static_cast<ubyte *>(malloc(new_capacity));
+            ASSERT(data != nullptr);
+
+            capacity = new_capacity;
+            ++num_heap_allocations;
+        }
+    }
+
+    // Only possible while nothing is allocated, i.e. before the outermost scope begins
+    void reserve(size_t size) {
+        ASSERT(offset == 0 && overflow_count == 0);
+
+        if (size <= capacity) {
+            return;
+        }
+
+        free(data);
+        data = static_cast<ubyte *>(malloc(size));
+        ASSERT(data != nullptr);
+
+        capacity = size;
+        ++num_heap_allocations;
+    }
+
+    void reset() {
+        end_scope({0, 0});
+    }
+
+    void reset_counters() {
+        peak_usage = offset + overflow_size;
+        num_allocations = 0;
+        num_heap_allocations = 0;
+    }
+};
+
+Linear_Allocator make_linear_allocator() {
+    Linear_Allocator ret = {};
+
+    return ret;
+}
+
+void destroy(Linear_Allocator &allocator) {
+    allocator.reset();
+
+    free(allocator.data);
+    allocator.data = nullptr;
+    allocator.capacity = 0;
+}
+
+// --------------------------------------------------------------------------------
+
+namespace global {
+// Scratch memory for the frame buffer readbacks, camera setups and screenshots. The indices
+// computation opens a scope per run and one per camera setup.
+extern Linear_Allocator transient_storage;
+} // namespace global
+
+// --------------------------------------------------------------------------------
+
+#endif // MEMORY_HPP
\ No newline at end of file
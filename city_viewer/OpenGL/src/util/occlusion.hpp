@@ -0,0 +1,323 @@
+#ifndef OCCLUSION_HPP
+#define OCCLUSION_HPP
+
+#include "geometry.hpp"
+
+// --------------------------------------------------------------------------------
+
+// Largest side of the last level reduced on the GPU, which is the one read back
+#define DEPTH_PYRAMID_READBACK_SIZE 128
+#define DEPTH_PYRAMID_MAX_LEVELS    32
+
+// --------------------------------------------------------------------------------
+
+// Area of the box's screen rectangle in normalized device coordinates, clipped to the screen,
+// so at most 4. Boxes crossing the near plane are taken to cover the whole screen.
+float get_screen_area(const AABB &box, const glm::mat4 &mvp, float near_plane) {
+    glm::vec2 rect_min = { FLT_MAX,  FLT_MAX};
+    glm::vec2 rect_max = {-FLT_MAX, -FLT_MAX};
+
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4 corner = {(i & 1) ? box.max.x : box.min.x,
+                            (i & 2) ? box.max.y : box.min.y,
+                            (i & 4) ? box.max.z : box.min.z, 1.0f};
+        glm::vec4 clip = mvp * corner;
+
+        if (clip.w < near_plane) {
+            return 4.0f;
+        }
+
+        glm::vec2 ndc = glm::vec2(clip) / clip.w;
+
+        rect_min = glm::min(rect_min, ndc);
+        rect_max = glm::max(rect_max, ndc);
+    }
+
+    rect_min = glm::clamp(rect_min, glm::vec2(-1.0f), glm::vec2(1.0f));
+    rect_max = glm::clamp(rect_max, glm::vec2(-1.0f), glm::vec2(1.0f));
+
+    return (rect_max.x - rect_min.x) * (rect_max.y - rect_min.y);
+}
+
+// --------------------------------------------------------------------------------
+
+// Max pyramid over the linear view distances of an indices frame buffer, for Hi-Z occlusion
+// culling. Level 'i' is the source size shifted right by i + 1, the last row and column of an
+// odd sized level are folded into the texel before them, so source pixel 'p' is always covered
+// by texel min(p >> (i + 1), size - 1). The levels down to DEPTH_PYRAMID_READBACK_SIZE are
+// reduced on the GPU, the last of them is read back and the rest is reduced on the CPU, where
+// the boxes are tested.
+struct Depth_Pyramid {
+    uint               frame_buffer;
+    uint               texture;
+
+    int                width;
+    int                height;
+
+    int                gpu_level_count;
+
+    // Levels from the one read back down to 1x1
+    int                cpu_level_count;
+    int                cpu_level_shifts[DEPTH_PYRAMID_MAX_LEVELS];
+    glm::ivec2         cpu_level_sizes[DEPTH_PYRAMID_MAX_LEVELS];
+    size_t             cpu_level_offsets[DEPTH_PYRAMID_MAX_LEVELS];
+    std::vector<float> cpu_texels;
+
+    void init(int source_width, int source_height) {
+        width = source_width;
+        height = source_height;
+
+        gpu_level_count = 0;
+        while ((width >> (gpu_level_count + 1)) > 0 && (height >> (gpu_level_count + 1)) > 0) {
+            ++gpu_level_count;
+
+            if ((width >> gpu_level_count) <= DEPTH_PYRAMID_READBACK_SIZE &&
+                (height >> gpu_level_count) <= DEPTH_PYRAMID_READBACK_SIZE) {
+                break;
+            }
+        }
+
+        // A single pixel wide source has nothing to reduce, 'is_occluded' then never culls
+        cpu_level_count = 0;
+        if (gpu_level_count == 0) {
+            return;
+        }
+
+        GL_CALL(glGenFramebuffers(1, &frame_buffer));
+
+        GL_CALL(glGenTextures(1, &texture));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, texture));
+
+        for (int i = 0; i < gpu_level_count; ++i) {
+            GL_CALL(glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_R32F, width >> (i + 1), height >> (i + 1), 1, 0, GL_RED, GL_FLOAT, nullptr));
+        }
+
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, gpu_level_count - 1));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+
+        glm::ivec2 size = {width >> gpu_level_count, height >> gpu_level_count};
+        size_t texel_count = 0;
+
+        while (true) {
+            ASSERT(cpu_level_count < DEPTH_PYRAMID_MAX_LEVELS);
+
+            cpu_level_shifts[cpu_level_count] = gpu_level_count + cpu_level_count;
+            cpu_level_sizes[cpu_level_count] = size;
+            cpu_level_offsets[cpu_level_count] = texel_count;
+            ++cpu_level_count;
+
+            texel_count += size.x * size.y;
+
+            if (size.x == 1 && size.y == 1) {
+                break;
+            }
+
+            size = glm::max(size / 2, glm::ivec2(1));
+        }
+
+        cpu_texels.resize(texel_count);
+    }
+
+    void release() {
+        if (texture) {
+            GL_CALL(glDeleteTextures(1, &texture));
+            texture = 0;
+        }
+
+        if (frame_buffer) {
+            GL_CALL(glDeleteFramebuffers(1, &frame_buffer));
+            frame_buffer = 0;
+        }
+    }
+
+    void resize(int new_width, int new_height) {
+        release();
+        init(new_width, new_height);
+    }
+
+// --------------------------------------------------------------------------------
+
+    // Reduces 'layer' of 'distance_texture', a 2D array texture the size of the pyramid's source.
+    // The read back stalls until the source has been rendered.
+    void build(uint distance_texture, int layer, Shader &shader, const Vertex_Array<Vertex> &empty_vertex_array) {
+        if (gpu_level_count == 0) {
+            return;
+        }
+
+        int viewport[4];
+        GL_CALL(glGetIntegerv(GL_VIEWPORT, viewport));
+
+        int draw_frame_buffer;
+        GL_CALL(glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_frame_buffer));
+
+        bool culling = glIsEnabled(GL_CULL_FACE);
+        GL_CALL(glDisable(GL_CULL_FACE));
+        GL_CALL(glDisable(GL_DEPTH_TEST));
+
+        GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer));
+
+        shader.bind();
+        shader.set_uniform_1i(UNIFORM_SOURCE, 0);
+
+        GL_CALL(glActiveTexture(GL_TEXTURE0));
+
+        empty_vertex_array.bind();
+
+        for (int i = 0; i < gpu_level_count; ++i) {
+            GL_CALL(glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, i, 0));
+
+            // NOTE(paalf): reading the level above the one being written would be a feedback
+            // loop unless the sampled levels are restricted to it
+            if (i == 0) {
+                GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, distance_texture));
+                shader.set_uniform_1i(UNIFORM_SOURCE_LAYER, layer);
+            } else {
+                GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, texture));
+                GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, i - 1));
+                GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, i - 1));
+                shader.set_uniform_1i(UNIFORM_SOURCE_LAYER, 0);
+            }
+
+            GL_CALL(glViewport(0, 0, width >> (i + 1), height >> (i + 1)));
+            GL_CALL(glDrawArrays(GL_TRIANGLES, 0, 3));
+        }
+
+        empty_vertex_array.unbind();
+
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, texture));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, gpu_level_count - 1));
+
+        GL_CALL(glGetTexImage(GL_TEXTURE_2D_ARRAY, gpu_level_count - 1, GL_RED, GL_FLOAT, cpu_texels.data()));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+
+        GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, draw_frame_buffer));
+        GL_CALL(glViewport(viewport[0], viewport[1], viewport[2], viewport[3]));
+
+        GL_CALL(glEnable(GL_DEPTH_TEST));
+        if (culling) {
+            GL_CALL(glEnable(GL_CULL_FACE));
+        }
+
+        // Same folding as the shader for the rest of the levels
+        for (int i = 1; i < cpu_level_count; ++i) {
+            glm::ivec2 src_size = cpu_level_sizes[i - 1];
+            glm::ivec2 dst_size = cpu_level_sizes[i];
+
+            const float *src = cpu_texels.data() + cpu_level_offsets[i - 1];
+            float *dst = cpu_texels.data() + cpu_level_offsets[i];
+
+            for (int y = 0; y < dst_size.y; ++y) {
+                int y_end = y == dst_size.y - 1 ? src_size.y : 2 * y + 2;
+
+                for (int x = 0; x < dst_size.x; ++x) {
+                    int x_end = x == dst_size.x - 1 ? src_size.x : 2 * x + 2;
+
+                    float max_distance = 0.0f;
+                    for (int sy = MIN(2 * y, src_size.y - 1); sy < y_end; ++sy) {
+                        for (int sx = MIN(2 * x, src_size.x - 1); sx < x_end; ++sx) {
+                            max_distance = MAX(max_distance, src[sy * src_size.x + sx]);
+                        }
+                    }
+
+                    dst[y * dst_size.x + x] = max_distance;
+                }
+            }
+        }
+    }
+
+// --------------------------------------------------------------------------------
+
+    // Conservative: true only when the box is behind everything in the pyramid over its whole
+    // screen rectangle. The box's nearest view distance is the smallest clip space w of its
+    // corners, compared with a margin of a few depth buffer steps so that boxes which could
+    // only tie with the occluders in the depth test are never culled.
+    bool is_occluded(const AABB &box, const glm::mat4 &mvp, float near_plane) const {
+        if (cpu_level_count == 0) {
+            return false;
+        }
+
+        glm::vec2 rect_min = { FLT_MAX,  FLT_MAX};
+        glm::vec2 rect_max = {-FLT_MAX, -FLT_MAX};
+        float near_distance = FLT_MAX;
+
+        for (int i = 0; i < 8; ++i) {
+            glm::vec4 corner = {(i & 1) ? box.max.x : box.min.x,
+                                (i & 2) ? box.max.y : box.min.y,
+                                (i & 4) ? box.max.z : box.min.z, 1.0f};
+            glm::vec4 clip = mvp * corner;
+
+            // Crosses the near plane, its screen rectangle is unbounded
+            if (clip.w < near_plane) {
+                return false;
+            }
+
+            glm::vec2 ndc = glm::vec2(clip) / clip.w;
+
+            rect_min = glm::min(rect_min, ndc);
+            rect_max = glm::max(rect_max, ndc);
+            near_distance = MIN(near_distance, clip.w);
+        }
+
+        // One pixel of slack on every side for the rasterization rules
+        int x0 = static_cast<int>(floorf((rect_min.x * 0.5f + 0.5f) * width)) - 1;
+        int y0 = static_cast<int>(floorf((rect_min.y * 0.5f + 0.5f) * height)) - 1;
+        int x1 = static_cast<int>(floorf((rect_max.x * 0.5f + 0.5f) * width)) + 1;
+        int y1 = static_cast<int>(floorf((rect_max.y * 0.5f + 0.5f) * height)) + 1;
+
+        x0 = CLAMP(x0, 0, width - 1);
+        y0 = CLAMP(y0, 0, height - 1);
+        x1 = CLAMP(x1, 0, width - 1);
+        y1 = CLAMP(y1, 0, height - 1);
+
+        // Finest level where the rectangle covers at most 2x2 texels
+        int level = 0;
+        glm::ivec2 t0, t1;
+
+        while (true) {
+            int shift = cpu_level_shifts[level];
+            glm::ivec2 size = cpu_level_sizes[level];
+
+            t0 = glm::min(glm::ivec2(x0 >> shift, y0 >> shift), size - 1);
+            t1 = glm::min(glm::ivec2(x1 >> shift, y1 >> shift), size - 1);
+
+            if ((t1.x - t0.x <= 1 && t1.y - t0.y <= 1) || level == cpu_level_count - 1) {
+                break;
+            }
+
+            ++level;
+        }
+
+        const float *texels = cpu_texels.data() + cpu_level_offsets[level];
+        int level_width = cpu_level_sizes[level].x;
+
+        float max_distance = 0.0f;
+        for (int y = t0.y; y <= t1.y; ++y) {
+            for (int x = t0.x; x <= t1.x; ++x) {
+                max_distance = MAX(max_distance, texels[y * level_width + x]);
+            }
+        }
+
+        // A 24 bit depth buffer step is roughly distance^2 / (near * 2^24), keep four of them
+        float margin = max_distance * max_distance / (near_plane * 4194304.0f);
+
+        return near_distance > max_distance + margin;
+    }
+};
+
+Depth_Pyramid make_depth_pyramid() {
+    Depth_Pyramid ret = {};
+
+    return ret;
+}
+
+void destroy(Depth_Pyramid &pyramid) {
+    pyramid.release();
+}
+
+// --------------------------------------------------------------------------------
+
+#endif // OCCLUSION_HPP
\ No newline at end of file
@@ -2,11 +2,13 @@
 #define OPENGL_HPP
 
 #include "file.hpp"
+#include "memory.hpp"
 
 #include <GL/glew.h>
 #include <stb_image/stb_image_write.h>
 #include <glm/glm.hpp>
 
+#include <atomic>
 #include <unordered_map>
 
 // --------------------------------------------------------------------------------
@@ -44,6 +46,60 @@ const char *get_framebuffer_status_name(uint fb_err_code) {
     }
 }
 
+const char *get_gl_debug_type_name(uint type) {
+    switch (type) {
+    case GL_DEBUG_TYPE_ERROR:                          return "error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:            return "deprecated behavior";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:             return "undefined behavior";
+    case GL_DEBUG_TYPE_PORTABILITY:                    return "portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:                    return "performance";
+    case GL_DEBUG_TYPE_MARKER:                         return "marker";
+    default:                                           return "message";
+    }
+}
+
+const char *get_gl_debug_severity_name(uint severity) {
+    switch (severity) {
+    case GL_DEBUG_SEVERITY_HIGH:                       return "high";
+    case GL_DEBUG_SEVERITY_MEDIUM:                     return "medium";
+    case GL_DEBUG_SEVERITY_LOW:                        return "low";
+    case GL_DEBUG_SEVERITY_NOTIFICATION:               return "notification";
+    default:                                           return "unknown";
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+// Least severe debug message reported, every level also reports the ones above it
+enum Debug_Severity : ubyte {
+    DEBUG_SEVERITY_OFF,
+    DEBUG_SEVERITY_HIGH,
+    DEBUG_SEVERITY_MEDIUM,
+    DEBUG_SEVERITY_LOW,
+    DEBUG_SEVERITY_NOTIFICATION,
+
+    DEBUG_SEVERITY_COUNT
+};
+
+const char *debug_severity_names[] = {"Off", "High", "Medium", "Low", "Notification"};
+static_assert(ARRAY_SIZE(debug_severity_names) == DEBUG_SEVERITY_COUNT, "Every debug severity needs a name.");
+
+// Where a 'GL_CALL' was made from, one per call site
+struct Gl_Call_Site {
+    const char *file_path;
+    int         line_no;
+    const char *proc_name;
+};
+
+// NOTE(paalf): The driver reports errors through 'gl_debug_callback' when KHR_debug is supported,
+// so a call only costs a store of its site. The glGetError polling is kept for debug builds
+// without it.
+bool                              gl_debug_output   = false;
+Debug_Severity                    gl_debug_severity = DEBUG_SEVERITY_OFF;
+
+// Last call made, the context of the messages. Asynchronous messages may belong to an earlier one.
+std::atomic<const Gl_Call_Site *> gl_call_site      = {nullptr};
+
 void gl_clear_error() {
     while (glGetError() != GL_NO_ERROR);
 }
@@ -61,25 +117,122 @@ bool gl_log_call(const char *file_path, int line_no, const char *proc_name) {
 }
 
 #ifdef DEBUG_MODE
-#   define GL_CALL(proc) \
-        gl_clear_error(); \
-        proc; \
-        if (!gl_log_call(__FILE__, __LINE__, #proc)) { \
+#   define GL_CHECK_BEGIN() \
+        if (!gl_debug_output) { \
+            gl_clear_error(); \
+        }
+#   define GL_CHECK_END(proc) \
+        if (!gl_debug_output && !gl_log_call(__FILE__, __LINE__, #proc)) { \
             HALT(); \
         }
 #else
-#   define GL_CALL(proc)
-#endif
+#   define GL_CHECK_BEGIN()
+#   define GL_CHECK_END(proc)
+#endif // DEBUG_MODE
+
+#define GL_CALL(proc) \
+    do { \
+        static const Gl_Call_Site _call_site = {__FILE__, __LINE__, #proc}; \
+        gl_call_site.store(&_call_site, std::memory_order_relaxed); \
+        GL_CHECK_BEGIN(); \
+        proc; \
+        GL_CHECK_END(proc); \
+    } while (0)
+
+void GLAPIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint, GLenum severity,
+                                  GLsizei, const GLchar *message, const void *) {
+    // Only read in debug builds
+    (void)source;
+
+    const Gl_Call_Site *call_site = gl_call_site.load(std::memory_order_relaxed);
+
+    const char *file_path = call_site != nullptr ? call_site->file_path : "?";
+    int         line_no   = call_site != nullptr ? call_site->line_no : 0;
+    const char *proc_name = call_site != nullptr ? call_site->proc_name : "?";
+
+#ifdef DEBUG_MODE
+    constexpr const char *site_kind = "OpenGL procedure";
+#else
+    constexpr const char *site_kind = "OpenGL, after procedure";
+#endif // DEBUG_MODE
+
+    fprintf(
+        stderr,
+        "\x1b[97m%s(%d)\033[0m: %s \x1b[97m'%s'\033[0m: %s %s \x1b[91m%s\033[0m.\n",
+        file_path, line_no, site_kind, proc_name,
+        get_gl_debug_severity_name(severity), get_gl_debug_type_name(type), message
+    );
+
+#ifdef DEBUG_MODE
+    // Synchronous in debug builds, so this still stops in the failing call like glGetError did
+    if (source == GL_DEBUG_SOURCE_API && type == GL_DEBUG_TYPE_ERROR) {
+        HALT();
+    }
+#endif // DEBUG_MODE
+}
+
+// Messages below the severity are discarded by the driver, they are never generated
+void gl_set_debug_severity(Debug_Severity severity) {
+    if (!gl_debug_output) {
+        return;
+    }
+
+    static const uint gl_severities[] = {
+        GL_DEBUG_SEVERITY_HIGH, GL_DEBUG_SEVERITY_MEDIUM, GL_DEBUG_SEVERITY_LOW, GL_DEBUG_SEVERITY_NOTIFICATION
+    };
+    static_assert(ARRAY_SIZE(gl_severities) == DEBUG_SEVERITY_COUNT - 1, "Every debug severity needs a GL one.");
+
+    for (uint i = 0; i < ARRAY_SIZE(gl_severities); ++i) {
+        GLboolean enabled = i < severity ? GL_TRUE : GL_FALSE;
+        GL_CALL(glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, gl_severities[i], 0, nullptr, enabled));
+    }
+
+    gl_debug_severity = severity;
+}
+
+void gl_init_debug_output() {
+    if (!GLEW_VERSION_4_3 && !GLEW_KHR_debug) {
+        LOG_WARNING("KHR_debug is not supported, OpenGL errors are only checked in debug builds.");
+        return;
+    }
+
+    gl_debug_output = true;
+
+    GL_CALL(glEnable(GL_DEBUG_OUTPUT));
+
+#ifdef DEBUG_MODE
+    GL_CALL(glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS));
+    GL_CALL(glDebugMessageCallback(gl_debug_callback, nullptr));
+
+    gl_set_debug_severity(DEBUG_SEVERITY_MEDIUM);
+#else
+    GL_CALL(glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS));
+    GL_CALL(glDebugMessageCallback(gl_debug_callback, nullptr));
+
+    gl_set_debug_severity(DEBUG_SEVERITY_HIGH);
+#endif // DEBUG_MODE
+}
 
 // --------------------------------------------------------------------------------
 
 void gl_init() {
     ubyte status = glewInit();
+
+#ifdef HEADLESS_MODE
+    // NOTE(paalf): GLX builds of GLEW resolve every GL entry point before failing on
+    // the missing X display, so a surfaceless EGL context is still usable
+    if (status == GLEW_ERROR_NO_GLX_DISPLAY) {
+        status = GLEW_OK;
+    }
+#endif // HEADLESS_MODE
+
     if (status != GLEW_OK) {
         LOG_ERROR("Failed to initialize GLEW: %s", glewGetErrorString(status));
         HALT();
     }
 
+    gl_init_debug_output();
+
     fprintf(stderr, "-- OpenGL Loaded --\n");
     GL_CALL(fprintf(stderr, "Vendor:   %s\n", glGetString(GL_VENDOR)));
     GL_CALL(fprintf(stderr, "Version:  %s\n", glGetString(GL_VERSION)));
@@ -116,6 +269,32 @@ void destroy(Vertex_Buffer &vb) {
 
 // --------------------------------------------------------------------------------
 
+// NOTE(paalf): member specializations inside the class body only compile on MSVC,
+// so the per-type attribute format lives in a namespace-scope trait instead
+template<typename U>
+struct Vertex_Attrib_Format;
+
+template<>
+struct Vertex_Attrib_Format<float> {
+    static constexpr uint type       = GL_FLOAT;
+    static constexpr bool normalized = false;
+    static constexpr bool integer    = false;
+};
+
+template<>
+struct Vertex_Attrib_Format<uint> {
+    static constexpr uint type       = GL_UNSIGNED_INT;
+    static constexpr bool normalized = false;
+    static constexpr bool integer    = true;
+};
+
+template<>
+struct Vertex_Attrib_Format<ubyte> {
+    static constexpr uint type       = GL_UNSIGNED_BYTE;
+    static constexpr bool normalized = true;
+    static constexpr bool integer    = false;
+};
+
 template<typename T>
 struct Vertex_Array {
     uint id;
@@ -126,32 +305,28 @@ struct Vertex_Array {
 
     template<typename U>
     void push(uint num_vals, uint offset) {
-        static_assert(false, "Unsupported element type.");
+        push_attrib<U>(num_vals, sizeof(T), offset);
     }
 
-    template<>
-    void push<float>(uint num_vals, uint offset) {
-        GL_CALL(glEnableVertexAttribArray(count));
-        GL_CALL(glVertexAttribPointer(count, num_vals, GL_FLOAT, GL_FALSE, sizeof(T),
-                                      reinterpret_cast<const void *>(offset)));
-
-        ++count;
+    // Attribute of the bound buffer of 'S', which only advances once every 'divisor' instances
+    template<typename S, typename U>
+    void push_instanced(uint num_vals, uint offset, uint divisor) {
+        GL_CALL(glVertexAttribDivisor(count, divisor));
+        push_attrib<U>(num_vals, sizeof(S), offset);
     }
 
-    template<>
-    void push<uint>(uint num_vals, uint offset) {
-        GL_CALL(glEnableVertexAttribArray(count));
-        GL_CALL(glVertexAttribPointer(count, num_vals, GL_UNSIGNED_INT, GL_FALSE, sizeof(T),
-                                      reinterpret_cast<const void *>(offset)));
-
-        ++count;
-    }
+    template<typename U>
+    void push_attrib(uint num_vals, uint stride, uint offset) {
+        const void *ptr = reinterpret_cast<const void *>(static_cast<size_t>(offset));
 
-    template<>
-    void push<ubyte>(uint num_vals, uint offset) {
         GL_CALL(glEnableVertexAttribArray(count));
-        GL_CALL(glVertexAttribPointer(count, num_vals, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(T),
-                                      reinterpret_cast<const void *>(offset)));
+
+        if (Vertex_Attrib_Format<U>::integer) {
+            GL_CALL(glVertexAttribIPointer(count, num_vals, Vertex_Attrib_Format<U>::type, stride, ptr));
+        } else {
+            GL_CALL(glVertexAttribPointer(count, num_vals, Vertex_Attrib_Format<U>::type,
+                                          Vertex_Attrib_Format<U>::normalized ? GL_TRUE : GL_FALSE, stride, ptr));
+        }
 
         ++count;
     }
@@ -198,6 +373,173 @@ void destroy(Index_Buffer &ib) {
 
 // --------------------------------------------------------------------------------
 
+// Layout of the commands read by 'glMultiDrawElementsIndirect', fixed by the specification
+struct Draw_Elements_Command {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int  base_vertex;
+    uint base_instance;
+};
+
+struct Indirect_Buffer {
+    uint id;
+
+    inline void bind() const                { GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, id)); }
+    inline void unbind() const              { GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0)); }
+
+    // As a storage buffer, for commands written by a compute shader
+    inline void bind_base(uint index) const { GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, id)); }
+
+    void init(size_t count, uint usage = GL_DYNAMIC_COPY) const {
+        bind();
+        GL_CALL(glBufferData(GL_DRAW_INDIRECT_BUFFER, count * sizeof(Draw_Elements_Command), nullptr, usage));
+        unbind();
+    }
+
+    // Respecifies the whole buffer, so draws still reading the previous commands don't stall it
+    void write(const Draw_Elements_Command *commands, size_t count) const {
+        bind();
+        GL_CALL(glBufferData(GL_DRAW_INDIRECT_BUFFER, count * sizeof(Draw_Elements_Command), commands, GL_STREAM_DRAW));
+        unbind();
+    }
+};
+
+Indirect_Buffer make_indirect_buffer() {
+    Indirect_Buffer ret = {};
+    GL_CALL(glGenBuffers(1, &ret.id));
+
+    return ret;
+}
+
+void destroy(Indirect_Buffer &ib) {
+    GL_CALL(glDeleteBuffers(1, &ib.id));
+}
+
+// --------------------------------------------------------------------------------
+
+struct Storage_Buffer {
+    uint id;
+
+    inline void bind() const                { GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, id)); }
+    inline void unbind() const              { GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0)); }
+    inline void bind_base(uint index) const { GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, id)); }
+
+    void init(const void *data, size_t size, uint usage = GL_DYNAMIC_COPY) const {
+        bind();
+        GL_CALL(glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, usage));
+        unbind();
+    }
+
+    void write(const void *data, size_t size, size_t offset = 0) const {
+        bind();
+        GL_CALL(glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, data));
+        unbind();
+    }
+
+    void read(void *dst, size_t size, size_t offset = 0) const {
+        bind();
+        GL_CALL(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, dst));
+        unbind();
+    }
+
+    // Queued on the GPU like a draw, the CPU does not wait for it
+    void copy_to(const Storage_Buffer &dst, size_t size) const {
+        GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, id));
+        GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, dst.id));
+        GL_CALL(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size));
+        GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+        GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    }
+};
+
+Storage_Buffer make_storage_buffer() {
+    Storage_Buffer ret = {};
+    GL_CALL(glGenBuffers(1, &ret.id));
+
+    return ret;
+}
+
+void destroy(Storage_Buffer &sb) {
+    GL_CALL(glDeleteBuffers(1, &sb.id));
+}
+
+// --------------------------------------------------------------------------------
+
+struct Uniform_Buffer {
+    uint id;
+
+    inline void bind() const                { GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, id)); }
+    inline void unbind() const              { GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, 0)); }
+    inline void bind_base(uint index) const { GL_CALL(glBindBufferBase(GL_UNIFORM_BUFFER, index, id)); }
+
+    void init(const void *data, size_t size, uint usage = GL_DYNAMIC_DRAW) const {
+        bind();
+        GL_CALL(glBufferData(GL_UNIFORM_BUFFER, size, data, usage));
+        unbind();
+    }
+
+    void write(const void *data, size_t size, size_t offset = 0) const {
+        bind();
+        GL_CALL(glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data));
+        unbind();
+    }
+};
+
+Uniform_Buffer make_uniform_buffer() {
+    Uniform_Buffer ret = {};
+    GL_CALL(glGenBuffers(1, &ret.id));
+
+    return ret;
+}
+
+void destroy(Uniform_Buffer &ub) {
+    GL_CALL(glDeleteBuffers(1, &ub.id));
+}
+
+// --------------------------------------------------------------------------------
+
+struct Pixel_Pack_Buffer {
+    uint id;
+
+    inline void bind() const   { GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, id)); }
+    inline void unbind() const { GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0)); }
+
+    void init(size_t size) const {
+        bind();
+        GL_CALL(glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ));
+        unbind();
+    }
+
+    // Leaves the buffer bound until 'unmap' is called
+    const void *map(size_t size, size_t offset = 0) const {
+        const void *ptr = nullptr;
+
+        bind();
+        GL_CALL(ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, offset, size, GL_MAP_READ_BIT));
+
+        return ptr;
+    }
+
+    void unmap() const {
+        GL_CALL(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+        unbind();
+    }
+};
+
+Pixel_Pack_Buffer make_pixel_pack_buffer() {
+    Pixel_Pack_Buffer ret = {};
+    GL_CALL(glGenBuffers(1, &ret.id));
+
+    return ret;
+}
+
+void destroy(Pixel_Pack_Buffer &pb) {
+    GL_CALL(glDeleteBuffers(1, &pb.id));
+}
+
+// --------------------------------------------------------------------------------
+
 struct Frame_Buffer {
     uint id;
 
@@ -224,12 +566,17 @@ struct Frame_Buffer {
         } else {
             GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
         }
+        // No mipmaps are ever generated, so the default minification filter would leave the texture incomplete
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
         GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, picking_texture, 0));
 
         // Create the texture object for the depth buffer
         GL_CALL(glGenTextures(1, &depth_texture));
         GL_CALL(glBindTexture(GL_TEXTURE_2D, depth_texture));
         GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
         GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0));
 
         // Verify that the FBO is correct
@@ -275,13 +622,13 @@ struct Frame_Buffer {
         return picked_id;
     }
 
+    // The retrieved pixels live in 'global::transient_storage' until the caller's scope ends
     ubyte *retrieve_color_pixels() const {
         constexpr int num_channels = 4;
         int stride = num_channels * width;
         int count = stride * height;
 
-        ubyte *color_pixels = static_cast<ubyte *>(malloc(count * sizeof(ubyte)));
-        ASSERT(color_pixels != nullptr);
+        ubyte *color_pixels = global::transient_storage.alloc_array<ubyte>(count);
 
         bind();
         GL_CALL(glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, color_pixels));
@@ -295,8 +642,7 @@ struct Frame_Buffer {
         int stride = num_channels * width;
         int count = stride * height;
 
-        float *pos_pixels = static_cast<float *>(malloc(count * sizeof(float)));
-        ASSERT(pos_pixels != nullptr);
+        float *pos_pixels = global::transient_storage.alloc_array<float>(count);
 
         bind();
         GL_CALL(glReadPixels(0, 0, width, height, GL_RG32F, GL_FLOAT, pos_pixels));
@@ -310,8 +656,7 @@ struct Frame_Buffer {
         int stride = num_channels * width;
         int count = stride * height;
 
-        float *depth_pixels = static_cast<float *>(malloc(count * sizeof(float)));
-        ASSERT(depth_pixels != nullptr);
+        float *depth_pixels = global::transient_storage.alloc_array<float>(count);
 
         bind();
         GL_CALL(glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, depth_pixels));
@@ -325,8 +670,9 @@ struct Frame_Buffer {
         int stride = num_channels * width;
         int count = stride * height;
 
-        ubyte *buff = static_cast<ubyte *>(malloc(count * sizeof(ubyte)));
-        ASSERT(buff != nullptr);
+        Arena_Scope scope = global::transient_storage.begin_scope();
+
+        ubyte *buff = global::transient_storage.alloc_array<ubyte>(count);
 
         bind();
         GL_CALL(glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, buff));
@@ -334,7 +680,7 @@ struct Frame_Buffer {
 
         stbi_write_png(filepath, width, height, num_channels, buff, stride);
 
-        free(buff);
+        global::transient_storage.end_scope(scope);
     }
 };
 
@@ -351,34 +697,306 @@ void destroy(Frame_Buffer &fb) {
 
 // --------------------------------------------------------------------------------
 
+// Render target of the indices pass: one class id and one linear view distance per pixel.
+// Every attachment is a texture array so that several camera setups can be rendered at
+// once, one per layer; draws without a geometry shader only ever touch layer 0.
+struct Indices_Frame_Buffer {
+    uint id;
+    uint read_id;
+
+    int width;
+    int height;
+    int layers;
+
+    uint class_texture;
+    uint distance_texture;
+    uint depth_texture;
+
+    inline void bind() const   { GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, id)); }
+    inline void unbind() const { GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0)); }
+
+    void init(int win_width, int win_height, int num_layers = 1) {
+        width = win_width;
+        height = win_height;
+        layers = num_layers;
+
+        bind();
+
+        // Class ids, written as unsigned integers by the indices shaders
+        GL_CALL(glGenTextures(1, &class_texture));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, class_texture));
+        GL_CALL(glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8UI, width, height, layers, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        GL_CALL(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, class_texture, 0));
+
+        // Linear view distances
+        GL_CALL(glGenTextures(1, &distance_texture));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, distance_texture));
+        GL_CALL(glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, width, height, layers, 0, GL_RED, GL_FLOAT, nullptr));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        GL_CALL(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, distance_texture, 0));
+
+        // The depth buffer is only needed for the depth test, but layered frame buffers
+        // need every attachment to be layered, so it cannot be a renderbuffer
+        GL_CALL(glGenTextures(1, &depth_texture));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, depth_texture));
+        GL_CALL(glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, width, height, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        GL_CALL(glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0));
+
+        const uint draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        GL_CALL(glDrawBuffers(ARRAY_SIZE(draw_buffers), draw_buffers));
+
+        // Verify that the FBO is correct
+        uint status = 0;
+        GL_CALL(status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            LOG_ERROR("Failed to create indices frame buffer: %s", get_framebuffer_status_name(status));
+            HALT();
+        }
+
+        // Restore the default framebuffer
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+        unbind();
+    }
+
+    void release() {
+        if (class_texture) {
+            GL_CALL(glDeleteTextures(1, &class_texture));
+            class_texture = 0;
+        }
+
+        if (distance_texture) {
+            GL_CALL(glDeleteTextures(1, &distance_texture));
+            distance_texture = 0;
+        }
+
+        if (depth_texture) {
+            GL_CALL(glDeleteTextures(1, &depth_texture));
+            depth_texture = 0;
+        }
+    }
+
+    void resize(int new_width, int new_height, int new_layers) {
+        release();
+        init(new_width, new_height, new_layers);
+    }
+
+    inline void resize(int new_width, int new_height) { resize(new_width, new_height, layers); }
+
+    // Integer attachments cannot be cleared with glClear, so every attachment is cleared
+    // explicitly (all layers at once); 'max_distance' is stored where nothing was drawn
+    void clear(uint class_id, float max_distance) const {
+        const uint  class_value[4]    = {class_id, 0, 0, 0};
+        const float distance_value[4] = {max_distance, 0.0f, 0.0f, 0.0f};
+        const float depth_value       = 1.0f;
+
+        GL_CALL(glClearBufferuiv(GL_COLOR, 0, class_value));
+        GL_CALL(glClearBufferfv(GL_COLOR, 1, distance_value));
+        GL_CALL(glClearBufferfv(GL_DEPTH, 0, &depth_value));
+    }
+
+    // The retrieved pixels live in 'global::transient_storage' until the caller's scope ends
+    ubyte *retrieve_class_pixels(int layer = 0) const {
+        ubyte *class_pixels = global::transient_storage.alloc_array<ubyte>(width * height);
+
+        pack_class_pixels(class_pixels, layer);
+
+        return class_pixels;
+    }
+
+    float *retrieve_distance_pixels(int layer = 0) const {
+        float *distance_pixels = global::transient_storage.alloc_array<float>(width * height);
+
+        pack_distance_pixels(distance_pixels, layer);
+
+        return distance_pixels;
+    }
+
+    // Reads one layer of 'texture' through the read-only frame buffer, since glReadPixels
+    // only sees layer 0 of a layered attachment
+    void pack_layer(uint texture, int layer, uint format, uint type, void *dst) const {
+        GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, read_id));
+        GL_CALL(glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, layer));
+        GL_CALL(glReadBuffer(GL_COLOR_ATTACHMENT0));
+        GL_CALL(glReadPixels(0, 0, width, height, format, type, dst));
+        GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, 0));
+    }
+
+    // With a pixel pack buffer bound, 'dst' is an offset into it and the copy is asynchronous
+    void pack_class_pixels(void *dst, int layer = 0) const {
+        // Rows of single bytes are not 4-byte aligned for arbitrary widths
+        GL_CALL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+        pack_layer(class_texture, layer, GL_RED_INTEGER, GL_UNSIGNED_BYTE, dst);
+        GL_CALL(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+    }
+
+    void pack_distance_pixels(void *dst, int layer = 0) const {
+        pack_layer(distance_texture, layer, GL_RED, GL_FLOAT, dst);
+    }
+
+    void pack_class_pixels(const Pixel_Pack_Buffer &pbo, size_t offset, int layer = 0) const {
+        pbo.bind();
+        pack_class_pixels(reinterpret_cast<void *>(offset), layer);
+        pbo.unbind();
+    }
+
+    void pack_distance_pixels(const Pixel_Pack_Buffer &pbo, size_t offset, int layer = 0) const {
+        pbo.bind();
+        pack_distance_pixels(reinterpret_cast<void *>(offset), layer);
+        pbo.unbind();
+    }
+};
+
+Indices_Frame_Buffer make_indices_frame_buffer() {
+    Indices_Frame_Buffer ret = {};
+    GL_CALL(glGenFramebuffers(1, &ret.id));
+    GL_CALL(glGenFramebuffers(1, &ret.read_id));
+
+    return ret;
+}
+
+void destroy(Indices_Frame_Buffer &fb) {
+    fb.release();
+    GL_CALL(glDeleteFramebuffers(1, &fb.read_id));
+    GL_CALL(glDeleteFramebuffers(1, &fb.id));
+}
+
+// --------------------------------------------------------------------------------
+
+// Every uniform a shader sets from the CPU. The locations are looked up once, when the program is
+// linked, so setting one is just an array access.
+enum Uniform_Handle : ubyte {
+    UNIFORM_COLOR,
+    UNIFORM_OBJECT_INDEX,
+    UNIFORM_OBJECT_COUNT,
+    UNIFORM_PICKED_MESH,
+    UNIFORM_PICKED_COLOR,
+    UNIFORM_PANORAMA_CLASSES,
+    UNIFORM_PANORAMA_DISTANCES,
+    UNIFORM_FACE_ROTATIONS,
+    UNIFORM_FRONT,
+    UNIFORM_RIGHT,
+    UNIFORM_UP,
+    UNIFORM_TAN_HALF_FOV,
+    UNIFORM_VIEWPORT_SIZE,
+    UNIFORM_FAR,
+    UNIFORM_SOURCE,
+    UNIFORM_SOURCE_LAYER,
+    UNIFORM_LAYER,
+    UNIFORM_PARTIAL_COUNT,
+    UNIFORM_RESOLVE,
+    UNIFORM_PLANES,
+    UNIFORM_VIEW_COUNT,
+    UNIFORM_CULLING,
+    UNIFORM_LIST_OFFSET,
+    UNIFORM_LIST_SIZE,
+    UNIFORM_INSTANCE_COUNT,
+    UNIFORM_STATS_OFFSET,
+    UNIFORM_COUNT
+};
+
+const char *uniform_names[] = {
+    "uColor",
+    "uObjectIndex",
+    "uObjectCount",
+    "uPickedMesh",
+    "uPickedColor",
+    "uPanoramaClasses",
+    "uPanoramaDistances",
+    "uFaceRotations",
+    "uFront",
+    "uRight",
+    "uUp",
+    "uTanHalfFov",
+    "uViewportSize",
+    "uFar",
+    "uSource",
+    "uSourceLayer",
+    "uLayer",
+    "uPartialCount",
+    "uResolve",
+    "uPlanes",
+    "uViewCount",
+    "uCulling",
+    "uListOffset",
+    "uListSize",
+    "uInstanceCount",
+    "uStatsOffset"
+};
+
+static_assert(ARRAY_SIZE(uniform_names) == UNIFORM_COUNT, "Every uniform handle needs a name.");
+static_assert(UNIFORM_COUNT <= 64, "The missing uniforms of a shader are a 64-bit mask.");
+
+// Uniform blocks are bound to the binding point of their handle in every program that has them
+enum Uniform_Block : ubyte {
+    UNIFORM_BLOCK_VIEWS,
+    UNIFORM_BLOCK_FRAME,
+    UNIFORM_BLOCK_COUNT
+};
+
+const char *uniform_block_names[] = {
+    "Views",
+    "Frame"
+};
+
+static_assert(ARRAY_SIZE(uniform_block_names) == UNIFORM_BLOCK_COUNT, "Every uniform block needs a name.");
+
 struct Shader {
-    uint                                 id;
-    std::unordered_map<std::string, int> uniform_locations;
+    uint     id;
+    int      uniform_locations[UNIFORM_COUNT];
+
+    // Handles set while the program doesn't have them, only warned about once
+    uint64_t missing_uniforms;
 
-    int get_uniform_location(const char *name) {
-        auto iter = uniform_locations.find(name);
-        if (iter != uniform_locations.end()) {
-            return iter->second;
+    void resolve_uniforms() {
+        for (uint i = 0; i < UNIFORM_COUNT; ++i) {
+            GL_CALL(uniform_locations[i] = glGetUniformLocation(id, uniform_names[i]));
         }
 
-        int location;
-        GL_CALL(location = glGetUniformLocation(id, name));
-        if (location == -1) {
-            LOG_WARNING("Uniform '%s' doesn't exist.", name);
+        uint block_idx;
+        for (uint i = 0; i < UNIFORM_BLOCK_COUNT; ++i) {
+            GL_CALL(block_idx = glGetUniformBlockIndex(id, uniform_block_names[i]));
+            if (block_idx != GL_INVALID_INDEX) {
+                GL_CALL(glUniformBlockBinding(id, block_idx, i));
+            }
         }
 
-        uniform_locations[name] = location;
+        missing_uniforms = 0;
+    }
+
+    inline int get_uniform_location(Uniform_Handle uniform) {
+#ifdef DEBUG_MODE
+        if (uniform_locations[uniform] == -1 && !HAS_FLAG(missing_uniforms, 1ull << uniform)) {
+            LOG_WARNING("Uniform '%s' doesn't exist.", uniform_names[uniform]);
+            SET_FLAG(missing_uniforms, 1ull << uniform);
+        }
+#endif // DEBUG_MODE
 
-        return location;
+        return uniform_locations[uniform];
     }
 
-    inline void bind() const                                      { GL_CALL(glUseProgram(id)); }
-    inline void unbind() const                                    { GL_CALL(glUseProgram(0)); }
+    inline void bind() const                                            { GL_CALL(glUseProgram(id)); }
+    inline void unbind() const                                          { GL_CALL(glUseProgram(0)); }
+
+    inline void set_uniform_1i(Uniform_Handle uniform, int v0)          { GL_CALL(glUniform1i(get_uniform_location(uniform), v0)); }
+    inline void set_uniform_1ui(Uniform_Handle uniform, uint v0)        { GL_CALL(glUniform1ui(get_uniform_location(uniform), v0)); }
+    inline void set_uniform_1f(Uniform_Handle uniform, float v0)        { GL_CALL(glUniform1f(get_uniform_location(uniform), v0)); }
+    inline void set_uniform_vec2(Uniform_Handle uniform, glm::vec2 val) { GL_CALL(glUniform2f(get_uniform_location(uniform), val.x, val.y)); }
+    inline void set_uniform_vec3(Uniform_Handle uniform, glm::vec3 val) { GL_CALL(glUniform3f(get_uniform_location(uniform), val.x, val.y, val.z)); }
+    inline void set_uniform_vec4(Uniform_Handle uniform, glm::vec4 val) { GL_CALL(glUniform4f(get_uniform_location(uniform), val.x, val.y, val.z, val.w)); }
+    inline void set_uniform_mat4(Uniform_Handle uniform, glm::mat4 val) { GL_CALL(glUniformMatrix4fv(get_uniform_location(uniform), 1, GL_FALSE, &val[0][0])); }
+
+    inline void set_uniform_vec4v(Uniform_Handle uniform, const glm::vec4 *vals, int count) {
+        GL_CALL(glUniform4fv(get_uniform_location(uniform), count, &vals[0][0]));
+    }
 
-    inline void set_uniform_1ui(const char *name, uint v0)        { GL_CALL(glUniform1ui(get_uniform_location(name), v0)); }
-    inline void set_uniform_vec3(const char *name, glm::vec3 val) { GL_CALL(glUniform3f(get_uniform_location(name), val.x, val.y, val.z)); }
-    inline void set_uniform_vec4(const char *name, glm::vec4 val) { GL_CALL(glUniform4f(get_uniform_location(name), val.x, val.y, val.z, val.w)); }
-    inline void set_uniform_mat4(const char *name, glm::mat4 val) { GL_CALL(glUniformMatrix4fv(get_uniform_location(name), 1, GL_FALSE, &val[0][0])); }
+    inline void set_uniform_mat3v(Uniform_Handle uniform, const glm::mat3 *vals, int count) {
+        GL_CALL(glUniformMatrix3fv(get_uniform_location(uniform), count, GL_FALSE, &vals[0][0][0]));
+    }
 };
 
 uint compile_shader(uint type, char *content) {
@@ -401,6 +1019,8 @@ uint compile_shader(uint type, char *content) {
             type_name = "vertex";
         } else if (type == GL_FRAGMENT_SHADER) {
             type_name = "fragment";
+        } else if (type == GL_GEOMETRY_SHADER) {
+            type_name = "geometry";
         } else {
             type_name = "compute";
         }
@@ -442,13 +1062,99 @@ Shader make_shader(const char *vs_path, const char *fs_path) {
     ASSERT(fs_content != nullptr);
 
     ret.id = link_shader(vs_content, fs_content);
+    ret.resolve_uniforms();
+
+    free(vs_content);
+    free(fs_content);
+
+    return ret;
+}
+
+uint link_shader(char *vs_content, char *gs_content, char *fs_content) {
+    uint program = 0;
+    GL_CALL(program = glCreateProgram());
+    uint vs_id = compile_shader(GL_VERTEX_SHADER, vs_content);
+    uint gs_id = compile_shader(GL_GEOMETRY_SHADER, gs_content);
+    uint fs_id = compile_shader(GL_FRAGMENT_SHADER, fs_content);
+
+    GL_CALL(glAttachShader(program, vs_id));
+    GL_CALL(glAttachShader(program, gs_id));
+    GL_CALL(glAttachShader(program, fs_id));
+    GL_CALL(glLinkProgram(program));
+    GL_CALL(glValidateProgram(program));
+
+    GL_CALL(glDeleteShader(vs_id));
+    GL_CALL(glDeleteShader(gs_id));
+    GL_CALL(glDeleteShader(fs_id));
+
+    return program;
+}
+
+Shader make_shader(const char *vs_path, const char *gs_path, const char *fs_path) {
+    Shader ret = {};
+
+    char *vs_content = get_file_content(vs_path);
+    ASSERT(vs_content != nullptr);
+
+    char *gs_content = get_file_content(gs_path);
+    ASSERT(gs_content != nullptr);
+
+    char *fs_content = get_file_content(fs_path);
+    ASSERT(fs_content != nullptr);
+
+    ret.id = link_shader(vs_content, gs_content, fs_content);
+    ret.resolve_uniforms();
 
     free(vs_content);
+    free(gs_content);
     free(fs_content);
 
     return ret;
 }
 
+uint link_compute_shader(char *cs_content) {
+    uint program = 0;
+    GL_CALL(program = glCreateProgram());
+    uint cs_id = compile_shader(GL_COMPUTE_SHADER, cs_content);
+    if (cs_id == 0) {
+        GL_CALL(glDeleteProgram(program));
+        return 0;
+    }
+
+    GL_CALL(glAttachShader(program, cs_id));
+    GL_CALL(glLinkProgram(program));
+
+    GL_CALL(glDeleteShader(cs_id));
+
+    int res = GL_FALSE;
+    GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &res));
+    if (res == GL_FALSE) {
+        LOG_ERROR("Failed to link compute shader.");
+
+        GL_CALL(glDeleteProgram(program));
+
+        return 0;
+    }
+
+    return program;
+}
+
+Shader make_compute_shader(const char *cs_path) {
+    Shader ret = {};
+
+    char *cs_content = get_file_content(cs_path);
+    ASSERT(cs_content != nullptr);
+
+    ret.id = link_compute_shader(cs_content);
+    if (ret.id != 0) {
+        ret.resolve_uniforms();
+    }
+
+    free(cs_content);
+
+    return ret;
+}
+
 void destroy(Shader &s) {
     GL_CALL(glDeleteProgram(s.id));
 }
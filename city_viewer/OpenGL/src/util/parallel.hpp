@@ -0,0 +1,70 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include "core.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------------------------------
+
+// Threads to run on when 'thread_count' are asked for, 0 meaning one per hardware thread
+inline uint get_thread_count(uint thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+    }
+
+    return MAX(thread_count, 1u);
+}
+
+// Calls 'proc(idx)' for every index in [0, count) from up to 'thread_count' threads, the calling
+// one included, and returns once all of them are done. Indices are claimed 'chunk_size' at a time
+// from a shared counter, so items of uneven cost still balance. Whatever 'proc' writes to the
+// slot of its index can then be merged in index order, the result never depends on the schedule.
+template <typename Proc>
+void parallel_for(size_t count, uint thread_count, Proc &&proc, size_t chunk_size = 1) {
+    size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+    thread_count = static_cast<uint>(MIN(static_cast<size_t>(MAX(thread_count, 1u)), chunk_count));
+
+    if (thread_count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            proc(i);
+        }
+
+        return;
+    }
+
+    std::atomic<size_t> next_idx = {0};
+
+    auto work = [&]() {
+        for (;;) {
+            size_t begin = next_idx.fetch_add(chunk_size, std::memory_order_relaxed);
+            if (begin >= count) {
+                return;
+            }
+
+            size_t end = MIN(begin + chunk_size, count);
+            for (size_t i = begin; i < end; ++i) {
+                proc(i);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+
+    for (uint i = 1; i < thread_count; ++i) {
+        threads.emplace_back(work);
+    }
+
+    work();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+#endif // PARALLEL_HPP
\ No newline at end of file
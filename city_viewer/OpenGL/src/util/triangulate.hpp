@@ -0,0 +1,708 @@
+#ifndef TRIANGULATE_HPP
+#define TRIANGULATE_HPP
+
+#include "core.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include <float.h>
+#include <math.h>
+
+// --------------------------------------------------------------------------------
+
+// Below this many vertices a polygon is clipped without the z-order index, scanning it all is cheaper
+#define TRIANGULATION_HASH_THRESHOLD 80
+
+// --------------------------------------------------------------------------------
+
+// Rings of a face, as vertex ranges. The first ring of every polygon is its outline, the others
+// are its holes; no orientation is assumed for either.
+struct Polygon_Rings {
+    std::vector<uint> ring_ends;    // One past the last vertex of each ring
+    std::vector<uint> polygon_ends; // One past the last ring of each polygon
+
+    void clear() {
+        ring_ends.clear();
+        polygon_ends.clear();
+    }
+};
+
+// --------------------------------------------------------------------------------
+
+/*
+Ear clipping over a doubly linked list of the polygon, holes bridged into the outline first. With
+more than TRIANGULATION_HASH_THRESHOLD vertices the nodes are also linked in z-order, so the test
+of an ear only visits the vertices inside its bounding box instead of the whole polygon, which is
+what keeps footprints with thousands of vertices around O(n log n).
+
+When no ear is left, duplicate and collinear points are filtered out, then small self-intersections
+are cut away, then the polygon is split along a valid diagonal and both halves are clipped on their
+own. Only if no such diagonal exists is a part left untriangulated.
+
+The output triangles are counter-clockwise in the plane of the points.
+*/
+struct Triangulator {
+    struct Node {
+        uint    idx;            // Vertex index written to the output
+        double  x, y;
+
+        Node   *prev, *next;    // Along the ring
+
+        uint    z;              // Morton code of the position
+        Node   *prev_z, *next_z;
+
+        bool    steiner;        // A degenerate hole reduced to a point, never filtered out
+    };
+
+    std::vector<Node>    nodes;
+    std::vector<Node *>  holes;
+
+    std::vector<uint>   *dst      = nullptr;
+
+    // Morton code transform, 'inv_size' is 0 when the z-order index is not used
+    double               min_x    = 0.0;
+    double               min_y    = 0.0;
+    double               inv_size = 0.0;
+
+    bool                 complete = true;
+
+// --------------------------------------------------------------------------------
+
+    static double area(const Node *p, const Node *q, const Node *r) {
+        return (q->x - p->x) * (r->y - p->y) - (q->y - p->y) * (r->x - p->x);
+    }
+
+    static bool equals(const Node *p, const Node *q) {
+        return p->x == q->x && p->y == q->y;
+    }
+
+    static bool point_in_triangle(double ax, double ay, double bx, double by, double cx, double cy, double px, double py) {
+        return (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+               (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+               (bx - px) * (cy - py) >= (cx - px) * (by - py);
+    }
+
+    static int sign(double val) {
+        return (val > 0.0) - (val < 0.0);
+    }
+
+    // 'q' within the bounding box of the collinear 'p' and 'r'
+    static bool on_segment(const Node *p, const Node *q, const Node *r) {
+        return q->x <= MAX(p->x, r->x) && q->x >= MIN(p->x, r->x) &&
+               q->y <= MAX(p->y, r->y) && q->y >= MIN(p->y, r->y);
+    }
+
+    static bool intersects(const Node *p0, const Node *q0, const Node *p1, const Node *q1) {
+        int o0 = sign(area(p0, q0, p1));
+        int o1 = sign(area(p0, q0, q1));
+        int o2 = sign(area(p1, q1, p0));
+        int o3 = sign(area(p1, q1, q0));
+
+        if (o0 != o1 && o2 != o3) {
+            return true;
+        }
+
+        return (o0 == 0 && on_segment(p0, p1, q0)) || (o1 == 0 && on_segment(p0, q1, q0)) ||
+               (o2 == 0 && on_segment(p1, p0, q1)) || (o3 == 0 && on_segment(p1, q0, q1));
+    }
+
+    // Whether the diagonal from 'a' to 'b' leaves 'a' towards the inside of the polygon
+    static bool locally_inside(const Node *a, const Node *b) {
+        if (area(a->prev, a, a->next) > 0.0) {
+            return area(a, b, a->next) <= 0.0 && area(a, a->prev, b) <= 0.0;
+        }
+
+        return area(a, b, a->prev) > 0.0 || area(a, a->next, b) > 0.0;
+    }
+
+    static bool middle_inside(const Node *a, const Node *b) {
+        double px = (a->x + b->x) * 0.5;
+        double py = (a->y + b->y) * 0.5;
+
+        bool inside = false;
+        const Node *p = a;
+
+        do {
+            if (((p->y > py) != (p->next->y > py)) && p->next->y != p->y &&
+                (px < (p->next->x - p->x) * (py - p->y) / (p->next->y - p->y) + p->x)) {
+                inside = !inside;
+            }
+
+            p = p->next;
+        } while (p != a);
+
+        return inside;
+    }
+
+    static bool intersects_polygon(const Node *a, const Node *b) {
+        const Node *p = a;
+
+        do {
+            if (p->idx != a->idx && p->next->idx != a->idx && p->idx != b->idx && p->next->idx != b->idx &&
+                intersects(p, p->next, a, b)) {
+                return true;
+            }
+
+            p = p->next;
+        } while (p != a);
+
+        return false;
+    }
+
+    static bool is_valid_diagonal(const Node *a, const Node *b) {
+        if (a->next->idx == b->idx || a->prev->idx == b->idx || intersects_polygon(a, b)) {
+            return false;
+        }
+
+        // Either a proper diagonal or the two ends of a bridge meeting at the same point
+        return (locally_inside(a, b) && locally_inside(b, a) && middle_inside(a, b) &&
+                (area(a->prev, a, b->prev) != 0.0 || area(a, b->prev, b) != 0.0)) ||
+               (equals(a, b) && area(a->prev, a, a->next) < 0.0 && area(b->prev, b, b->next) < 0.0);
+    }
+
+    // Whether the wedge of 'p' lies in the wedge of 'm', both being at the same point
+    static bool sector_contains_sector(const Node *m, const Node *p) {
+        return area(m->prev, m, p->prev) > 0.0 && area(p->next, m, m->next) > 0.0;
+    }
+
+// --------------------------------------------------------------------------------
+
+    Node *insert_node(uint idx, double x, double y, Node *last) {
+        // Nodes are linked by address, the capacity reserved up front is never exceeded
+        ASSERT(nodes.size() < nodes.capacity());
+
+        nodes.push_back({idx, x, y, nullptr, nullptr, 0, nullptr, nullptr, false});
+        Node *p = &nodes.back();
+
+        if (last == nullptr) {
+            p->prev = p;
+            p->next = p;
+        } else {
+            p->next = last->next;
+            p->prev = last;
+            last->next->prev = p;
+            last->next = p;
+        }
+
+        return p;
+    }
+
+    static void remove_node(Node *p) {
+        p->next->prev = p->prev;
+        p->prev->next = p->next;
+
+        if (p->prev_z != nullptr) {
+            p->prev_z->next_z = p->next_z;
+        }
+
+        if (p->next_z != nullptr) {
+            p->next_z->prev_z = p->prev_z;
+        }
+    }
+
+    // Counter-clockwise for the outline, clockwise for a hole. Returns the last node.
+    Node *make_ring(const glm::vec2 *points, uint begin, uint end, uint base_idx, bool outline) {
+        double signed_area = 0.0;
+        for (uint i = begin, j = end - 1; i < end; j = i++) {
+            signed_area += (static_cast<double>(points[j].x) - points[i].x) * (static_cast<double>(points[i].y) + points[j].y);
+        }
+
+        Node *last = nullptr;
+
+        if (outline == (signed_area > 0.0)) {
+            for (uint i = begin; i < end; ++i) {
+                last = insert_node(base_idx + i, points[i].x, points[i].y, last);
+            }
+        } else {
+            for (uint i = end; i-- > begin;) {
+                last = insert_node(base_idx + i, points[i].x, points[i].y, last);
+            }
+        }
+
+        if (last != nullptr && equals(last, last->next)) {
+            Node *next = last->next;
+            remove_node(last);
+            last = next;
+        }
+
+        return last;
+    }
+
+    // Removes duplicate and collinear points from 'start' up to 'end', the whole ring by default
+    static Node *filter_points(Node *start, Node *end = nullptr) {
+        if (start == nullptr) {
+            return start;
+        }
+
+        if (end == nullptr) {
+            end = start;
+        }
+
+        Node *p = start;
+        bool again;
+
+        do {
+            again = false;
+
+            if (!p->steiner && (equals(p, p->next) || area(p->prev, p, p->next) == 0.0)) {
+                remove_node(p);
+                p = end = p->prev;
+
+                if (p == p->next) {
+                    break;
+                }
+
+                again = true;
+            } else {
+                p = p->next;
+            }
+        } while (again || p != end);
+
+        return end;
+    }
+
+    // Links 'b' to 'a' by two overlapping edges, splitting the ring in two when both are on it
+    // or merging two rings when they are not. Returns the node starting the other half.
+    Node *split_polygon(Node *a, Node *b) {
+        Node *a2 = insert_node(a->idx, a->x, a->y, nullptr);
+        Node *b2 = insert_node(b->idx, b->x, b->y, nullptr);
+
+        Node *an = a->next;
+        Node *bp = b->prev;
+
+        a->next = b;
+        b->prev = a;
+
+        a2->next = an;
+        an->prev = a2;
+
+        b2->next = a2;
+        a2->prev = b2;
+
+        bp->next = b2;
+        b2->prev = bp;
+
+        return b2;
+    }
+
+// --------------------------------------------------------------------------------
+
+    uint z_order(double x, double y) const {
+        uint ix = static_cast<uint>((x - min_x) * inv_size);
+        uint iy = static_cast<uint>((y - min_y) * inv_size);
+
+        ix = (ix | (ix << 8)) & 0x00FF00FF;
+        ix = (ix | (ix << 4)) & 0x0F0F0F0F;
+        ix = (ix | (ix << 2)) & 0x33333333;
+        ix = (ix | (ix << 1)) & 0x55555555;
+
+        iy = (iy | (iy << 8)) & 0x00FF00FF;
+        iy = (iy | (iy << 4)) & 0x0F0F0F0F;
+        iy = (iy | (iy << 2)) & 0x33333333;
+        iy = (iy | (iy << 1)) & 0x55555555;
+
+        return ix | (iy << 1);
+    }
+
+    // Bottom up merge sort of the z-order list
+    static Node *sort_linked(Node *list) {
+        uint in_size = 1;
+        uint num_merges;
+
+        do {
+            Node *p = list, *tail = nullptr;
+            list = nullptr;
+            num_merges = 0;
+
+            while (p != nullptr) {
+                ++num_merges;
+
+                Node *q = p;
+                uint p_size = 0;
+
+                for (uint i = 0; i < in_size; ++i) {
+                    ++p_size;
+                    q = q->next_z;
+
+                    if (q == nullptr) {
+                        break;
+                    }
+                }
+
+                uint q_size = in_size;
+
+                while (p_size > 0 || (q_size > 0 && q != nullptr)) {
+                    Node *e;
+
+                    if (p_size != 0 && (q_size == 0 || q == nullptr || p->z <= q->z)) {
+                        e = p;
+                        p = p->next_z;
+                        --p_size;
+                    } else {
+                        e = q;
+                        q = q->next_z;
+                        --q_size;
+                    }
+
+                    if (tail != nullptr) {
+                        tail->next_z = e;
+                    } else {
+                        list = e;
+                    }
+
+                    e->prev_z = tail;
+                    tail = e;
+                }
+
+                p = q;
+            }
+
+            tail->next_z = nullptr;
+            in_size *= 2;
+        } while (num_merges > 1);
+
+        return list;
+    }
+
+    void index_curve(Node *start) {
+        Node *p = start;
+
+        do {
+            p->z = z_order(p->x, p->y);
+            p->prev_z = p->prev;
+            p->next_z = p->next;
+            p = p->next;
+        } while (p != start);
+
+        p->prev_z->next_z = nullptr;
+        p->prev_z = nullptr;
+
+        sort_linked(p);
+    }
+
+// --------------------------------------------------------------------------------
+
+    // Convex, and no reflex vertex of the polygon inside
+    static bool is_ear(const Node *ear) {
+        const Node *a = ear->prev, *b = ear, *c = ear->next;
+
+        if (area(a, b, c) <= 0.0) {
+            return false;
+        }
+
+        double x0 = MIN(a->x, MIN(b->x, c->x)), y0 = MIN(a->y, MIN(b->y, c->y));
+        double x1 = MAX(a->x, MAX(b->x, c->x)), y1 = MAX(a->y, MAX(b->y, c->y));
+
+        for (const Node *p = c->next; p != a; p = p->next) {
+            if (p->x >= x0 && p->x <= x1 && p->y >= y0 && p->y <= y1 &&
+                point_in_triangle(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) &&
+                area(p->prev, p, p->next) <= 0.0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Same as 'is_ear', only visiting the nodes whose z-order is in the ear's bounding box
+    bool is_ear_hashed(const Node *ear) const {
+        const Node *a = ear->prev, *b = ear, *c = ear->next;
+
+        if (area(a, b, c) <= 0.0) {
+            return false;
+        }
+
+        double x0 = MIN(a->x, MIN(b->x, c->x)), y0 = MIN(a->y, MIN(b->y, c->y));
+        double x1 = MAX(a->x, MAX(b->x, c->x)), y1 = MAX(a->y, MAX(b->y, c->y));
+
+        uint min_z = z_order(x0, y0);
+        uint max_z = z_order(x1, y1);
+
+        auto blocks_ear = [&](const Node *p) {
+            return p->x >= x0 && p->x <= x1 && p->y >= y0 && p->y <= y1 && p != a && p != c &&
+                   point_in_triangle(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) &&
+                   area(p->prev, p, p->next) <= 0.0;
+        };
+
+        // Both directions at once, the first half tends to find a blocking vertex sooner
+        const Node *p = ear->prev_z, *n = ear->next_z;
+
+        while (p != nullptr && p->z >= min_z && n != nullptr && n->z <= max_z) {
+            if (blocks_ear(p) || blocks_ear(n)) {
+                return false;
+            }
+
+            p = p->prev_z;
+            n = n->next_z;
+        }
+
+        for (; p != nullptr && p->z >= min_z; p = p->prev_z) {
+            if (blocks_ear(p)) {
+                return false;
+            }
+        }
+
+        for (; n != nullptr && n->z <= max_z; n = n->next_z) {
+            if (blocks_ear(n)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void emit(const Node *a, const Node *b, const Node *c) {
+        dst->push_back(a->idx);
+        dst->push_back(b->idx);
+        dst->push_back(c->idx);
+    }
+
+    // Clips the small loops of self-intersecting outlines, two crossing edges around one vertex
+    Node *cure_local_intersections(Node *start) {
+        Node *p = start;
+
+        do {
+            Node *a = p->prev, *b = p->next->next;
+
+            if (!equals(a, b) && intersects(a, p, p->next, b) && locally_inside(a, b) && locally_inside(b, a)) {
+                emit(a, p, b);
+
+                remove_node(p);
+                remove_node(p->next);
+
+                p = start = b;
+            }
+
+            p = p->next;
+        } while (p != start);
+
+        return filter_points(p);
+    }
+
+    // Last resort, clips the halves of the first valid diagonal found on their own
+    void split_clip(Node *start) {
+        Node *a = start;
+
+        do {
+            for (Node *b = a->next->next; b != a->prev; b = b->next) {
+                if (a->idx != b->idx && is_valid_diagonal(a, b)) {
+                    Node *c = split_polygon(a, b);
+
+                    a = filter_points(a, a->next);
+                    c = filter_points(c, c->next);
+
+                    clip_ears(a, 0);
+                    clip_ears(c, 0);
+
+                    return;
+                }
+            }
+
+            a = a->next;
+        } while (a != start);
+
+        complete = false;
+    }
+
+    // 'pass' 0 is plain clipping, 1 after filtering points, 2 after curing self-intersections
+    void clip_ears(Node *ear, int pass) {
+        if (ear == nullptr) {
+            return;
+        }
+
+        if (pass == 0 && inv_size != 0.0) {
+            index_curve(ear);
+        }
+
+        Node *stop = ear;
+
+        while (ear->prev != ear->next) {
+            Node *prev = ear->prev;
+            Node *next = ear->next;
+
+            if (inv_size != 0.0 ? is_ear_hashed(ear) : is_ear(ear)) {
+                emit(prev, ear, next);
+
+                remove_node(ear);
+
+                // Skipping the next vertex leaves fewer sliver triangles
+                ear = next->next;
+                stop = next->next;
+
+                continue;
+            }
+
+            ear = next;
+
+            if (ear == stop) {
+                if (pass == 0) {
+                    clip_ears(filter_points(ear), 1);
+                } else if (pass == 1) {
+                    clip_ears(cure_local_intersections(filter_points(ear)), 2);
+                } else {
+                    split_clip(ear);
+                }
+
+                break;
+            }
+        }
+    }
+
+// --------------------------------------------------------------------------------
+
+    // The visible outline vertex a hole is bridged to: the closest one to the left of its leftmost
+    // vertex, or the least steep one from it among the reflex vertices in the way
+    static Node *find_hole_bridge(Node *hole, Node *outer) {
+        double hx = hole->x, hy = hole->y;
+        double qx = -DBL_MAX;
+
+        Node *p = outer, *m = nullptr;
+
+        do {
+            if (hy <= p->y && hy >= p->next->y && p->next->y != p->y) {
+                double x = p->x + (hy - p->y) * (p->next->x - p->x) / (p->next->y - p->y);
+
+                if (x <= hx && x > qx) {
+                    qx = x;
+                    m = p->x < p->next->x ? p : p->next;
+
+                    if (x == hx) {
+                        return m;
+                    }
+                }
+            }
+
+            p = p->next;
+        } while (p != outer);
+
+        if (m == nullptr) {
+            return nullptr;
+        }
+
+        Node *stop = m;
+        double mx = m->x, my = m->y;
+        double tan_min = DBL_MAX;
+
+        p = m;
+
+        do {
+            if (hx >= p->x && p->x >= mx && hx != p->x &&
+                point_in_triangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->x, p->y)) {
+                double tan = fabs(hy - p->y) / (hx - p->x);
+
+                if (locally_inside(p, hole) &&
+                    (tan < tan_min || (tan == tan_min && (p->x > m->x || (p->x == m->x && sector_contains_sector(m, p)))))) {
+                    m = p;
+                    tan_min = tan;
+                }
+            }
+
+            p = p->next;
+        } while (p != stop);
+
+        return m;
+    }
+
+    Node *eliminate_hole(Node *hole, Node *outer) {
+        Node *bridge = find_hole_bridge(hole, outer);
+
+        if (bridge == nullptr) {
+            return outer;
+        }
+
+        Node *bridge_reverse = split_polygon(bridge, hole);
+
+        filter_points(bridge_reverse, bridge_reverse->next);
+        return filter_points(bridge, bridge->next);
+    }
+
+// --------------------------------------------------------------------------------
+
+    // Appends the triangles of the polygon whose outline is the first of the rings ending at
+    // 'ring_ends' to 'out', as vertex indices offset by 'base_idx'. False if a part of it could
+    // not be triangulated.
+    bool triangulate(std::vector<uint> &out, const glm::vec2 *points, const uint *ring_ends, size_t ring_count, uint base_idx = 0) {
+        if (ring_count == 0) {
+            return true;
+        }
+
+        uint point_count = ring_ends[ring_count - 1];
+
+        dst = &out;
+        complete = true;
+        inv_size = 0.0;
+
+        // Every bridge and split adds two nodes, a split at most once per vertex
+        nodes.clear();
+        nodes.reserve(3 * (point_count + 2 * ring_count));
+
+        Node *outer = make_ring(points, 0, ring_ends[0], base_idx, true);
+
+        if (outer == nullptr || outer->next == outer->prev) {
+            return true;
+        }
+
+        if (ring_count > 1) {
+            holes.clear();
+
+            for (size_t r = 1; r < ring_count; ++r) {
+                Node *list = make_ring(points, ring_ends[r - 1], ring_ends[r], base_idx, false);
+
+                if (list == nullptr) {
+                    continue;
+                }
+
+                if (list == list->next) {
+                    list->steiner = true;
+                }
+
+                // Bridged from their leftmost vertex, left to right
+                Node *leftmost = list;
+                for (Node *p = list->next; p != list; p = p->next) {
+                    if (p->x < leftmost->x || (p->x == leftmost->x && p->y < leftmost->y)) {
+                        leftmost = p;
+                    }
+                }
+
+                holes.push_back(leftmost);
+            }
+
+            std::sort(holes.begin(), holes.end(), [](const Node *a, const Node *b) {
+                return a->x < b->x || (a->x == b->x && a->y < b->y);
+            });
+
+            for (Node *hole : holes) {
+                outer = eliminate_hole(hole, outer);
+            }
+        }
+
+        if (point_count > TRIANGULATION_HASH_THRESHOLD) {
+            double max_x = -DBL_MAX, max_y = -DBL_MAX;
+
+            min_x = DBL_MAX;
+            min_y = DBL_MAX;
+
+            for (uint i = 0; i < point_count; ++i) {
+                min_x = MIN(min_x, static_cast<double>(points[i].x));
+                min_y = MIN(min_y, static_cast<double>(points[i].y));
+                max_x = MAX(max_x, static_cast<double>(points[i].x));
+                max_y = MAX(max_y, static_cast<double>(points[i].y));
+            }
+
+            // Codes are 15 bits per axis
+            double size = MAX(max_x - min_x, max_y - min_y);
+            inv_size = size != 0.0 ? 32767.0 / size : 0.0;
+        }
+
+        clip_ears(outer, 0);
+
+        return complete;
+    }
+};
+
+// --------------------------------------------------------------------------------
+
+#endif // TRIANGULATE_HPP
\ No newline at end of file